@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sflib.h"
+
+/*
+    sfbench: throughput of the stringfun kernels
+
+    usage: sfbench [MB] [rounds] [threads]
+
+    Builds MB megabytes (default 256) of text with words of 1 to 12
+    letters and runs of 1 to 3 whitespace bytes, then times every kernel
+    the cpu supports over it and reports the best round in GB/s, for the
+    word count and for the blank squeeze setup_buff runs.  The best
+    kernel is then timed with sf_count_words_mt() on 1, 2, 4 ... threads
+    up to threads (default: the number of cpus).
+
+    Last sf_find() is timed against the nested loop replace_string used to
+    have, on the worst case for the loop: hay of all 'a' and a needle of
+    m - 1 'a' and a 'b', which never matches.  The loop does about m
+    compares per byte and slows down as m grows, sf_find does not.
+
+    The Aho-Corasick scan -m does is timed over the text with 1 to 10000
+    random patterns of 3 to 10 letters, all matches found in one pass.
+    The table grows with the patterns but the work per byte stays one
+    load, so GB/s should drop only once the table falls out of cache.
+*/
+#define BENCH_MB        256
+#define BENCH_ROUNDS    5
+#define FIND_MB         4       //hay for the find runs, the loop is slow
+#define NAIVE_MAX_M     1024    //longest needle the loop is timed on
+#define AC_MB           64      //text for the multi pattern runs
+
+static double now_sec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *make_text(size_t len, size_t *words){
+    static const char ws[] = " \t\n";
+    char *text = malloc(len);
+    size_t i = 0;
+
+    if (!text) return NULL;
+    srand(42);
+    *words = 0;
+    while (i < len) {
+        int n = 1 + rand() % 12;
+        (*words)++;
+        for (int k = 0; k < n && i < len; k++) text[i++] = 'a' + rand() % 26;
+        n = 1 + rand() % 3;
+        for (int k = 0; k < n && i < len; k++) text[i++] = ws[rand() % 3];
+    }
+    return text;
+}
+
+//the search replace_string did before sf_find()
+static const char *find_naive(const char *hay, size_t hay_len, const char *needle, size_t needle_len){
+    for (const char *start = hay; start + needle_len <= hay + hay_len; start++) {
+        size_t i = 0;
+        while (i < needle_len && start[i] == needle[i]) i++;
+        if (i == needle_len) return start;
+    }
+    return NULL;
+}
+
+//GB/s of the best round of find over hay, which must not contain needle
+static double time_find(const char *(*find)(const char *, size_t, const char *, size_t),
+                        const char *hay, size_t hay_len, const char *needle, size_t m, int rounds){
+    double best = 0;
+    for (int r = 0; r < rounds; r++) {
+        double start = now_sec();
+        if (find(hay, hay_len, needle, m) != NULL) return -1;
+        double sec = now_sec() - start;
+        if (best == 0 || sec < best) best = sec;
+    }
+    return hay_len / best / 1e9;
+}
+
+static int bench_find(int rounds){
+    static const size_t lens[] = { 2, 16, 64, 256, 1024, 4096 };
+    size_t hay_len = (size_t)FIND_MB << 20;
+    char *hay = malloc(hay_len);
+    char *needle = malloc(lens[sizeof(lens) / sizeof(lens[0]) - 1]);
+
+    if (!hay || !needle) {
+        free(hay);
+        free(needle);
+        return 99;
+    }
+    memset(hay, 'a', hay_len);
+    printf("\n%-10s %10s %14s %8s\n", "find", "m", "naive GB/s", "GB/s");
+    for (size_t k = 0; k < sizeof(lens) / sizeof(lens[0]); k++) {
+        size_t m = lens[k];
+        memset(needle, 'a', m - 1);
+        needle[m - 1] = 'b';
+        double fast = time_find(sf_find, hay, hay_len, needle, m, rounds);
+        if (m <= NAIVE_MAX_M) {
+            double naive = time_find(find_naive, hay, hay_len, needle, m, 1);
+            printf("%-10s %10zu %14.3f %8.2f\n", "a..ab", m, naive, fast);
+        } else {
+            printf("%-10s %10zu %14s %8.2f\n", "a..ab", m, "-", fast);
+        }
+    }
+    free(hay);
+    free(needle);
+    return 0;
+}
+
+static int bench_ac(const char *text, size_t len, int rounds){
+    static const int counts[] = { 1, 10, 100, 1000, 10000 };
+    int max_pats = counts[sizeof(counts) / sizeof(counts[0]) - 1];
+    char **pats = malloc(max_pats * sizeof(char *));
+    size_t *lens = malloc(max_pats * sizeof(size_t));
+    char *store = malloc((size_t)max_pats * 10);
+    int rc = 0;
+
+    if (!pats || !lens || !store) {
+        rc = 99;
+        goto done;
+    }
+    srand(7);
+    for (int i = 0; i < max_pats; i++) {
+        pats[i] = store + (size_t)i * 10;
+        lens[i] = 3 + rand() % 8;
+        for (size_t k = 0; k < lens[i]; k++) pats[i][k] = 'a' + rand() % 26;
+    }
+
+    printf("\n%-10s %10s %14s %8s\n", "patterns", "MB", "matches", "GB/s");
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        sf_ac_t *ac = sf_ac_build(pats, lens, counts[c]);
+        if (!ac) {
+            rc = 99;
+            goto done;
+        }
+        double best = 0;
+        size_t matches = 0;
+        for (int r = 0; r < rounds; r++) {
+            size_t pos = 0, start, safe;
+            int k;
+            double t0 = now_sec();
+            matches = 0;
+            while ((k = sf_ac_find(ac, text + pos, len - pos, 1, &start, &safe)) >= 0) {
+                pos += start + lens[k];
+                matches++;
+            }
+            double sec = now_sec() - t0;
+            if (best == 0 || sec < best) best = sec;
+        }
+        printf("%-10d %10zu %14zu %8.2f\n", counts[c], len >> 20, matches, len / best / 1e9);
+        sf_ac_free(ac);
+    }
+
+done:
+    free(pats);
+    free(lens);
+    free(store);
+    return rc;
+}
+
+int main(int argc, char *argv[]){
+    static const char *names[] = { "scalar", "sse2", "ssse3", "avx2" };
+    size_t mb = argc > 1 ? strtoul(argv[1], NULL, 10) : BENCH_MB;
+    int rounds = argc > 2 ? atoi(argv[2]) : BENCH_ROUNDS;
+    int max_threads = argc > 3 ? atoi(argv[3]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    size_t len = mb << 20;
+    size_t words;
+    int rc = 0;
+
+    if (mb == 0 || rounds <= 0 || max_threads <= 0) {
+        printf("usage: %s [MB] [rounds] [threads]\n", argv[0]);
+        return 1;
+    }
+    char *text = make_text(len, &words);
+    if (!text) {
+        printf("Failed to allocate memory\n");
+        return 99;
+    }
+
+    printf("%-10s %10s %14s %8s\n", "kernel", "MB", "words", "GB/s");
+    for (size_t k = 0; k < sizeof(names) / sizeof(names[0]); k++) {
+        if (sf_use_kernel(names[k]) != 0) {
+            printf("%-10s %10s\n", names[k], "n/a");
+            continue;
+        }
+        double best = 0;
+        size_t count = 0;
+        for (int r = 0; r < rounds; r++) {
+            int in_word = 0;
+            double start = now_sec();
+            count = sf_count_words(text, len, &in_word);
+            double sec = now_sec() - start;
+            if (best == 0 || sec < best) best = sec;
+        }
+        printf("%-10s %10zu %14zu %8.2f\n", names[k], mb, count, len / best / 1e9);
+        if (count != words) {
+            printf("%s counted %zu words, expected %zu\n", names[k], count, words);
+            rc = 2;
+        }
+    }
+
+    char *squeezed = malloc(len + SF_SQUEEZE_SLACK);
+    size_t expect = 0;
+    if (!squeezed) {
+        free(text);
+        printf("Failed to allocate memory\n");
+        return 99;
+    }
+    printf("\n%-10s %10s %14s %8s\n", "squeeze", "MB", "bytes out", "GB/s");
+    for (size_t k = 0; k < sizeof(names) / sizeof(names[0]); k++) {
+        if (sf_use_kernel(names[k]) != 0) {
+            printf("%-10s %10s\n", names[k], "n/a");
+            continue;
+        }
+        double best = 0;
+        size_t out = 0;
+        for (int r = 0; r < rounds; r++) {
+            int blank = 1;
+            double start = now_sec();
+            out = sf_squeeze_blanks(squeezed, text, len, &blank);
+            double sec = now_sec() - start;
+            if (best == 0 || sec < best) best = sec;
+        }
+        printf("%-10s %10zu %14zu %8.2f\n", names[k], mb, out, len / best / 1e9);
+        if (expect == 0) expect = out;
+        if (out != expect) {
+            printf("%s squeezed to %zu bytes, expected %zu\n", names[k], out, expect);
+            rc = 2;
+        }
+    }
+    free(squeezed);
+
+    sf_use_kernel(NULL);
+    printf("\n%-10s %10s %14s %8s\n", "threads", "kernel", "words", "GB/s");
+    for (int t = 1; t <= max_threads; t = t * 2 > max_threads && t < max_threads ? max_threads : t * 2) {
+        double best = 0;
+        size_t count = 0;
+        for (int r = 0; r < rounds; r++) {
+            double start = now_sec();
+            count = sf_count_words_mt(text, len, t);
+            double sec = now_sec() - start;
+            if (best == 0 || sec < best) best = sec;
+        }
+        printf("%-10d %10s %14zu %8.2f\n", t, sf_kernel_name(), count, len / best / 1e9);
+        if (count != words) {
+            printf("%d threads counted %zu words, expected %zu\n", t, count, words);
+            rc = 2;
+        }
+    }
+    if (bench_ac(text, len < ((size_t)AC_MB << 20) ? len : (size_t)AC_MB << 20, rounds) != 0) rc = 99;
+    free(text);
+    return bench_find(rounds) ? 99 : rc;
+}
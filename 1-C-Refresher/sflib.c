@@ -0,0 +1,973 @@
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SF_X86 1
+#endif
+
+#include "sflib.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024            //the smallest limit in use, Linux has it
+#endif
+
+/*
+    Word counting
+
+    A word starts at every byte that is not whitespace and follows one
+    that is.  The vector kernels classify 64 bytes at a time into a bit
+    mask ws with bit i set when byte i is whitespace, so the starts in the
+    block are
+
+        ~ws & (ws << 1 | carry)
+
+    where carry is 1 when the last byte of the previous block was
+    whitespace.  Counting them is one popcount per 64 bytes with no
+    branches on the data.  Tails shorter than a block go through the
+    scalar loop, which keeps the same carry.
+*/
+typedef size_t (*count_fn)(const char *, size_t, int *);
+
+static size_t count_scalar(const char *buf, size_t len, int *in_word){
+    size_t word_count = 0;
+    int in = *in_word;
+
+    for (const char *ptr = buf; ptr < buf + len; ptr++) {
+        int space = SF_IS_SPACE(*ptr);
+        word_count += !space & !in;
+        in = !space;
+    }
+    *in_word = in;
+    return word_count;
+}
+
+//bit i of the result is set when a block with whitespace mask ws has a
+//word starting at byte i
+static inline uint64_t word_starts(uint64_t ws, uint64_t *carry){
+    uint64_t starts = ~ws & (ws << 1 | *carry);
+    *carry = ws >> 63;
+    return starts;
+}
+
+#ifdef SF_X86
+static inline __m128i space_mask_sse2(__m128i v){
+    //bytes above 0x7f are negative and fail the signed compares
+    __m128i ctl = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('\t' - 1)),
+                                _mm_cmplt_epi8(v, _mm_set1_epi8('\r' + 1)));
+    return _mm_or_si128(ctl, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+}
+
+__attribute__((target("sse2")))
+static size_t count_sse2(const char *buf, size_t len, int *in_word){
+    size_t word_count = 0;
+    uint64_t carry = !*in_word;
+    size_t i = 0;
+
+    for (; i + 64 <= len; i += 64) {
+        uint64_t ws = 0;
+        for (int k = 0; k < 4; k++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(buf + i + 16 * k));
+            ws |= (uint64_t)(uint16_t)_mm_movemask_epi8(space_mask_sse2(v)) << (16 * k);
+        }
+        word_count += __builtin_popcountll(word_starts(ws, &carry));
+    }
+    *in_word = !carry;
+    return word_count + count_scalar(buf + i, len - i, in_word);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t count_avx2(const char *buf, size_t len, int *in_word){
+    const __m256i lo = _mm256_set1_epi8('\t' - 1);
+    const __m256i hi = _mm256_set1_epi8('\r' + 1);
+    const __m256i sp = _mm256_set1_epi8(' ');
+    size_t word_count = 0;
+    uint64_t carry = !*in_word;
+    size_t i = 0;
+
+    for (; i + 64 <= len; i += 64) {
+        uint64_t ws = 0;
+        for (int k = 0; k < 2; k++) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i + 32 * k));
+            __m256i ctl = _mm256_and_si256(_mm256_cmpgt_epi8(v, lo), _mm256_cmpgt_epi8(hi, v));
+            __m256i m = _mm256_or_si256(ctl, _mm256_cmpeq_epi8(v, sp));
+            ws |= (uint64_t)(uint32_t)_mm256_movemask_epi8(m) << (32 * k);
+        }
+        word_count += _mm_popcnt_u64(word_starts(ws, &carry));
+    }
+    *in_word = !carry;
+    return word_count + count_scalar(buf + i, len - i, in_word);
+}
+#endif
+
+/*
+    Blank squeezing
+
+    Blanks are spaces and tabs.  A blank is kept, as a space, when the
+    byte before it is not a blank, every other byte is kept as is.  With b
+    the blank mask of a block that is
+
+        keep = ~(b & (b << 1 | carry))
+
+    the same carry trick as the word count.  The ssse3 and avx2 kernels
+    work on vectors only: blanks become spaces and the kept bytes of each
+    half of a 16 byte lane are moved to the front with pshufb, the shuffle
+    coming from a table indexed by the 8 bits of keep.  Each half is
+    stored whole, 8 bytes, and the output pointer only moves by the number
+    kept, hence the slack the caller leaves.  A block that keeps every
+    byte is stored straight through.  The sse2 kernel set has no pshufb
+    and squeezes with the scalar loop.
+*/
+typedef size_t (*squeeze_fn)(char *, const char *, size_t, int *);
+
+static size_t squeeze_scalar(char *dst, const char *src, size_t len, int *blank){
+    char *out = dst;
+    int prev = *blank;
+
+    for (size_t i = 0; i < len; i++) {
+        int b = src[i] == ' ' || src[i] == '\t';
+        *out = b ? ' ' : src[i];
+        out += !(b & prev);
+        prev = b;
+    }
+    *blank = prev;
+    return out - dst;
+}
+
+#ifdef SF_X86
+//byte j of squeeze_shuf[m] is the position of the j-th set bit of m
+static uint64_t squeeze_shuf[256];
+static pthread_once_t squeeze_once = PTHREAD_ONCE_INIT;
+
+static void squeeze_init(void){
+    for (int m = 0; m < 256; m++) {
+        uint64_t idx = 0;
+        for (int bit = 0, j = 0; bit < 8; bit++)
+            if (m >> bit & 1) idx |= (uint64_t)bit << (8 * j++);
+        squeeze_shuf[m] = idx;
+    }
+}
+
+//moves the bytes of v picked by keep to out, returns the new end.  Inlined
+//into the avx2 kernel the popcounts become popcnt.
+__attribute__((target("ssse3")))
+static inline char *squeeze_lane(char *out, __m128i v, uint32_t keep){
+    uint64_t lo = squeeze_shuf[keep & 0xff];
+    uint64_t hi = squeeze_shuf[keep >> 8 & 0xff] + 0x0808080808080808ULL;
+    __m128i r = _mm_shuffle_epi8(v, _mm_set_epi64x(hi, lo));
+
+    _mm_storel_epi64((__m128i *)out, r);
+    out += __builtin_popcount(keep & 0xff);
+    _mm_storel_epi64((__m128i *)out, _mm_unpackhi_epi64(r, r));
+    return out + __builtin_popcount(keep >> 8 & 0xff);
+}
+
+__attribute__((target("ssse3")))
+static size_t squeeze_ssse3(char *dst, const char *src, size_t len, int *blank){
+    const __m128i sp = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    char *out = dst;
+    uint32_t carry = *blank;
+    size_t i = 0;
+
+    pthread_once(&squeeze_once, squeeze_init);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i is_blank = _mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab));
+        uint32_t b = _mm_movemask_epi8(is_blank);
+        uint32_t keep = ~(b & (b << 1 | carry)) & 0xffff;
+        //no pblendvb before sse4.1, blanks are turned into spaces with masks
+        v = _mm_or_si128(_mm_andnot_si128(is_blank, v), _mm_and_si128(is_blank, sp));
+        if (keep == 0xffff) {
+            _mm_storeu_si128((__m128i *)out, v);
+            out += 16;
+        } else {
+            out = squeeze_lane(out, v, keep);
+        }
+        carry = b >> 15;
+    }
+    *blank = carry;
+    return (out - dst) + squeeze_scalar(out, src + i, len - i, blank);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t squeeze_avx2(char *dst, const char *src, size_t len, int *blank){
+    const __m256i sp = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    char *out = dst;
+    uint64_t carry = *blank;
+    size_t i = 0;
+
+    pthread_once(&squeeze_once, squeeze_init);
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i is_blank = _mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, tab));
+        uint64_t b = (uint32_t)_mm256_movemask_epi8(is_blank);
+        uint32_t keep = ~(b & (b << 1 | carry));
+        v = _mm256_blendv_epi8(v, sp, is_blank);
+        if (keep == 0xffffffff) {
+            _mm256_storeu_si256((__m256i *)out, v);
+            out += 32;
+        } else {
+            out = squeeze_lane(out, _mm256_castsi256_si128(v), keep);
+            out = squeeze_lane(out, _mm256_extracti128_si256(v, 1), keep >> 16);
+        }
+        carry = b >> 31;
+    }
+    *blank = carry;
+    return (out - dst) + squeeze_scalar(out, src + i, len - i, blank);
+}
+#endif
+
+static const struct {
+    const char *name;
+    count_fn fn;
+    squeeze_fn squeeze;
+} kernels[] = {
+#ifdef SF_X86
+    { "avx2", count_avx2, squeeze_avx2 },
+    { "ssse3", count_sse2, squeeze_ssse3 },
+    { "sse2", count_sse2, squeeze_scalar },
+#endif
+    { "scalar", count_scalar, squeeze_scalar },
+};
+
+static count_fn count_impl;
+static squeeze_fn squeeze_impl;
+static const char *count_name;
+
+static int kernel_ok(const char *name){
+#ifdef SF_X86
+    if (strcmp(name, "avx2") == 0)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+    if (strcmp(name, "ssse3") == 0)
+        return __builtin_cpu_supports("ssse3");
+    if (strcmp(name, "sse2") == 0)
+        return __builtin_cpu_supports("sse2");
+#endif
+    return strcmp(name, "scalar") == 0;
+}
+
+int sf_use_kernel(const char *name){
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if ((name && strcmp(name, kernels[i].name) != 0) || !kernel_ok(kernels[i].name))
+            continue;
+        count_impl = kernels[i].fn;
+        squeeze_impl = kernels[i].squeeze;
+        count_name = kernels[i].name;
+        return 0;
+    }
+    return -1;
+}
+
+//picks a kernel on first use, SF_KERNEL can force one
+static void pick_kernel(void){
+    if (count_impl) return;
+    const char *env = getenv("SF_KERNEL");
+    if (!env || sf_use_kernel(env) != 0)
+        sf_use_kernel(NULL);
+}
+
+const char *sf_kernel_name(void){
+    pick_kernel();
+    return count_name;
+}
+
+size_t sf_count_words(const char *buf, size_t len, int *in_word){
+    pick_kernel();
+    return count_impl(buf, len, in_word);
+}
+
+size_t sf_squeeze_blanks(char *dst, const char *src, size_t len, int *blank){
+    pick_kernel();
+    return squeeze_impl(dst, src, len, blank);
+}
+
+/*
+    Parallel word counting
+
+    buf is cut into nthreads ranges of about the same size and every range
+    is counted on its own thread.  A word that straddles a cut would be
+    counted by both ranges, so each range starts with in_word set from the
+    byte just before it: the range then only counts words that start inside
+    it, and the sum is exactly the sequential count.
+*/
+typedef struct count_job {
+    const char *buf;
+    size_t start;
+    size_t len;
+    size_t count;
+} count_job_t;
+
+static void *count_worker(void *arg){
+    count_job_t *job = arg;
+    int in_word = job->start > 0 && !SF_IS_SPACE(job->buf[job->start - 1]);
+
+    job->count = sf_count_words(job->buf + job->start, job->len, &in_word);
+    return NULL;
+}
+
+size_t sf_count_words_mt(const char *buf, size_t len, int nthreads){
+    count_job_t jobs[SF_MAX_THREADS];
+    pthread_t tids[SF_MAX_THREADS];
+    int started[SF_MAX_THREADS] = {0};
+    size_t total = 0;
+
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > SF_MAX_THREADS) nthreads = SF_MAX_THREADS;
+    //not worth a thread for less than a block each
+    if ((size_t)nthreads > len / 4096 + 1) nthreads = len / 4096 + 1;
+
+    pick_kernel();
+    for (int i = 0; i < nthreads; i++) {
+        jobs[i].buf = buf;
+        jobs[i].start = len / nthreads * i;
+        jobs[i].len = (i == nthreads - 1 ? len : len / nthreads * (i + 1)) - jobs[i].start;
+        if (i > 0)
+            started[i] = pthread_create(&tids[i], NULL, count_worker, &jobs[i]) == 0;
+    }
+    //the calling thread takes the first range and any that got no thread
+    for (int i = 0; i < nthreads; i++) {
+        if (!started[i]) count_worker(&jobs[i]);
+    }
+    for (int i = 0; i < nthreads; i++) {
+        if (started[i]) pthread_join(tids[i], NULL);
+        total += jobs[i].count;
+    }
+    return total;
+}
+
+/*
+    Substring search
+
+    Needles of up to SF_FIND_SHORT bytes are found by jumping between
+    occurrences of their rarest byte with memchr and comparing the rest,
+    which costs at most SF_FIND_SHORT compares per byte of hay.  Rarest
+    is a guess from how common bytes are in text.
+
+    Longer needles use the Two-Way algorithm (Crochemore and Perrin).  The
+    needle is cut at its critical factorization ms: the right part is
+    compared left to right and a mismatch there shifts by how far it got,
+    then the left part is compared right to left and a match there shifts
+    by the period p.  For a periodic needle the bytes already known to
+    match after a period shift are remembered in mem and not compared
+    again, so no byte of hay is looked at more than twice and the search
+    stays linear even for hay like "aaaa...a" and needles like "aaa...ab".
+    Before any of that the last byte of the window is looked up in a
+    Horspool shift table, so on ordinary text most windows are skipped
+    after a single compare.
+*/
+#define SF_FIND_SHORT   4
+
+//bytes of text from most to least common, the rest count as rare
+static const char common_bytes[] = " etaoinsrhldcumfpgwybvkxjqz";
+
+static size_t rarest_byte(const char *needle, size_t needle_len){
+    size_t best = 0;
+    size_t best_rank = 0;
+
+    for (size_t i = 0; i < needle_len; i++) {
+        const char *pos = needle[i] ? strchr(common_bytes, needle[i] | 0x20) : NULL;
+        size_t rank = pos ? sizeof(common_bytes) - (pos - common_bytes) : 0;
+        if (i == 0 || rank < best_rank) {
+            best = i;
+            best_rank = rank;
+        }
+    }
+    return best;
+}
+
+static const char *find_short(const char *hay, size_t hay_len, const char *needle, size_t needle_len){
+    size_t r = rarest_byte(needle, needle_len);
+    const char *end = hay + hay_len - (needle_len - 1 - r);
+    const char *ptr = hay + r;
+
+    while (ptr < end && (ptr = memchr(ptr, needle[r], end - ptr)) != NULL) {
+        if (memcmp(ptr - r, needle, needle_len) == 0) return ptr - r;
+        ptr++;
+    }
+    return NULL;
+}
+
+//start of the maximal suffix of n under the byte order (or its reverse
+//when rev is set), and its period in *period
+static size_t max_suffix(const unsigned char *n, size_t len, int rev, size_t *period){
+    size_t ip = (size_t)-1;     //start of the best suffix so far, minus one
+    size_t jp = 0;              //start of the candidate suffix, minus one
+    size_t k = 1;
+    size_t p = 1;
+
+    while (jp + k < len) {
+        unsigned char a = n[ip + k], b = n[jp + k];
+        if (a == b) {
+            if (k == p) {
+                jp += p;
+                k = 1;
+            } else {
+                k++;
+            }
+        } else if (rev ? a < b : a > b) {
+            jp += k;
+            k = 1;
+            p = jp - ip;
+        } else {
+            ip = jp++;
+            k = p = 1;
+        }
+    }
+    *period = p;
+    return ip;
+}
+
+static const char *find_two_way(const char *hay, size_t hay_len, const char *needle, size_t l){
+    const unsigned char *h = (const unsigned char *)hay;
+    const unsigned char *z = h + hay_len;
+    const unsigned char *n = (const unsigned char *)needle;
+    size_t shift[256];
+    size_t ms, p, p_rev, mem0, mem = 0;
+
+    //bytes not in the needle let the window jump past them
+    for (int c = 0; c < 256; c++) shift[c] = l;
+    for (size_t i = 0; i < l; i++) shift[n[i]] = l - 1 - i;
+
+    //the critical factorization is the later of the two maximal suffixes
+    ms = max_suffix(n, l, 0, &p);
+    size_t ms_rev = max_suffix(n, l, 1, &p_rev);
+    if (ms_rev + 1 > ms + 1) {
+        ms = ms_rev;
+        p = p_rev;
+    }
+
+    //a needle that is not periodic shifts by more than half its length
+    if (memcmp(n, n + p, ms + 1) != 0) {
+        mem0 = 0;
+        p = (ms + 1 > l - ms - 1 ? ms + 1 : l - ms - 1) + 1;
+    } else {
+        mem0 = l - p;
+    }
+
+    while ((size_t)(z - h) >= l) {
+        size_t k = shift[h[l - 1]];
+        if (k) {
+            //the last period has a byte out of place, so no match can
+            //start before it
+            if (mem && k < p) k = l - p;
+            h += k;
+            mem = 0;
+            continue;
+        }
+
+        //right part, left to right
+        for (k = ms + 1 > mem ? ms + 1 : mem; k < l && n[k] == h[k]; k++);
+        if (k < l) {
+            h += k - ms;
+            mem = 0;
+            continue;
+        }
+
+        //left part, right to left
+        for (k = ms + 1; k > mem && n[k - 1] == h[k - 1]; k--);
+        if (k <= mem) return (const char *)h;
+        h += p;
+        mem = mem0;
+    }
+    return NULL;
+}
+
+const char *sf_find(const char *hay, size_t hay_len, const char *needle, size_t needle_len){
+    if (needle_len == 0) return hay;
+    if (needle_len > hay_len) return NULL;
+    if (needle_len == 1) return memchr(hay, needle[0], hay_len);
+    if (needle_len <= SF_FIND_SHORT) return find_short(hay, hay_len, needle, needle_len);
+    return find_two_way(hay, hay_len, needle, needle_len);
+}
+
+int sf_writev_all(int fd, struct iovec *iov, int iovcnt){
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt < IOV_MAX ? iovcnt : IOV_MAX);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        //drop what went out, the first entry left may be part written
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+/*
+    Output builder
+
+    Output is formatted straight into a staging buffer and leaves in one
+    write per SF_OUT_SZ bytes.  A piece too big to stage goes out in the
+    same writev as what is staged, without being copied.  The first error
+    sticks and everything after it is dropped, so callers only look at
+    what sf_out_flush() returns at the end.
+*/
+void sf_out_init(sf_out_t *o, int fd){
+    o->fd = fd;
+    o->err = 0;
+    o->len = 0;
+}
+
+int sf_out_flush(sf_out_t *o){
+    struct iovec iov = { o->buf, o->len };
+
+    if (o->len > 0 && !o->err && sf_writev_all(o->fd, &iov, 1) != 0) o->err = 1;
+    o->len = 0;
+    return o->err ? -1 : 0;
+}
+
+void sf_out_write(sf_out_t *o, const char *p, size_t n){
+    if (n <= SF_OUT_SZ - o->len) {
+        memcpy(o->buf + o->len, p, n);
+        o->len += n;
+        return;
+    }
+    if (n < SF_OUT_SZ) {
+        sf_out_flush(o);
+        memcpy(o->buf, p, n);
+        o->len = n;
+        return;
+    }
+    struct iovec iov[2] = { { o->buf, o->len }, { (char *)p, n } };
+    if (!o->err && sf_writev_all(o->fd, iov, 2) != 0) o->err = 1;
+    o->len = 0;
+}
+
+void sf_out_fill(sf_out_t *o, char c, size_t n){
+    while (n > 0) {
+        if (o->len == SF_OUT_SZ) sf_out_flush(o);
+        size_t k = SF_OUT_SZ - o->len < n ? SF_OUT_SZ - o->len : n;
+        memset(o->buf + o->len, c, k);
+        o->len += k;
+        n -= k;
+    }
+}
+
+void sf_out_uint(sf_out_t *o, unsigned long v){
+    char digits[24];
+    char *p = digits + sizeof(digits);
+
+    do {
+        *--p = '0' + v % 10;
+        v /= 10;
+    } while (v > 0);
+    sf_out_write(o, p, digits + sizeof(digits) - p);
+}
+
+/*
+    Word frequencies
+
+    An open addressing table with linear probing, kept at most half full
+    and doubled when it gets there.  A slot holds the full hash, so a probe
+    only compares words whose hashes are equal, and growing does not hash
+    again.  The words live in an arena of large blocks, one allocation per
+    block instead of per word, and are never moved.
+
+    The hash follows wyhash: words up to 16 bytes, nearly all of them, are
+    read as two overlapping 64 bit values and mixed with one 64x64->128
+    multiply folded in half.
+
+    The top n is a quickselect that leaves the n most frequent at the front
+    in linear time, then only those n are sorted.  No two entries compare
+    equal, so the partition never degrades on ties.
+*/
+#define FREQ_MIN_SLOTS      1024
+#define FREQ_BLOCK_SZ       (64 * 1024)
+
+typedef struct freq_slot {
+    uint64_t hash;
+    char    *word;          //NULL for an empty slot
+    size_t   len;
+    size_t   count;
+} freq_slot_t;
+
+typedef struct freq_block {
+    struct freq_block *next;
+    size_t used;
+    size_t size;
+    char   data[];
+} freq_block_t;
+
+struct sf_freq {
+    freq_slot_t  *slots;
+    size_t        nslots;   //a power of 2
+    size_t        used;
+    freq_block_t *blocks;   //the one words go to first
+};
+
+static const uint64_t wy_p0 = 0xa0761d6478bd642full;
+static const uint64_t wy_p1 = 0xe7037ed1a0b428dbull;
+static const uint64_t wy_p2 = 0x8ebc6af09c88c6e3ull;
+
+static inline uint64_t wy_mix(uint64_t a, uint64_t b){
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t wy_r8(const uint8_t *p){
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t wy_r4(const uint8_t *p){
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint64_t freq_hash(const char *word, size_t len){
+    const uint8_t *p = (const uint8_t *)word;
+    uint64_t seed = wy_p0;
+    uint64_t a, b;
+
+    if (len <= 16) {
+        if (len >= 4) {
+            a = wy_r4(p) << 32 | wy_r4(p + (len >> 3 << 2));
+            b = wy_r4(p + len - 4) << 32 | wy_r4(p + len - 4 - (len >> 3 << 2));
+        } else if (len > 0) {
+            a = (uint64_t)p[0] << 16 | (uint64_t)p[len >> 1] << 8 | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        for (; i > 16; i -= 16, p += 16)
+            seed = wy_mix(wy_r8(p) ^ wy_p1, wy_r8(p + 8) ^ seed);
+        a = wy_r8(p + i - 16);
+        b = wy_r8(p + i - 8);
+    }
+    return wy_mix(wy_p1 ^ len, wy_mix(a ^ wy_p1, b ^ seed ^ wy_p2));
+}
+
+sf_freq_t *sf_freq_new(void){
+    sf_freq_t *f = calloc(1, sizeof(sf_freq_t));
+
+    if (!f) return NULL;
+    f->nslots = FREQ_MIN_SLOTS;
+    f->slots = calloc(f->nslots, sizeof(freq_slot_t));
+    if (!f->slots) {
+        free(f);
+        return NULL;
+    }
+    return f;
+}
+
+void sf_freq_free(sf_freq_t *f){
+    if (!f) return;
+    while (f->blocks) {
+        freq_block_t *next = f->blocks->next;
+        free(f->blocks);
+        f->blocks = next;
+    }
+    free(f->slots);
+    free(f);
+}
+
+size_t sf_freq_distinct(const sf_freq_t *f){
+    return f->used;
+}
+
+//a copy of word in the arena.  A word bigger than a block gets a block of
+//its own behind the current one, so the room left there is not lost.
+static char *freq_store(sf_freq_t *f, const char *word, size_t len){
+    freq_block_t *b = f->blocks;
+
+    if (!b || b->size - b->used < len) {
+        size_t size = len > FREQ_BLOCK_SZ / 4 ? len : FREQ_BLOCK_SZ;
+        freq_block_t *nb = malloc(sizeof(freq_block_t) + size);
+        if (!nb) return NULL;
+        nb->used = 0;
+        nb->size = size;
+        if (b && size != FREQ_BLOCK_SZ) {
+            nb->next = b->next;
+            b->next = nb;
+        } else {
+            nb->next = b;
+            f->blocks = nb;
+        }
+        b = nb;
+    }
+    char *copy = b->data + b->used;
+    memcpy(copy, word, len);
+    b->used += len;
+    return copy;
+}
+
+static int freq_grow(sf_freq_t *f){
+    size_t nslots = f->nslots * 2;
+    size_t mask = nslots - 1;
+    freq_slot_t *slots = calloc(nslots, sizeof(freq_slot_t));
+
+    if (!slots) return -1;
+    for (size_t i = 0; i < f->nslots; i++) {
+        if (!f->slots[i].word) continue;
+        size_t at = f->slots[i].hash & mask;
+        while (slots[at].word) at = (at + 1) & mask;
+        slots[at] = f->slots[i];
+    }
+    free(f->slots);
+    f->slots = slots;
+    f->nslots = nslots;
+    return 0;
+}
+
+int sf_freq_add(sf_freq_t *f, const char *word, size_t len){
+    uint64_t hash = freq_hash(word, len);
+    size_t mask = f->nslots - 1;
+    size_t at = hash & mask;
+
+    for (; f->slots[at].word; at = (at + 1) & mask) {
+        freq_slot_t *slot = &f->slots[at];
+        if (slot->hash == hash && slot->len == len && memcmp(slot->word, word, len) == 0) {
+            slot->count++;
+            return 0;
+        }
+    }
+
+    //empty words still need a pointer that is not NULL
+    char *copy = freq_store(f, word, len);
+    if (!copy) return -1;
+    f->slots[at] = (freq_slot_t){ hash, copy, len, 1 };
+    f->used++;
+    if (f->used * 2 > f->nslots) return freq_grow(f);
+    return 0;
+}
+
+//most frequent first, then in byte order
+static int freq_cmp(const void *pa, const void *pb){
+    const sf_freq_entry_t *a = pa, *b = pb;
+
+    if (a->count != b->count) return a->count > b->count ? -1 : 1;
+    int c = memcmp(a->word, b->word, a->len < b->len ? a->len : b->len);
+    if (c != 0) return c;
+    return (a->len > b->len) - (a->len < b->len);
+}
+
+static inline void freq_swap(sf_freq_entry_t *a, sf_freq_entry_t *b){
+    sf_freq_entry_t t = *a;
+    *a = *b;
+    *b = t;
+}
+
+//moves the k first by freq_cmp to the front of e, in no order
+static void freq_select(sf_freq_entry_t *e, size_t n, size_t k){
+    size_t lo = 0, hi = n;
+
+    while (hi - lo > 1) {
+        //median of three as the pivot, parked at the end
+        size_t mid = lo + (hi - lo) / 2;
+        if (freq_cmp(&e[mid], &e[lo]) < 0) freq_swap(&e[mid], &e[lo]);
+        if (freq_cmp(&e[hi - 1], &e[lo]) < 0) freq_swap(&e[hi - 1], &e[lo]);
+        if (freq_cmp(&e[mid], &e[hi - 1]) < 0) freq_swap(&e[mid], &e[hi - 1]);
+
+        size_t store = lo;
+        for (size_t i = lo; i < hi - 1; i++)
+            if (freq_cmp(&e[i], &e[hi - 1]) < 0) freq_swap(&e[i], &e[store++]);
+        freq_swap(&e[store], &e[hi - 1]);
+
+        if (k <= store) hi = store;
+        else if (k > store + 1) lo = store + 1;
+        else return;
+    }
+}
+
+long sf_freq_top(const sf_freq_t *f, size_t n, sf_freq_entry_t *top){
+    sf_freq_entry_t *all = malloc((f->used ? f->used : 1) * sizeof(sf_freq_entry_t));
+    size_t count = 0;
+
+    if (!all) return -1;
+    for (size_t i = 0; i < f->nslots; i++) {
+        const freq_slot_t *slot = &f->slots[i];
+        if (slot->word) all[count++] = (sf_freq_entry_t){ slot->word, slot->len, slot->count };
+    }
+    if (n > count) n = count;
+    if (n < count) freq_select(all, count, n);
+    qsort(all, n, sizeof(sf_freq_entry_t), freq_cmp);
+    memcpy(top, all, n * sizeof(sf_freq_entry_t));
+    free(all);
+    return (long)n;
+}
+
+/*
+    Aho-Corasick
+
+    The automaton is a trie of the patterns turned into a DFA.  Bytes that
+    occur in no pattern all share class 0 and the others get a class each,
+    so every state has a dense row of nclasses transitions and the scan is
+    one table load per byte.  An entry holds the offset of the next row
+    shifted left by one, with the low bit set when the next state has a
+    match, so states without one cost nothing more than the load.
+
+    A state matches the longest pattern that is a suffix of its string,
+    which is the one that starts first of all those ending there.  Matches
+    are leftmost-longest: once one is found it is only a candidate, as a
+    match that started earlier or at the same place may still end later.
+    Every such match runs through the string of the current state, so the
+    candidate is final as soon as that string starts after it.  The next
+    search starts right after the match.
+*/
+#define AC_ROOT     0
+
+struct sf_ac {
+    uint8_t cls[256];       //byte to class
+    int nclasses;
+    int nstates;
+    uint32_t *trans;        //nstates rows of nclasses entries
+    int *match;             //pattern matched in a state, -1 for none
+    int *depth;             //length of the string of a state
+    size_t *lens;           //pattern lengths
+};
+
+#define AC_ENTRY(ac, s)     ((uint32_t)(s) * (ac)->nclasses << 1 | ((ac)->match[s] >= 0))
+#define AC_STATE(ac, e)     ((int)((e) >> 1) / (ac)->nclasses)
+
+void sf_ac_free(sf_ac_t *ac){
+    if (!ac) return;
+    free(ac->trans);
+    free(ac->match);
+    free(ac->depth);
+    free(ac->lens);
+    free(ac);
+}
+
+sf_ac_t *sf_ac_build(char *const *pats, const size_t *lens, int npats){
+    sf_ac_t *ac = calloc(1, sizeof(sf_ac_t));
+    int *goto_tab = NULL, *fail = NULL, *queue = NULL;
+    size_t total = 0;
+
+    if (!ac || npats <= 0) goto fail;
+    for (int i = 0; i < npats; i++) {
+        if (lens[i] == 0) goto fail;
+        total += lens[i];
+        for (size_t k = 0; k < lens[i]; k++) ac->cls[(unsigned char)pats[i][k]] = 1;
+    }
+    for (int c = 0, n = 1; c < 256; c++) {
+        if (ac->cls[c]) ac->cls[c] = n++;
+        ac->nclasses = n;
+    }
+
+    //the root and at most one state per pattern byte
+    size_t cap = total + 1;
+    int k = ac->nclasses;
+    if (cap * k >= (1u << 31)) goto fail;
+    goto_tab = malloc(cap * k * sizeof(int));
+    fail = malloc(cap * sizeof(int));
+    queue = malloc(cap * sizeof(int));
+    ac->match = malloc(cap * sizeof(int));
+    ac->depth = malloc(cap * sizeof(int));
+    ac->lens = malloc(npats * sizeof(size_t));
+    if (!goto_tab || !fail || !queue || !ac->match || !ac->depth || !ac->lens) goto fail;
+    memcpy(ac->lens, lens, npats * sizeof(size_t));
+    memset(goto_tab, -1, cap * k * sizeof(int));
+
+    //the trie, the first of equal patterns wins
+    ac->nstates = 1;
+    ac->match[AC_ROOT] = -1;
+    ac->depth[AC_ROOT] = 0;
+    for (int i = 0; i < npats; i++) {
+        int s = AC_ROOT;
+        for (size_t b = 0; b < lens[i]; b++) {
+            int *next = &goto_tab[s * k + ac->cls[(unsigned char)pats[i][b]]];
+            if (*next < 0) {
+                *next = ac->nstates++;
+                ac->match[*next] = -1;
+                ac->depth[*next] = ac->depth[s] + 1;
+            }
+            s = *next;
+        }
+        if (ac->match[s] < 0) ac->match[s] = i;
+    }
+
+    //breadth first, so the row of a failure state is always done first
+    ac->trans = malloc((size_t)ac->nstates * k * sizeof(uint32_t));
+    if (!ac->trans) goto fail;
+    int head = 0, tail = 0;
+    fail[AC_ROOT] = AC_ROOT;
+    queue[tail++] = AC_ROOT;
+    while (head < tail) {
+        int s = queue[head++];
+
+        for (int c = 0; c < k; c++) {
+            int next = goto_tab[s * k + c];
+            int via_fail = s == AC_ROOT ? AC_ROOT : AC_STATE(ac, ac->trans[fail[s] * k + c]);
+            if (next < 0) {
+                ac->trans[s * k + c] = AC_ENTRY(ac, via_fail);
+                continue;
+            }
+            //the own match of next is longer than any of its failure state
+            fail[next] = via_fail;
+            if (ac->match[next] < 0) ac->match[next] = ac->match[via_fail];
+            ac->trans[s * k + c] = AC_ENTRY(ac, next);
+            queue[tail++] = next;
+        }
+    }
+
+    free(goto_tab);
+    free(fail);
+    free(queue);
+    return ac;
+
+fail:
+    free(goto_tab);
+    free(fail);
+    free(queue);
+    sf_ac_free(ac);
+    return NULL;
+}
+
+int sf_ac_find(const sf_ac_t *ac, const char *text, size_t len, int final,
+               size_t *start, size_t *safe){
+    const unsigned char *t = (const unsigned char *)text;
+    const uint32_t *trans = ac->trans;
+    const uint8_t *cls = ac->cls;
+    uint32_t e = AC_ENTRY(ac, AC_ROOT);
+    int best = -1;
+    size_t best_start = 0;
+    size_t i = 0;
+
+    //no candidate yet, only the table load and the match bit
+    for (; i < len; i++) {
+        e = trans[(e >> 1) + cls[t[i]]];
+        if (e & 1) break;
+    }
+    //a candidate, until the current string starts after it
+    while (i < len) {
+        int s = AC_STATE(ac, e);
+        if (e & 1) {
+            int m = ac->match[s];
+            size_t m_start = i + 1 - ac->lens[m];
+            if (best < 0 || m_start <= best_start) {
+                best = m;
+                best_start = m_start;
+            }
+        }
+        if (i + 1 - ac->depth[s] > best_start) break;
+        if (++i < len) e = trans[(e >> 1) + cls[t[i]]];
+    }
+
+    if (i == len && !final) {
+        //the text ran out while a match could still grow
+        *safe = len - ac->depth[AC_STATE(ac, e)];
+        return -1;
+    }
+    *safe = len;
+    if (best >= 0) *start = best_start;
+    return best;
+}
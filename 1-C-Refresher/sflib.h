@@ -0,0 +1,105 @@
+#ifndef __SFLIB_H__
+#define __SFLIB_H__
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/uio.h>
+
+//kernels shared by stringfun and sfbench
+
+//whitespace as the kernels see it: space, \t, \n, \v, \f and \r
+#define SF_IS_SPACE(c)  ((c) == ' ' || (unsigned char)((c) - '\t') <= '\r' - '\t')
+
+#define SF_MAX_THREADS  256     //threads sf_count_words_mt() will start
+
+//counts the words in buf.  *in_word says if the byte before buf was part
+//of a word and is updated for the next call, so a word split across two
+//calls is counted once.
+size_t sf_count_words(const char *buf, size_t len, int *in_word);
+
+//picks the kernels by name ("scalar", "sse2", "ssse3" or "avx2"), NULL
+//for the best one this cpu has.  Returns -1 if the cpu can not run it.
+//The SF_KERNEL environment variable does the same on first use.
+int sf_use_kernel(const char *name);
+const char *sf_kernel_name(void);
+
+//squeezes every run of spaces and tabs in src to one space.  *blank says
+//if the byte before src was a blank, so a run split across two calls
+//leaves one space, and 1 drops leading blanks.  It is updated for the
+//next call.  dst needs room for len + SF_SQUEEZE_SLACK bytes, returns the
+//length written.  Uses the kernel sf_use_kernel() picked.
+#define SF_SQUEEZE_SLACK    16
+size_t sf_squeeze_blanks(char *dst, const char *src, size_t len, int *blank);
+
+//sf_count_words() over the whole of buf split between nthreads threads
+size_t sf_count_words_mt(const char *buf, size_t len, int nthreads);
+
+//first occurrence of needle in hay, NULL if there is none.  Runs in time
+//linear in hay_len + needle_len whatever the bytes are.
+const char *sf_find(const char *hay, size_t hay_len, const char *needle, size_t needle_len);
+
+//output staged in memory and written to fd in SF_OUT_SZ pieces.  Errors
+//stick and come back from sf_out_flush(), which must end every use.
+#define SF_OUT_SZ   (64 * 1024)
+
+typedef struct sf_out {
+    int    fd;
+    int    err;
+    size_t len;
+    char   buf[SF_OUT_SZ];
+} sf_out_t;
+
+void sf_out_init(sf_out_t *o, int fd);
+int  sf_out_flush(sf_out_t *o);
+void sf_out_write(sf_out_t *o, const char *p, size_t n);
+void sf_out_fill(sf_out_t *o, char c, size_t n);    //n copies of c
+void sf_out_uint(sf_out_t *o, unsigned long v);     //v in decimal
+
+static inline void sf_out_char(sf_out_t *o, char c){
+    if (o->len == SF_OUT_SZ) sf_out_flush(o);
+    o->buf[o->len++] = c;
+}
+
+static inline void sf_out_str(sf_out_t *o, const char *str){
+    sf_out_write(o, str, strlen(str));
+}
+
+//Aho-Corasick automaton over a set of patterns, see sflib.c
+typedef struct sf_ac sf_ac_t;
+
+//NULL if a pattern is empty or memory runs out
+sf_ac_t *sf_ac_build(char *const *pats, const size_t *lens, int npats);
+void sf_ac_free(sf_ac_t *ac);
+
+//finds the leftmost-longest match in text, scanning from text[0].
+//returns the pattern index and sets *start, or -1 if there is none.  With
+//final 0 more text may follow, so a match that could still grow or start
+//earlier is not reported: -1 comes back and *safe is how many bytes at
+//the front of text can not be part of any match.
+int sf_ac_find(const sf_ac_t *ac, const char *text, size_t len, int final,
+               size_t *start, size_t *safe);
+
+//counts of distinct words, memory grows with the number of distinct words
+typedef struct sf_freq sf_freq_t;
+
+typedef struct sf_freq_entry {
+    const char *word;
+    size_t len;
+    size_t count;
+} sf_freq_entry_t;
+
+sf_freq_t *sf_freq_new(void);
+void sf_freq_free(sf_freq_t *f);
+//counts one more of word, -1 if memory runs out
+int sf_freq_add(sf_freq_t *f, const char *word, size_t len);
+size_t sf_freq_distinct(const sf_freq_t *f);
+//the n most frequent words into top, most frequent first and equal counts
+//in byte order.  Returns how many there were, or -1 if memory runs out.
+//The words point into f.
+long sf_freq_top(const sf_freq_t *f, size_t n, sf_freq_entry_t *top);
+
+//writes every byte of iov to fd, in IOV_MAX sized batches and across
+//short writes.  iov is used as scratch.  Returns 0 or -1 on error.
+int sf_writev_all(int fd, struct iovec *iov, int iovcnt);
+
+#endif
@@ -1,111 +1,158 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sflib.h"
 
 #define BUFFER_SZ 50
+#define STREAM_CHUNK_SZ (64 * 1024)     //bytes read per chunk in -s mode
+#define SETUP_CHUNK_SZ  1024            //bytes squeezed per call in setup_buff
+#define FREQ_TOP_DEFAULT 10             //words -f lists when no N is given
+
+/*
+    The buffer is passed around as a view: ptr[0..len) is the content and
+    cap is the room behind ptr.  Every operation works on the content and
+    updates len, nothing marks the end inside the data, so a '.' in the
+    input is just a character.  The dots only show up in print_buff, which
+    pads the content to cap with them for display.
+*/
+typedef struct strview {
+    char *ptr;
+    int   len;
+    int   cap;
+} strview_t;
 
 //prototypes
 void usage(char *);
-void print_buff(char *, int);
-int setup_buff(char *, char *, int);
+void print_buff(strview_t *);
+int setup_buff(strview_t *, char *);
 
 //prototypes for functions to handle required functionality
-int count_words(char *, int, int);
+int count_words(strview_t *);
 //add additional prototypes here
-int reverse_string(char *, int, int);
-int print_words(char *, int, int);
-int replace_string(char *buff, int len, int str_len, char *search, char *replace);
+int reverse_string(strview_t *);
+int print_words(strview_t *);
+int word_freq(strview_t *sv, int top);
+int replace_string(strview_t *sv, char *search, char *replace);
+int replace_all(strview_t *sv, char *search, char *replace);
+
+//prototypes for the multi pattern (-m) replace
+typedef struct pairs pairs_t;
+pairs_t *load_pairs(char *path);
+void free_pairs(pairs_t *p);
+int replace_multi(strview_t *sv, pairs_t *p);
+
+//prototypes for the streaming (-s) mode
+typedef struct stream stream_t;
+int stream_fill(stream_t *s);
+int stream_next(stream_t *s, char *out);
+int count_words_stream(stream_t *s);
+int print_words_stream(stream_t *s);
+int word_freq_stream(stream_t *s, int top);
+int reverse_stream(stream_t *s);
+int replace_stream(stream_t *s, char *search, char *replace);
+int replace_all_stream(stream_t *s, char *search, char *replace);
+int replace_multi_stream(stream_t *s, pairs_t *p);
+int stream_main(char opt, int argc, char *argv[]);
+int count_words_parallel(int nthreads, int argc, char *argv[]);
 
-int setup_buff(char *buff, char *user_str, int len) {
+int setup_buff(strview_t *sv, char *user_str) {
     //TODO: #4:  Implement the setup buff as per the directions
-    if (!buff || !user_str || len <= 0){
+    if (!sv || !sv->ptr || !user_str || sv->cap <= 0){
         return -2;
     } 
+    int len = sv->cap;
     
-    int buff_pos = 0;
-    char *input_ptr = user_str;
+    /*
+        Runs of spaces and tabs become one space with leading ones dropped,
+        done by the sflib squeeze kernel a chunk at a time through scratch
+        that has the slack its vector stores need.  buff_pos counts every
+        byte the squeeze produced even past cap, so a string that does not
+        fit is only an error if it still does not after its trailing space
+        is dropped.
+    */
+    char chunk[SETUP_CHUNK_SZ + SF_SQUEEZE_SLACK];
+    size_t in_len = strlen(user_str);
+    size_t buff_pos = 0;
     int prev_space = 1;  // Start assuming previous char was space to handle leading spaces
     
-    // Process input string
-    while (*input_ptr != '\0') {
-        if (*input_ptr == ' ' || *input_ptr == '\t') {
-            if (!prev_space && buff_pos < len) {
-                *(buff + buff_pos) = ' ';
-                buff_pos++;
-            }
-            prev_space = 1;
-        } else {
-            if (buff_pos >= len) {
-                return -1;  // String too long
-            }
-            *(buff + buff_pos) = *input_ptr;
-            buff_pos++;
-            prev_space = 0;
+    for (size_t off = 0; off < in_len && buff_pos <= (size_t)len + 1; off += SETUP_CHUNK_SZ) {
+        size_t n = in_len - off < SETUP_CHUNK_SZ ? in_len - off : SETUP_CHUNK_SZ;
+        size_t out = sf_squeeze_blanks(chunk, user_str + off, n, &prev_space);
+        if (buff_pos < (size_t)len) {
+            memcpy(sv->ptr + buff_pos, chunk, out < len - buff_pos ? out : len - buff_pos);
         }
-        input_ptr++;
+        buff_pos += out;
     }
     
     // Remove trailing space if exists
-    if (buff_pos > 0 && *(buff + buff_pos - 1) == ' ') {
+    if (buff_pos > 0 && prev_space) {
         buff_pos--;
     }
-    
-    // Fill remainder with dots
-    while (buff_pos < len) {
-        *(buff + buff_pos) = '.';
-        buff_pos++;
+    if (buff_pos > (size_t)len) {
+        return -1;  // String too long
     }
     
-    return buff_pos;
+    sv->len = (int)buff_pos;
+    return sv->len;
 }
 
-void print_buff(char *buff, int len){
-    printf("Buffer:  [");
-    for (int i=0; i<len; i++){
-        putchar(*(buff+i));
-    }
-    printf("]\n");
+/*
+    print_buff and the word printers stage their output in an sf_out_t
+    and write it with a few write calls instead of one stdio call per
+    character.  stdout is flushed first so anything printf left there
+    still comes out before.
+*/
+
+//the content, padded with dots to the capacity
+void print_buff(strview_t *sv){
+    sf_out_t out;
+    
+    fflush(stdout);
+    sf_out_init(&out, STDOUT_FILENO);
+    sf_out_str(&out, "Buffer:  [");
+    sf_out_write(&out, sv->ptr, sv->len);
+    sf_out_fill(&out, '.', sv->cap - sv->len);
+    sf_out_str(&out, "]\n");
+    sf_out_flush(&out);
 }
 
 void usage(char *exename){
     printf("usage: %s [-h|c|r|w|x] \"string\" [other args]\n", exename);
+    printf("       %s [-c|r|w|x] -s [file|-] [other args]  (streams a file or stdin)\n", exename);
+    printf("       %s -c -j threads [file|-]  (counts words in parallel)\n", exename);
+    printf("       %s -X \"string\" search replace  (replaces every match, -s works too)\n", exename);
+    printf("       %s -m \"string\" pairs  (replaces per search=replace line of pairs, -s works too)\n", exename);
+    printf("       %s -f \"string\" [N]  (lists the N most frequent words, -s works too)\n", exename);
 }
 
 
-int count_words(char *buff, int len, int str_len){
-    if (!buff || len <= 0 || str_len > len) return -1;
+int count_words(strview_t *sv){
+    if (!sv || !sv->ptr || sv->len > sv->cap) return -1;
     
+    // Only ' ' separates words here, like in setup_buff and print_words, so
+    // \n and the other whitespace the -s kernels split on stay in the word.
+    // The buffer is BUFFER_SZ bytes, a plain loop is as fast as a kernel.
     int word_count = 0;
     int in_word = 0;
-    char *ptr = buff;
-    
-    while (ptr < buff + str_len && *ptr != '.') {
-        if (*ptr != ' ' && !in_word) {
-            word_count++;
-            in_word = 1;
-        } else if (*ptr == ' ') {
-            in_word = 0;
-        }
-        ptr++;
+
+    for (char *ptr = sv->ptr; ptr < sv->ptr + sv->len; ptr++) {
+        word_count += *ptr != ' ' && !in_word;
+        in_word = *ptr != ' ';
     }
-    
+
     return word_count;
 }
 
-int reverse_string(char *buff, int len, int str_len) {
-    if (!buff || len <= 0 || str_len > len) return -1;
+int reverse_string(strview_t *sv) {
+    if (!sv || !sv->ptr || sv->len > sv->cap) return -1;
     
-    // Find actual content length (until first dot)
-    int actual_len = 0;
-    char *ptr = buff;
-    while (ptr < buff + str_len && *ptr != '.') {
-        actual_len++;
-        ptr++;
-    }
-    
-    // Reverse only the content (not the dots)
-    char *start = buff;
-    char *end = buff + actual_len - 1;
+    char *start = sv->ptr;
+    char *end = sv->ptr + sv->len - 1;
     
     while (start < end) {
         char temp = *start;
@@ -118,162 +165,889 @@ int reverse_string(char *buff, int len, int str_len) {
     return 0;
 }
 
-int print_words(char *buff, int len, int str_len) {
-    if (!buff || len <= 0 || str_len > len) return -1;
+//one "N. word(len)" line
+static void out_word(sf_out_t *out, int n, const char *word, int len){
+    sf_out_uint(out, n);
+    sf_out_write(out, ". ", 2);
+    sf_out_write(out, word, len);
+    sf_out_char(out, '(');
+    sf_out_uint(out, len);
+    sf_out_write(out, ")\n", 2);
+}
+
+int print_words(strview_t *sv) {
+    if (!sv || !sv->ptr || sv->len > sv->cap) return -1;
     
-    printf("Word Print\n----------\n");
+    sf_out_t out;
+    fflush(stdout);
+    sf_out_init(&out, STDOUT_FILENO);
+    sf_out_str(&out, "Word Print\n----------\n");
     
     int word_count = 0;
-    int char_count = 0;
-    int in_word = 0;
-    char *word_start = buff;
-    char *ptr = buff;
-    
-    while (ptr < buff + str_len && *ptr != '.') {
-        if (*ptr != ' ' && !in_word) {
-            word_start = ptr;
-            in_word = 1;
-            char_count = 1;
-        } else if (*ptr != ' ' && in_word) {
-            char_count++;
-        } else if (*ptr == ' ' && in_word) {
-            word_count++;
-            printf("%d. ", word_count);
-            char *temp = word_start;
-            while (temp < ptr) {
-                putchar(*temp);
-                temp++;
-            }
-            printf("(%d)\n", char_count);
-            in_word = 0;
-        }
-        ptr++;
-    }
+    char *ptr = sv->ptr;
+    char *end = sv->ptr + sv->len;
     
-    // Handle last word if exists
-    if (in_word) {
-        word_count++;
-        printf("%d. ", word_count);
-        char *temp = word_start;
-        while (temp < ptr) {
-            putchar(*temp);
-            temp++;
+    while (ptr < end) {
+        if (*ptr == ' ') {
+            ptr++;
+            continue;
         }
-        printf("(%d)\n", char_count);
+        char *word_start = ptr;
+        while (ptr < end && *ptr != ' ') ptr++;
+        out_word(&out, ++word_count, word_start, (int)(ptr - word_start));
     }
     
-    return word_count;
+    return sf_out_flush(&out) == 0 ? word_count : -1;
 }
 
-int replace_string(char *buff, int len, int str_len, char *search, char *replace) {
-    if (!buff || !search || !replace || len <= 0 || str_len > len) return -1;
+/*
+    -f counts every distinct word in an sflib frequency table and lists the
+    top words as "count word" lines in the format of uniq -c, so the
+    output reads like sort | uniq -c | sort -rn | head would, with equal
+    counts in byte order.  Returns the number of distinct words.
+*/
+static int print_freq(sf_freq_t *freq, int top){
+    size_t distinct = sf_freq_distinct(freq);
+    size_t n = (size_t)top < distinct ? (size_t)top : distinct;
+    sf_freq_entry_t *words = malloc((n ? n : 1) * sizeof(sf_freq_entry_t));
+    sf_out_t out;
     
-    // Get lengths of search and replace strings
-    int search_len = 0;
-    int replace_len = 0;
-    char *ptr = search;
-    while (*ptr != '\0') {
-        search_len++;
-        ptr++;
+    if (!words || sf_freq_top(freq, n, words) < 0) {
+        free(words);
+        return -1;
     }
-    
-    ptr = replace;
-    while (*ptr != '\0') {
-        replace_len++;
-        ptr++;
+    fflush(stdout);
+    sf_out_init(&out, STDOUT_FILENO);
+    sf_out_str(&out, "Word Frequency\n--------------\n");
+    for (size_t i = 0; i < n; i++) {
+        int digits = 1;
+        for (size_t c = words[i].count; c >= 10; c /= 10) digits++;
+        if (digits < 7) sf_out_fill(&out, ' ', 7 - digits);
+        sf_out_uint(&out, words[i].count);
+        sf_out_char(&out, ' ');
+        sf_out_write(&out, words[i].word, words[i].len);
+        sf_out_char(&out, '\n');
     }
+    free(words);
+    if (sf_out_flush(&out) != 0) return -1;
+    return distinct > 0x7fffffff ? 0x7fffffff : (int)distinct;
+}
+
+int word_freq(strview_t *sv, int top) {
+    if (!sv || !sv->ptr || sv->len > sv->cap || top <= 0) return -1;
     
-    // Find search string in buffer
-    char *start = buff;
-    char *end = buff + str_len;
-    char *found = NULL;
+    sf_freq_t *freq = sf_freq_new();
+    if (!freq) return -1;
     
-    while (start < end && *start != '.') {
-        // Check if search string matches at current position
-        int matches = 1;
-        for (int i = 0; i < search_len; i++) {
-            if (start + i >= end || *(start + i) == '.' || *(start + i) != search[i]) {
-                matches = 0;
-                break;
-            }
+    char *ptr = sv->ptr;
+    char *end = sv->ptr + sv->len;
+    while (ptr < end) {
+        if (*ptr == ' ') {
+            ptr++;
+            continue;
         }
-        
-        if (matches) {
-            found = start;
-            break;
+        char *word_start = ptr;
+        while (ptr < end && *ptr != ' ') ptr++;
+        if (sf_freq_add(freq, word_start, ptr - word_start) != 0) {
+            sf_freq_free(freq);
+            return -1;
         }
-        start++;
     }
     
+    int rc = print_freq(freq, top);
+    sf_freq_free(freq);
+    return rc;
+}
+
+int replace_string(strview_t *sv, char *search, char *replace) {
+    if (!sv || !sv->ptr || !search || !replace || sv->len > sv->cap) return -1;
+    
+    int search_len = (int)strlen(search);
+    int replace_len = (int)strlen(replace);
+    
+    char *found = (char *)sf_find(sv->ptr, sv->len, search, search_len);
+    
     // If search string not found
     if (!found) {
         return -2;  // Pattern not found
     }
     
     // Calculate new string length after replacement
-    int new_len = str_len - search_len + replace_len;
-    if (new_len > len) {
+    int at = (int)(found - sv->ptr);
+    int tail = sv->len - at - search_len;
+    int new_len = sv->len - search_len + replace_len;
+    if (new_len > sv->cap) {
         // Handle overflow by truncating
-        new_len = len;
-    }
-    
-    // Make space for replacement if needed
-    if (replace_len != search_len) {
-        char *src = found + search_len;
-        char *dst = found + replace_len;
-        int move_len = end - (found + search_len);
-        
-        // If replacement is shorter, move left
-        if (replace_len < search_len) {
-            while (move_len > 0 && *src != '.') {
-                *dst = *src;
-                src++;
-                dst++;
-                move_len--;
-            }
-        }
-        // If replacement is longer, move right (but don't exceed buffer)
-        else {
-            // Calculate how many characters we can safely move
-            int max_move = len - (found - buff) - replace_len;
-            if (max_move > move_len) max_move = move_len;
-            
-            src = found + search_len + max_move - 1;
-            dst = found + replace_len + max_move - 1;
-            
-            while (move_len > 0 && max_move > 0) {
-                *dst = *src;
-                src--;
-                dst--;
-                move_len--;
-                max_move--;
-            }
-        }
+        new_len = sv->cap;
+    }
+    
+    // Shift the tail to where the replacement ends, what does not fit
+    // behind it is cut off
+    int room = sv->cap - at - replace_len;
+    if (room > 0 && tail > 0) {
+        memmove(found + replace_len, found + search_len, tail < room ? tail : room);
     }
     
     // Copy in replacement string
-    for (int i = 0; i < replace_len && (found + i) < (buff + len); i++) {
-        *(found + i) = replace[i];
+    memcpy(found, replace, replace_len < sv->cap - at ? replace_len : sv->cap - at);
+    
+    sv->len = new_len;
+    return new_len;
+}
+
+/*
+    Replaces every match, left to right without overlaps.  Calling
+    replace_string in a loop would shift the tail once per match, so
+    instead every match is found first, the output is sized from the count
+    and built in one pass, and only then copied over the buffer.  Output
+    longer than the capacity is cut off like replace_string does.
+*/
+int replace_all(strview_t *sv, char *search, char *replace) {
+    if (!sv || !sv->ptr || !search || !replace || sv->len > sv->cap) return -1;
+    
+    int search_len = (int)strlen(search);
+    int replace_len = (int)strlen(replace);
+    char *buff = sv->ptr;
+    int content_len = sv->len;
+    
+    // An empty search string would match everywhere
+    if (search_len == 0) return -1;
+    
+    int *matches = malloc((content_len / search_len + 1) * sizeof(int));
+    if (!matches) return -1;
+    int nmatches = 0;
+    const char *found = buff;
+    while ((found = sf_find(found, buff + content_len - found, search, search_len)) != NULL) {
+        matches[nmatches++] = (int)(found - buff);
+        found += search_len;
+    }
+    if (nmatches == 0) {
+        free(matches);
+        return -2;  // Pattern not found
     }
     
-    // Fill rest with dots if needed
-    ptr = buff;
-    while (ptr < buff + len) {
-        if (*ptr == '\0' || ptr >= buff + new_len) {
-            *ptr = '.';
+    int new_len = content_len + nmatches * (replace_len - search_len);
+    char *out = malloc(new_len > 0 ? new_len : 1);
+    if (!out) {
+        free(matches);
+        return -1;
+    }
+    char *dst = out;
+    int from = 0;
+    for (int i = 0; i < nmatches; i++) {
+        memcpy(dst, buff + from, matches[i] - from);
+        dst += matches[i] - from;
+        memcpy(dst, replace, replace_len);
+        dst += replace_len;
+        from = matches[i] + search_len;
+    }
+    memcpy(dst, buff + from, content_len - from);
+    
+    if (new_len > sv->cap) new_len = sv->cap;
+    memcpy(buff, out, new_len);
+    sv->len = new_len;
+    free(out);
+    free(matches);
+    return new_len;
+}
+
+/*
+    Multi pattern replace
+
+    -m takes a file of search=replace lines, split at the first '=', and
+    replaces all of them in one pass over the text instead of one -X run
+    per pair.  The searches go into an Aho-Corasick automaton (sflib), so
+    the pass costs the same however many pairs there are.  Where matches
+    overlap the one that starts first wins, then the longest of those,
+    and the scan goes on after it.  Empty lines are skipped and a trailing
+    \r is dropped so files from windows work.
+*/
+struct pairs {
+    sf_ac_t *ac;
+    char   *text;           //the file, lines split in place
+    char  **replace;
+    size_t *search_len;
+    size_t *replace_len;
+    size_t  max_len;        //longest search
+    int     n;
+};
+
+void free_pairs(pairs_t *p){
+    if (!p) return;
+    sf_ac_free(p->ac);
+    free(p->text);
+    free(p->replace);
+    free(p->search_len);
+    free(p->replace_len);
+    free(p);
+}
+
+//loads a pairs file, errors are reported here and give NULL
+pairs_t *load_pairs(char *path){
+    FILE *f = fopen(path, "rb");
+    pairs_t *p = calloc(1, sizeof(pairs_t));
+    char **search = NULL;
+    size_t size = 0, cap = 4096;
+    int line = 0;
+
+    if (!f || !p) {
+        fprintf(stderr, "Error opening %s\n", path);
+        goto fail;
+    }
+    //the whole file, it only holds the pairs
+    p->text = malloc(cap);
+    while (p->text) {
+        size += fread(p->text + size, 1, cap - size - 1, f);
+        if (size < cap - 1) break;
+        cap *= 2;
+        char *grown = realloc(p->text, cap);
+        if (!grown) break;
+        p->text = grown;
+    }
+    if (!p->text || ferror(f)) {
+        fprintf(stderr, "Error reading %s\n", path);
+        goto fail;
+    }
+    p->text[size] = '\0';
+
+    //at most one pair per line
+    int max_pairs = 1;
+    for (size_t i = 0; i < size; i++) max_pairs += p->text[i] == '\n';
+    search = malloc(max_pairs * sizeof(char *));
+    p->replace = malloc(max_pairs * sizeof(char *));
+    p->search_len = malloc(max_pairs * sizeof(size_t));
+    p->replace_len = malloc(max_pairs * sizeof(size_t));
+    if (!search || !p->replace || !p->search_len || !p->replace_len) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        goto fail;
+    }
+
+    for (char *next, *cur = p->text; cur < p->text + size; cur = next) {
+        char *end = memchr(cur, '\n', p->text + size - cur);
+        if (!end) end = p->text + size;
+        next = end + 1;
+        line++;
+        if (end > cur && end[-1] == '\r') end--;
+        if (end == cur) continue;
+
+        char *eq = memchr(cur, '=', end - cur);
+        if (!eq || eq == cur) {
+            fprintf(stderr, "Error: %s line %d is not search=replace\n", path, line);
+            goto fail;
         }
-        ptr++;
+        search[p->n] = cur;
+        p->search_len[p->n] = eq - cur;
+        p->replace[p->n] = eq + 1;
+        p->replace_len[p->n] = end - eq - 1;
+        if (p->search_len[p->n] > p->max_len) p->max_len = p->search_len[p->n];
+        p->n++;
+    }
+    if (p->n == 0) {
+        fprintf(stderr, "Error: %s holds no search=replace lines\n", path);
+        goto fail;
+    }
+
+    p->ac = sf_ac_build(search, p->search_len, p->n);
+    if (!p->ac) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        goto fail;
+    }
+    free(search);
+    fclose(f);
+    return p;
+
+fail:
+    free(search);
+    free_pairs(p);
+    if (f) fclose(f);
+    return NULL;
+}
+
+/*
+    Same shape as replace_all: find every match, size the output, build it
+    in one pass and copy it back, cut off at the capacity.
+*/
+int replace_multi(strview_t *sv, pairs_t *p) {
+    if (!sv || !sv->ptr || !p || sv->len > sv->cap) return -1;
+    
+    char *buff = sv->ptr;
+    int content_len = sv->len;
+    
+    //a match is at least one byte, so there are at most content_len
+    int *match_at = malloc((content_len + 1) * sizeof(int));
+    int *match_pair = malloc((content_len + 1) * sizeof(int));
+    if (!match_at || !match_pair) {
+        free(match_at);
+        free(match_pair);
+        return -1;
+    }
+    int nmatches = 0;
+    int new_len = content_len;
+    size_t pos = 0, start, safe;
+    int k;
+    while ((k = sf_ac_find(p->ac, buff + pos, content_len - pos, 1, &start, &safe)) >= 0) {
+        match_at[nmatches] = (int)(pos + start);
+        match_pair[nmatches++] = k;
+        new_len += (int)p->replace_len[k] - (int)p->search_len[k];
+        pos += start + p->search_len[k];
+    }
+    if (nmatches == 0) {
+        free(match_at);
+        free(match_pair);
+        return -2;  // Pattern not found
     }
     
+    char *out = malloc(new_len > 0 ? new_len : 1);
+    if (!out) {
+        free(match_at);
+        free(match_pair);
+        return -1;
+    }
+    char *dst = out;
+    int from = 0;
+    for (int i = 0; i < nmatches; i++) {
+        k = match_pair[i];
+        memcpy(dst, buff + from, match_at[i] - from);
+        dst += match_at[i] - from;
+        memcpy(dst, p->replace[k], p->replace_len[k]);
+        dst += p->replace_len[k];
+        from = match_at[i] + (int)p->search_len[k];
+    }
+    memcpy(dst, buff + from, content_len - from);
+    
+    if (new_len > sv->cap) new_len = sv->cap;
+    memcpy(buff, out, new_len);
+    sv->len = new_len;
+    free(out);
+    free(match_at);
+    free(match_pair);
     return new_len;
 }
 
+/*
+    Streaming mode
+
+    With -s the input comes from a file or stdin instead of argv and can be
+    any size.  It is read STREAM_CHUNK_SZ bytes at a time and normalized the
+    way setup_buff does it: leading and trailing whitespace is dropped and
+    every run of whitespace inside becomes one separator.  Real text has
+    lines, so newlines, returns and the like count as whitespace too, and a
+    run that held a newline becomes a newline instead of a space.
+
+    Chunks end anywhere, so the state that matters at a boundary (whether we
+    are inside a word, whether a separator is still owed, the tail that a
+    match could start in) is carried over to the next chunk.  Memory use
+    does not depend on the size of the input.
+
+    The transformed text goes to stdout and there is no buffer dump, so
+    errors go to stderr where they can not end up in the output.
+*/
+struct stream {
+    FILE *in;
+    char raw[STREAM_CHUNK_SZ];
+    int  raw_len;
+    int  sep;           //separator owed before the next word, 0 if none
+    int  started;       //a word has been seen, so separators count
+};
+
+//reads the next raw chunk, returns its length, 0 at the end or -1 on error
+int stream_fill(stream_t *s){
+    s->raw_len = (int)fread(s->raw, 1, STREAM_CHUNK_SZ, s->in);
+    if (s->raw_len == 0 && ferror(s->in)) return -1;
+    return s->raw_len;
+}
+
+//normalizes the next chunk into out, which needs STREAM_CHUNK_SZ + 1 bytes.
+//returns the bytes written, 0 at the end or -1 on error
+int stream_next(stream_t *s, char *out){
+    int n;
+    while ((n = stream_fill(s)) > 0) {
+        char *dst = out;
+        for (char *ptr = s->raw; ptr < s->raw + n; ptr++) {
+            if (SF_IS_SPACE(*ptr)) {
+                if (s->started && (s->sep == 0 || *ptr == '\n'))
+                    s->sep = *ptr == '\n' ? '\n' : ' ';
+                continue;
+            }
+            if (s->sep) {
+                *dst++ = (char)s->sep;
+                s->sep = 0;
+            }
+            *dst++ = *ptr;
+            s->started = 1;
+        }
+        //a chunk of nothing but whitespace gives nothing, read on
+        if (dst > out) return (int)(dst - out);
+    }
+    return n;
+}
+
+int count_words_stream(stream_t *s){
+    long word_count = 0;
+    int in_word = 0;    //carried across chunks, a word may straddle them
+    int n;
+
+    //counting needs no normalizing, the raw chunks go to the kernel as is
+    while ((n = stream_fill(s)) > 0) {
+        word_count += sf_count_words(s->raw, n, &in_word);
+    }
+    if (n < 0) return -1;
+    return word_count > 0x7fffffff ? 0x7fffffff : (int)word_count;
+}
+
+int print_words_stream(stream_t *s){
+    static char buf[STREAM_CHUNK_SZ + 1];
+    static sf_out_t out;
+    int word_count = 0;
+    int char_count = 0;
+    int n;
+
+    fflush(stdout);
+    sf_out_init(&out, STDOUT_FILENO);
+    sf_out_str(&out, "Word Print\n----------\n");
+
+    //a word goes out a piece per chunk, so words of any length work
+    while ((n = stream_next(s, buf)) > 0) {
+        char *ptr = buf;
+        char *end = buf + n;
+        while (ptr < end) {
+            if (SF_IS_SPACE(*ptr)) {
+                sf_out_char(&out, '(');
+                sf_out_uint(&out, char_count);
+                sf_out_write(&out, ")\n", 2);
+                char_count = 0;
+                ptr++;
+                continue;
+            }
+            if (char_count == 0) {
+                word_count++;
+                sf_out_uint(&out, word_count);
+                sf_out_write(&out, ". ", 2);
+            }
+            char *word = ptr;
+            while (ptr < end && !SF_IS_SPACE(*ptr)) ptr++;
+            sf_out_write(&out, word, ptr - word);
+            char_count += ptr - word;
+        }
+    }
+
+    // Handle last word if exists
+    if (n == 0 && char_count > 0) {
+        sf_out_char(&out, '(');
+        sf_out_uint(&out, char_count);
+        sf_out_write(&out, ")\n", 2);
+    }
+    if (sf_out_flush(&out) != 0 || n < 0) return -1;
+    return word_count;
+}
+
+/*
+    Words that fit in a chunk are counted straight from it.  One that runs
+    over the end of a chunk is put together in word first, which grows to
+    the longest such word, so memory is that plus the table.
+*/
+int word_freq_stream(stream_t *s, int top){
+    static char buf[STREAM_CHUNK_SZ + 1];
+    sf_freq_t *freq = sf_freq_new();
+    char *word = NULL;
+    size_t word_len = 0, word_cap = 0;
+    int rc = -1;
+    int n;
+
+    if (!freq) return -1;
+    while ((n = stream_next(s, buf)) > 0) {
+        char *ptr = buf;
+        char *end = buf + n;
+        while (ptr < end) {
+            if (SF_IS_SPACE(*ptr)) {
+                if (word_len > 0 && sf_freq_add(freq, word, word_len) != 0) goto done;
+                word_len = 0;
+                ptr++;
+                continue;
+            }
+            char *start = ptr;
+            while (ptr < end && !SF_IS_SPACE(*ptr)) ptr++;
+            if (word_len == 0 && ptr < end) {
+                if (sf_freq_add(freq, start, ptr - start) != 0) goto done;
+                continue;
+            }
+            if (word_len + (ptr - start) > word_cap) {
+                size_t cap = (word_len + (ptr - start)) * 2;
+                char *grown = realloc(word, cap);
+                if (!grown) goto done;
+                word = grown;
+                word_cap = cap;
+            }
+            memcpy(word + word_len, start, ptr - start);
+            word_len += ptr - start;
+        }
+    }
+    if (n < 0) goto done;
+    if (word_len > 0 && sf_freq_add(freq, word, word_len) != 0) goto done;
+    rc = print_freq(freq, top);
+
+done:
+    free(word);
+    sf_freq_free(freq);
+    return rc;
+}
+
+/*
+    The end of the input has to come out first, so the normalized text is
+    spooled to a temporary file and read back from its end one chunk at a
+    time.  That works the same for stdin, which can not seek.
+*/
+int reverse_stream(stream_t *s){
+    static char out[STREAM_CHUNK_SZ + 1];
+    FILE *spool = tmpfile();
+    int n;
+    int rc = -1;
+
+    if (!spool) return -1;
+    while ((n = stream_next(s, out)) > 0) {
+        if (fwrite(out, 1, n, spool) != (size_t)n) goto done;
+    }
+    if (n < 0) goto done;
+
+    off_t pos = ftello(spool);
+    while (pos > 0) {
+        int len = pos < STREAM_CHUNK_SZ ? (int)pos : STREAM_CHUNK_SZ;
+        pos -= len;
+        if (fseeko(spool, pos, SEEK_SET) != 0 || fread(out, 1, len, spool) != (size_t)len)
+            goto done;
+        char *start = out;
+        char *end = out + len - 1;
+        while (start < end) {
+            char temp = *start;
+            *start = *end;
+            *end = temp;
+            start++;
+            end--;
+        }
+        fwrite(out, 1, len, stdout);
+    }
+    if (ftello(spool) > 0) putchar('\n');
+    rc = 0;
+
+done:
+    fclose(spool);
+    return rc;
+}
+
+/*
+    Replaces the first match like replace_string.  Up to search_len - 1
+    bytes at the end of every window could still be the start of a match,
+    so they are held back and searched again with the next chunk.
+
+    returns the length of the output, or -2 if the search string was not
+    found, in which case the text went out unchanged
+*/
+int replace_stream(stream_t *s, char *search, char *replace){
+    int search_len = (int)strlen(search);
+    int replace_len = (int)strlen(replace);
+    char *win = malloc(STREAM_CHUNK_SZ + 1 + search_len);
+    int hold = 0;       //bytes carried over from the last window
+    int found = 0;
+    long total = 0;
+    int n;
+
+    if (!win) return -1;
+    while ((n = stream_next(s, win + hold)) > 0) {
+        int win_len = hold + n;
+        int start = 0;
+
+        if (!found) {
+            const char *match = sf_find(win, win_len, search, search_len);
+            if (match) {
+                start = (int)(match - win);
+                fwrite(win, 1, start, stdout);
+                fwrite(replace, 1, replace_len, stdout);
+                total += start + replace_len;
+                start += search_len;
+                found = 1;
+            } else {
+                hold = search_len > 1 ? search_len - 1 : 0;
+                if (hold > win_len) hold = win_len;
+                fwrite(win, 1, win_len - hold, stdout);
+                total += win_len - hold;
+                memmove(win, win + win_len - hold, hold);
+                continue;
+            }
+        }
+        fwrite(win + start, 1, win_len - start, stdout);
+        total += win_len - start;
+        hold = 0;
+    }
+
+    // an empty search string matches the start of empty input too
+    if (n == 0 && !found && search_len == 0) {
+        fwrite(replace, 1, replace_len, stdout);
+        total += replace_len;
+        found = 1;
+    }
+    fwrite(win, 1, hold, stdout);
+    total += hold;
+    if (total > 0) putchar('\n');
+    free(win);
+
+    if (n < 0) return -1;
+    if (!found) return -2;
+    return total > 0x7fffffff ? 0x7fffffff : (int)total;
+}
+
+/*
+    Replaces every match of a stream.  The output of a window is a list of
+    pieces pointing into the window or at the replacement, and writev
+    sends the list as is, so no byte is copied on its way out.  Like
+    replace_stream the last search_len - 1 bytes after the last match are
+    held back for the next window, those are the only bytes ever moved.
+*/
+#define REPLACE_IOV_MAX 1024    //pieces gathered before a writev
+
+int replace_all_stream(stream_t *s, char *search, char *replace){
+    int search_len = (int)strlen(search);
+    int replace_len = (int)strlen(replace);
+    char *win = malloc(STREAM_CHUNK_SZ + 1 + search_len);
+    struct iovec iov[REPLACE_IOV_MAX + 1];
+    int hold = 0;
+    int nmatches = 0;
+    long total = 0;
+    int n = -1;
+
+    if (!win || search_len == 0) goto done;
+    fflush(stdout);
+    while ((n = stream_next(s, win + hold)) > 0) {
+        int win_len = hold + n;
+        int niov = 0;
+        int from = 0;
+        const char *found = win;
+
+        while ((found = sf_find(found, win + win_len - found, search, search_len)) != NULL) {
+            int at = (int)(found - win);
+            iov[niov++] = (struct iovec){ win + from, at - from };
+            iov[niov++] = (struct iovec){ replace, replace_len };
+            total += at - from + replace_len;
+            from = at + search_len;
+            found += search_len;
+            nmatches++;
+            if (niov >= REPLACE_IOV_MAX - 1) {
+                if (sf_writev_all(STDOUT_FILENO, iov, niov) != 0) goto fail;
+                niov = 0;
+            }
+        }
+
+        //the tail after the last match may hold the start of the next one
+        hold = search_len - 1;
+        if (hold > win_len - from) hold = win_len - from;
+        iov[niov++] = (struct iovec){ win + from, win_len - hold - from };
+        total += win_len - hold - from;
+        if (sf_writev_all(STDOUT_FILENO, iov, niov) != 0) goto fail;
+        memmove(win, win + win_len - hold, hold);
+    }
+    if (n < 0) goto done;
+
+    iov[0] = (struct iovec){ win, hold };
+    iov[1] = (struct iovec){ "\n", total + hold > 0 };
+    if (sf_writev_all(STDOUT_FILENO, iov, 2) != 0) goto fail;
+    total += hold;
+
+done:
+    free(win);
+    if (n < 0) return -1;
+    if (nmatches == 0) return -2;
+    return total > 0x7fffffff ? 0x7fffffff : (int)total;
+
+fail:
+    free(win);
+    return -1;
+}
+
+/*
+    -m over a stream, written out the way replace_all_stream does it.
+    The automaton says how much of the window can not be part of a match
+    any more, everything after that (at most the longest search) is held
+    back and scanned again with the next window.
+*/
+int replace_multi_stream(stream_t *s, pairs_t *p){
+    char *win = malloc(STREAM_CHUNK_SZ + 1 + p->max_len);
+    struct iovec iov[REPLACE_IOV_MAX + 1];
+    int hold = 0;
+    int nmatches = 0;
+    int eof = 0;
+    long total = 0;
+    int n = -1;
+
+    if (!win) goto done;
+    fflush(stdout);
+    while (!eof) {
+        n = stream_next(s, win + hold);
+        if (n < 0) goto done;
+        eof = n == 0;
+
+        int win_len = hold + n;
+        int niov = 0;
+        size_t pos = 0, start, safe;
+        int from = 0;
+        int k;
+
+        while ((k = sf_ac_find(p->ac, win + pos, win_len - pos, eof, &start, &safe)) >= 0) {
+            int at = (int)(pos + start);
+            iov[niov++] = (struct iovec){ win + from, at - from };
+            iov[niov++] = (struct iovec){ p->replace[k], p->replace_len[k] };
+            total += at - from + p->replace_len[k];
+            from = at + (int)p->search_len[k];
+            pos = from;
+            nmatches++;
+            if (niov >= REPLACE_IOV_MAX - 1) {
+                if (sf_writev_all(STDOUT_FILENO, iov, niov) != 0) goto fail;
+                niov = 0;
+            }
+        }
+
+        hold = win_len - (int)(pos + safe);
+        iov[niov++] = (struct iovec){ win + from, win_len - hold - from };
+        total += win_len - hold - from;
+        if (eof) iov[niov++] = (struct iovec){ "\n", total > 0 };
+        if (sf_writev_all(STDOUT_FILENO, iov, niov) != 0) goto fail;
+        memmove(win, win + win_len - hold, hold);
+    }
+
+done:
+    free(win);
+    if (n < 0) return -1;
+    if (nmatches == 0) return -2;
+    return total > 0x7fffffff ? 0x7fffffff : (int)total;
+
+fail:
+    free(win);
+    return -1;
+}
+
+//runs an option over a file or stdin, args are what follows -s
+int stream_main(char opt, int argc, char *argv[]){
+    int nfiles = opt == 'x' || opt == 'X' ? argc - 2 : opt == 'm' ? argc - 1
+               : opt == 'f' && argc == 2 ? 1 : argc;
+    int top = opt == 'f' && argc == 2 ? atoi(argv[1]) : FREQ_TOP_DEFAULT;
+    pairs_t *pairs = NULL;
+    int rc;
+
+    if (nfiles < 0 || nfiles > 1 || !strchr("crwxXmf", opt) || top <= 0) {
+        return -1;
+    }
+    //an empty search would match everywhere, refused like replace_all does
+    if (opt == 'X' && argv[nfiles][0] == '\0') {
+        fprintf(stderr, "Error performing string replacement, rc = %d\n", -1);
+        return 2;
+    }
+    if (opt == 'm' && !(pairs = load_pairs(argv[nfiles]))) {
+        return 2;
+    }
+
+    stream_t *s = malloc(sizeof(stream_t));
+    if (!s) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        free_pairs(pairs);
+        return 99;
+    }
+    s->sep = 0;
+    s->started = 0;
+    s->in = stdin;
+    if (nfiles == 1 && strcmp(argv[0], "-") != 0) {
+        s->in = fopen(argv[0], "rb");
+        if (!s->in) {
+            fprintf(stderr, "Error opening %s\n", argv[0]);
+            free(s);
+            free_pairs(pairs);
+            return 2;
+        }
+    }
+
+    switch (opt){
+        case 'c':
+            rc = count_words_stream(s);
+            if (rc >= 0) printf("Word Count: %d\n", rc);
+            break;
+        case 'r':
+            rc = reverse_stream(s);
+            break;
+        case 'w':
+            rc = print_words_stream(s);
+            if (rc >= 0) printf("\nNumber of words returned: %d\n", rc);
+            break;
+        case 'f':
+            rc = word_freq_stream(s, top);
+            if (rc >= 0) printf("\nNumber of distinct words: %d\n", rc);
+            break;
+        case 'x':
+            rc = replace_stream(s, argv[nfiles], argv[nfiles + 1]);
+            break;
+        case 'X':
+            rc = replace_all_stream(s, argv[nfiles], argv[nfiles + 1]);
+            break;
+        default:
+            rc = replace_multi_stream(s, pairs);
+            break;
+    }
+
+    if (s->in != stdin) fclose(s->in);
+    free(s);
+    free_pairs(pairs);
+
+    if (rc == -2) {
+        fprintf(stderr, "Error: Search string not found\n");
+        return 3;
+    }
+    if (rc < 0) {
+        fprintf(stderr, "Error reading input, rc = %d\n", rc);
+        return 2;
+    }
+    return 0;
+}
+
+/*
+    -c -j N counts a file on N threads.  The file is mapped instead of
+    read so every thread works straight on the page cache, and
+    sf_count_words_mt() stitches the counts where a word spans a split.
+    Input that can not be mapped, like a pipe, is streamed instead.
+*/
+int count_words_parallel(int nthreads, int argc, char *argv[]){
+    struct stat st;
+    int fd = 0;
+
+    if (nthreads < 1 || argc > 1) return -1;
+    if (argc == 1 && strcmp(argv[0], "-") != 0) {
+        fd = open(argv[0], O_RDONLY);
+        if (fd == -1) {
+            fprintf(stderr, "Error opening %s\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        if (fd != 0) close(fd);
+        return stream_main('c', argc, argv);
+    }
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (fd != 0) close(fd);
+    if (map == MAP_FAILED) {
+        return stream_main('c', argc, argv);
+    }
+    madvise(map, st.st_size, MADV_WILLNEED);
+
+    size_t word_count = sf_count_words_mt(map, st.st_size, nthreads);
+    munmap(map, st.st_size);
+    printf("Word Count: %zu\n", word_count);
+    return 0;
+}
+
 int main(int argc, char *argv[]){
     char *buff;             //placehoder for the internal buffer
     char *input_string;     //holds the string provided by the user on cmd line
     char opt;               //used to capture user option from cmd line
     int  rc;                //used for return codes
     int  user_str_len;      //length of user supplied string
+    strview_t sv;           //the buffer and how much of it is content
+    int  top;               //words -f lists
 
     //TODO:  #1. WHY IS THIS SAFE, aka what if arv[1] does not exist?
     /*      This check is safe because the if condition first checks if (argc < 2) before attempting to access
@@ -296,6 +1070,26 @@ int main(int argc, char *argv[]){
 
     //WE NOW WILL HANDLE THE REQUIRED OPERATIONS
 
+    //-s streams a file or stdin of any size instead of the argv string
+    if (argc >= 3 && strcmp(argv[2], "-s") == 0){
+        rc = stream_main(opt, argc - 3, argv + 3);
+        if (rc < 0){
+            usage(argv[0]);
+            exit(1);
+        }
+        exit(rc);
+    }
+
+    //-c -j N [file|-] counts a large file on N threads
+    if (opt == 'c' && argc >= 4 && strcmp(argv[2], "-j") == 0){
+        rc = count_words_parallel(atoi(argv[3]), argc - 4, argv + 4);
+        if (rc < 0){
+            usage(argv[0]);
+            exit(1);
+        }
+        exit(rc);
+    }
+
     //TODO:  #2 Document the purpose of the if statement below
     //      PLACE A COMMENT BLOCK HERE EXPLAINING
     /*
@@ -320,7 +1114,8 @@ int main(int argc, char *argv[]){
         exit(99);
     }
 
-    user_str_len = setup_buff(buff, input_string, BUFFER_SZ);     //see todos
+    sv = (strview_t){ buff, 0, BUFFER_SZ };
+    user_str_len = setup_buff(&sv, input_string);     //see todos
     if (user_str_len < 0){
         printf("Error setting up buffer, error = %d\n", user_str_len);
         free(buff);
@@ -329,7 +1124,7 @@ int main(int argc, char *argv[]){
 
     switch (opt){
         case 'c':
-            rc = count_words(buff, BUFFER_SZ, user_str_len);  //you need to implement
+            rc = count_words(&sv);  //you need to implement
             if (rc < 0){
                 printf("Error counting words, rc = %d\n", rc);
                 free(buff);
@@ -341,7 +1136,7 @@ int main(int argc, char *argv[]){
         //TODO:  #5 Implement the other cases for 'r' and 'w' by extending
         //       the case statement options
         case 'r':
-            rc = reverse_string(buff, BUFFER_SZ, user_str_len);
+            rc = reverse_string(&sv);
             if (rc < 0) {
                 printf("Error reversing string, rc = %d\n", rc);
                 free(buff);
@@ -350,7 +1145,7 @@ int main(int argc, char *argv[]){
             break;
             
         case 'w':
-            rc = print_words(buff, BUFFER_SZ, user_str_len);
+            rc = print_words(&sv);
             if (rc < 0) {
                 printf("Error printing words, rc = %d\n", rc);
                 free(buff);
@@ -359,13 +1154,58 @@ int main(int argc, char *argv[]){
             printf("\nNumber of words returned: %d\n", rc);
             break;
             
+        case 'f':
+            top = argc > 3 ? atoi(argv[3]) : FREQ_TOP_DEFAULT;
+            if (top <= 0) {
+                printf("Error: -f takes a positive number of words\n");
+                free(buff);
+                exit(1);
+            }
+            rc = word_freq(&sv, top);
+            if (rc < 0) {
+                printf("Error counting word frequencies, rc = %d\n", rc);
+                free(buff);
+                exit(2);
+            }
+            printf("\nNumber of distinct words: %d\n", rc);
+            break;
+            
         case 'x':
+        case 'X':
             if (argc < 5) {
-                printf("Error: -x option requires two additional arguments\n");
+                printf("Error: -%c option requires two additional arguments\n", opt);
+                free(buff);
+                exit(1);
+            }
+            if (opt == 'x')
+                rc = replace_string(&sv, argv[3], argv[4]);
+            else
+                rc = replace_all(&sv, argv[3], argv[4]);
+            if (rc == -2) {
+                printf("Error: Search string not found\n");
+                free(buff);
+                exit(3);
+            }
+            if (rc < 0) {
+                printf("Error performing string replacement, rc = %d\n", rc);
+                free(buff);
+                exit(2);
+            }
+            break;
+            
+        case 'm':
+            if (argc < 4) {
+                printf("Error: -m option requires a pairs file\n");
                 free(buff);
                 exit(1);
             }
-            rc = replace_string(buff, BUFFER_SZ, user_str_len, argv[3], argv[4]);
+            pairs_t *pairs = load_pairs(argv[3]);
+            if (!pairs) {
+                free(buff);
+                exit(2);
+            }
+            rc = replace_multi(&sv, pairs);
+            free_pairs(pairs);
             if (rc == -2) {
                 printf("Error: Search string not found\n");
                 free(buff);
@@ -376,7 +1216,6 @@ int main(int argc, char *argv[]){
                 free(buff);
                 exit(2);
             }
-            user_str_len = rc;  // Update string length after replacement
             break;
             
         default:
@@ -386,7 +1225,7 @@ int main(int argc, char *argv[]){
     }
 
     //TODO:  #6 Dont forget to free your buffer before exiting
-    print_buff(buff, BUFFER_SZ);
+    print_buff(&sv);
     free(buff);
     exit(0);
 }
@@ -32,6 +32,12 @@ Buffer:  [There should be eight words in this sentence......]" ]
 Buffer:  [The strange spaces should be removed from this....]" ]
 }
 
+@test "wordcount splits on spaces only like -w" {
+    run ./stringfun -c "$(printf 'a\nb c')"
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Word Count: 2" ]
+}
+
 @test "reverse" {
     run ./stringfun -r "Reversed sentences look very weird"
     [ "$status" -eq 0 ]
@@ -99,3 +105,201 @@ Buffer:  [Lets get a lot of words to test...................]" ]
     [ "$output" = "Not Implemented!" ]
 }
 
+
+@test "stream mode counts and prints words from stdin" {
+    run bash -c "printf '  Lets get\t a\n\n lot   of words  ' | ./stringfun -w -s"
+    [ "$status" -eq 0 ]
+    [ "$output" = "Word Print
+----------
+1. Lets(4)
+2. get(3)
+3. a(1)
+4. lot(3)
+5. of(2)
+6. words(5)
+
+Number of words returned: 6" ]
+}
+
+@test "stream mode handles words and matches across chunk boundaries" {
+    # 65535 bytes put both the word and the match across the first 64K chunk
+    head -c 65535 /dev/zero | tr '\0' 'a' > stream.txt
+    printf 'needle  b c  \n' >> stream.txt
+    run ./stringfun -c -s stream.txt
+    [ "$output" = "Word Count: 3" ]
+
+    run bash -c "./stringfun -x -s stream.txt aneedle X | tail -c 7"
+    [ "$output" = "aX b c" ]
+
+    run bash -c "./stringfun -r -s stream.txt | head -c 10"
+    rm -f stream.txt
+    [ "$output" = "c b eldeen" ]
+}
+
+@test "every word count kernel gives the same count" {
+    # a word ends exactly on a 64 byte block boundary, then tabs and returns
+    printf '%063d x\t\r\ny  z\v\f%s end\n' 0 "$(head -c 200 /dev/zero | tr '\0' 'w')" > kernel.txt
+    for k in scalar sse2 ssse3 avx2; do
+        run env SF_KERNEL=$k ./stringfun -c -s kernel.txt
+        [ "$output" = "Word Count: 6" ]
+    done
+    rm -f kernel.txt
+}
+
+@test "every squeeze kernel sets up the same buffer" {
+    # blank runs cross the 16 and 32 byte blocks, leading and trailing blanks go
+    for k in scalar sse2 ssse3 avx2; do
+        run env SF_KERNEL=$k ./stringfun -c "$(printf '  \t The  quick\t\tbrown   fox jumps over  the lazy dog \t ')"
+        [ "$status" -eq 0 ]
+        [ "${lines[1]}" = "Buffer:  [The quick brown fox jumps over the lazy dog.......]" ]
+    done
+
+    # exactly full once the trailing blanks are dropped, one more word is too long
+    full=$(printf '%050d' 0)
+    run ./stringfun -c "  $full  $(printf '\t') "
+    [ "$status" -eq 0 ]
+    run ./stringfun -c "$full x"
+    [ "$status" -eq 2 ]
+}
+
+@test "parallel word count matches the sequential count" {
+    # long words make sure some split points land inside a word
+    for i in $(seq 1 3000); do printf 'word%05d%0*d \n\t' $i $((i % 97)) 0; done > par.txt
+    run ./stringfun -c -s par.txt
+    [ "$output" = "Word Count: 3000" ]
+    for j in 1 2 3 7 16; do
+        run ./stringfun -c -j $j par.txt
+        [ "$output" = "Word Count: 3000" ]
+    done
+
+    # a pipe can not be mapped and is streamed instead
+    run bash -c "cat par.txt | ./stringfun -c -j 4"
+    rm -f par.txt
+    [ "$output" = "Word Count: 3000" ]
+}
+
+@test "replace finds periodic patterns after near misses" {
+    run ./stringfun -x "aab aaab aaaab done" aaaab X
+    # a shorter replacement leaves no stale bytes behind it
+    [ "$output" = "Buffer:  [aab aaab X done...................................]" ]
+
+    # 200 near misses of a 300 byte pattern before the real match
+    pat=$(printf 'a%.0s' $(seq 1 299))b
+    for i in $(seq 1 200); do printf 'a%.0s' $(seq 1 $((i + 50))); printf 'b '; done > periodic.txt
+    printf '%s tail\n' "$pat" >> periodic.txt
+    run bash -c "./stringfun -x -s periodic.txt $pat X | tail -c 9"
+    rm -f periodic.txt
+    [ "$output" = "b X tail" ]
+}
+
+@test "replace all matches" {
+    run ./stringfun -X "the cat saw the other cat" cat dog
+    [ "$status" -eq 0 ]
+    [ "$output" = "Buffer:  [the dog saw the other dog.........................]" ]
+
+    # matches do not overlap and the result is cut off at the buffer size
+    run ./stringfun -X "aaaa aa" aa b
+    [ "$output" = "Buffer:  [bb b..............................................]" ]
+    run ./stringfun -X "This is a super long string for testing my program" s SSSS
+    [ "$output" = "Buffer:  [ThiSSSS iSSSS a SSSSuper long SSSString for teSSSS]" ]
+
+    run ./stringfun -X "This is a bad test" good bad
+    [ "$status" -eq 3 ]
+}
+
+@test "stream replace all matches across chunk boundaries" {
+    head -c 65533 /dev/zero | tr '\0' 'a' > replace.txt
+    printf 'needle needle\n needle' >> replace.txt
+    run bash -c "./stringfun -X -s replace.txt needle N | tail -c 7"
+    rm -f replace.txt
+    [ "$status" -eq 0 ]
+    [ "$output" = "aN N
+N" ]
+}
+
+@test "replace all rejects an empty search in both modes" {
+    run ./stringfun -X "abc" "" z
+    [ "$status" -eq 2 ]
+    [ "$output" = "Error performing string replacement, rc = -1" ]
+    run bash -c './stringfun -X -s /nonexistent "" z 2>&1 >/dev/null'
+    [ "$status" -eq 2 ]
+    [ "$output" = "Error performing string replacement, rc = -1" ]
+}
+
+@test "replace many pairs in one pass" {
+    printf 'cat=dog\ncatalog=list\nalog=X\n\nthe=a\r\n' > pairs.txt
+    # the match that starts first wins, then the longest of those
+    run ./stringfun -m "the catalog shows the cat" pairs.txt
+    [ "$status" -eq 0 ]
+    [ "$output" = "Buffer:  [a list shows a dog................................]" ]
+
+    run ./stringfun -m "no match here" pairs.txt
+    [ "$status" -eq 3 ]
+
+    # a match held back at a chunk boundary can still grow into a longer one
+    head -c 65530 /dev/zero | tr '\0' 'b' > multi.txt
+    printf ' catalog cat\n' >> multi.txt
+    run bash -c "./stringfun -m -s multi.txt pairs.txt | tail -c 11"
+    [ "$status" -eq 0 ]
+    [ "$output" = "b list dog" ]
+
+    printf 'cat\n' > pairs.txt
+    run ./stringfun -m "the cat" pairs.txt
+    rm -f pairs.txt multi.txt
+    [ "$status" -eq 2 ]
+}
+
+@test "dots in the input are content, not the end of it" {
+    run ./stringfun -c "end. of it"
+    [ "$output" = "Word Count: 3
+Buffer:  [end. of it........................................]" ]
+
+    run ./stringfun -r "a.b c"
+    [ "$output" = "Buffer:  [c b.a.............................................]" ]
+
+    run ./stringfun -x "v1.2 and v1.3" 1.3 2.0
+    [ "$status" -eq 0 ]
+    [ "$output" = "Buffer:  [v1.2 and v2.0.....................................]" ]
+}
+
+@test "word print output spans many staging flushes" {
+    for i in $(seq 1 30000); do printf 'w%d ' $i; done > words.txt
+    run bash -c "./stringfun -w -s words.txt | tail -n 4"
+    [ "$output" = "29999. w29999(6)
+30000. w30000(6)
+
+Number of words returned: 30000" ]
+    run bash -c "./stringfun -w -s words.txt | wc -l"
+    rm -f words.txt
+    [ "$output" = "30004" ]
+}
+
+@test "word frequencies list the top words" {
+    run ./stringfun -f "the cat and the dog and the bird" 2
+    [ "$status" -eq 0 ]
+    [ "$output" = "Word Frequency
+--------------
+      3 the
+      2 and
+
+Number of distinct words: 5
+Buffer:  [the cat and the dog and the bird..................]" ]
+
+    # equal counts come in byte order, words cross chunk boundaries
+    head -c 65534 /dev/zero | tr '\0' 'a' > freq.txt
+    for i in $(seq 1 3000); do printf ' b%d zz' $((i % 500)); done >> freq.txt
+    run bash -c "./stringfun -f -s freq.txt 4"
+    rm -f freq.txt
+    [ "$status" -eq 0 ]
+    [ "$output" = "Word Frequency
+--------------
+   3000 zz
+      6 b0
+      6 b1
+      6 b10
+
+Number of distinct words: 502" ]
+
+    run ./stringfun -f "a b" 0
+    [ "$status" -eq 1 ]
+}
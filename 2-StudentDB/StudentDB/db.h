@@ -1,6 +1,8 @@
 #ifndef __DB_H__
     #define __DB_H__
 
+#include <stdint.h>
+
 // Basic student database record.  Note:
 //  1. id must be > 0.  A student id==0 means the record has been deleted
 //  2. gpa is an int, should be between 0<=gpa<=500, real gpa is gpa/100.0 this
@@ -29,7 +31,150 @@ static const int STUDENT_RECORD_SIZE  = sizeof(struct student);
 static const int DELETED_STUDENT_ID = 0;
 
 
+//Database file versions.  A version 1 database is the plain array of
+//student_t slots indexed by id.  Because ids start at MIN_STD_ID the first
+//slot of a version 1 file is always empty, so a version 2 database stores
+//its db_header_t there instead and is recognized by DB_V2_MAGIC.
+//
+//A version 2 database is laid out as:
+//  [db_header_t][dir_entry_t x dir_slots][pad to DB_V2_HEAP_ALIGN][heap]
+//The directory is indexed by id and gives the offset and length of that
+//student's record in the heap, an offset of 0 means the slot is empty.
+//Heap records are a v2_record_t followed by flen bytes of first name and
+//llen bytes of last name (no NUL), packed back to back.  Deleted records
+//stay in the heap as dead bytes until the database is compressed.
+#define DB_VERSION_1        1
+#define DB_VERSION_2        2
+#define DB_V2_MAGIC         "SDB2"
+#define DB_V2_HEAP_ALIGN    4096
+#define DB_V2_NAME_MAX      255
+
+typedef struct db_header{
+    char magic[4];
+    int version;
+    uint32_t dir_slots;     //number of directory entries (max id + 1)
+    uint32_t count;         //number of live students
+    uint64_t heap_off;      //file offset of the first heap record
+    uint64_t heap_end;      //file offset where the next record is appended
+    uint64_t dead_bytes;    //heap bytes held by deleted records
+    char reserved[24];
+} db_header_t;
+
+typedef struct dir_entry{
+    uint32_t off;
+    uint32_t len;
+} dir_entry_t;
+
+typedef struct v2_record{
+    uint32_t id;
+    uint16_t gpa;
+    uint8_t flen;
+    uint8_t llen;
+} v2_record_t;
+
+#define V2_RECORD_MAX   (sizeof(v2_record_t) + 2 * DB_V2_NAME_MAX)
+
+//Checksum file kept next to the database as <db file>CRC_FILE_SUFFIX.  It
+//holds a CRC_HDR_SIZE header starting with CRC_MAGIC followed by one uint32
+//per id: 0 for an empty slot, otherwise the CRC32C of the stored record
+//(the 64 byte slot in version 1, the encoded heap record in version 2),
+//with a CRC that happens to be 0 stored as 1.
+#define CRC_FILE_SUFFIX     ".crc"
+#define CRC_MAGIC           "SDBC"
+#define CRC_HDR_SIZE        64
+
 #define DB_FILE     "student.db"            //name of database file
 #define TMP_DB_FILE ".tmp_student.db"       //for extra credit
 
-#endif
\ No newline at end of file
+//Layout of the compact archive file produced by export (-e) and consumed by
+//import (-r).  The archive is columnar: a fixed header followed by four
+//sections, each holding one field of every exported student in id order:
+//  ids:    LEB128 varints of the delta from the previous id (first from 0)
+//  fname:  name tokens, see below
+//  lname:  name tokens, see below
+//  gpa:    9 bit values packed LSB first, zero padded to a whole byte
+//A name token is a varint.  Zero means a literal follows (1 length byte then
+//the name bytes, no NUL) and the name is stored into dictionary slot
+//hash(name) % ARC_DICT_SLOTS.  Any other value v references slot v-1.  Both
+//sides keep the same fixed size dictionary so memory use does not grow with
+//the archive.  All header integers are little endian.
+#define ARC_MAGIC       "SDBA"
+#define ARC_VERSION     1
+#define ARC_HDR_SIZE    64
+#define ARC_SECTIONS    4
+#define ARC_DICT_SLOTS  4096
+#define ARC_GPA_BITS    9
+
+//Optional trigram index kept next to the database as <db file>TRI_FILE_SUFFIX.
+//A trigram is three lower case bytes of a name word packed as b0<<16|b1<<8|b2,
+//with every word padded as "  word " so the ends of words count too.  The
+//file holds a tri_header_t, then one byte per id 0..max_id with the number of
+//distinct trigrams of that student, then tri_entry_t sorted by trigram, then
+//the posting lists: the ids of every student with the trigram as LEB128
+//varints of the delta from the previous id.  Everything from log_off to the
+//end of the file is a log of uint32 ids changed since the index was built.
+#define TRI_FILE_SUFFIX ".tri"
+#define TRI_MAGIC       "SDBT"
+#define TRI_VERSION     1
+
+typedef struct tri_header {
+    char magic[4];                  //TRI_MAGIC
+    uint32_t version;               //TRI_VERSION
+    uint32_t ntrigrams;             //entries in the trigram table
+    uint32_t max_id;                //highest id in the count table
+    uint64_t counts_off;
+    uint64_t table_off;
+    uint64_t post_off;
+    uint64_t log_off;
+    uint8_t reserved[16];
+} tri_header_t;
+
+typedef struct tri_entry {
+    uint32_t trigram;
+    uint32_t count;                 //ids in the posting list
+    uint64_t off;                   //posting list offset from post_off
+} tri_entry_t;
+
+//Optional GPA index kept next to the database as <db file>GPA_FILE_SUFFIX.
+//The file holds a gpa_header_t, then GPA_BUCKETS + 1 uint32 bucket starts,
+//then the ids of every student grouped by GPA, ascending within a GPA, so
+//the students with GPA g are ids[start[g]] up to ids[start[g + 1]].  Then
+//one uint16 per id 0..max_id holding the GPA of that student plus one, 0
+//if there was none.  Everything from log_off to the end of the file is a
+//log of uint32 ids changed since the index was built.
+#define GPA_FILE_SUFFIX ".gpa"
+#define GPA_MAGIC       "SDBG"
+#define GPA_VERSION     1
+#define GPA_BUCKETS     (MAX_STD_GPA + 1)
+
+typedef struct gpa_header {
+    char magic[4];                  //GPA_MAGIC
+    uint32_t version;               //GPA_VERSION
+    uint32_t count;                 //ids in the index
+    uint32_t max_id;                //highest id in the GPA table
+    uint64_t start_off;
+    uint64_t ids_off;
+    uint64_t gpa_off;
+    uint64_t log_off;
+    uint8_t reserved[16];
+} gpa_header_t;
+
+//A sharded database keeps its students in up to SHARD_MAX ordinary database
+//files and the database file itself becomes a text manifest naming them:
+//  SDBS 1 hash                     SDBS 1 range
+//  student.db.0                    1 student.db.0
+//  /mnt/disk2/student.db.1         50001 /mnt/disk2/student.db.1
+//The first line gives SHARD_MAGIC, SHARD_VERSION and how ids are placed.
+//In hash mode every line after it names one shard file and an id lives in
+//shard hash(id) % shards.  In range mode every line starts with the lowest
+//id of that shard, ascending and starting at MIN_STD_ID, and a shard holds
+//every id up to the next one.  Relative paths are relative to the directory
+//of the manifest.  Blank lines and lines starting with # after the first
+//line are ignored.  Each shard file has its own checksum, trigram and GPA
+//index files.
+#define SHARD_MAGIC     "SDBS"
+#define SHARD_VERSION   1
+#define SHARD_MAX       64
+#define SHARD_LINE_MAX  4096
+
+#endif
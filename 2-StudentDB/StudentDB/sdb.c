@@ -0,0 +1,1837 @@
+#define _GNU_SOURCE     //fallocate(), O_DIRECT
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h> //c library for system call file routines
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// database include files
+#include "db.h"
+#include "sdbint.h"
+
+/*
+ *  libsdb core
+ *
+ *  Every function here works on an sdb_t handle and reports its outcome
+ *  only through return codes, see sdb.h.  The handle remembers which
+ *  database version the file holds (see db.h) and, for version 2, a copy
+ *  of the header that is written straight back whenever it changes.
+ */
+
+static off_t dir_offset(uint32_t id)
+{
+    return sizeof(db_header_t) + (off_t)id * sizeof(dir_entry_t);
+}
+
+static off_t slot_offset(int id)
+{
+    return (off_t)id * STUDENT_RECORD_SIZE;
+}
+
+/*
+ *  Bulk writers reserve file space before they fill it, so the filesystem
+ *  hands out a few large extents instead of growing the file a buffer at a
+ *  time.  Reservations use FALLOC_FL_KEEP_SIZE so the file size still only
+ *  moves with the writes, and they are best effort: a filesystem without
+ *  fallocate() just allocates as the writes come.
+ */
+
+//reserves the pages under [off, off + len)
+static void prealloc(int fd, off_t off, off_t len)
+{
+    off_t start = off & ~(off_t)(WRITE_ALIGN - 1);
+    off_t end = (off + len + WRITE_ALIGN - 1) & ~(off_t)(WRITE_ALIGN - 1);
+
+    if (end > start)
+        io_fallocate(fd, FALLOC_FL_KEEP_SIZE, start, end - start);
+}
+
+//gives back the whole pages of [off, end) that were reserved but not written
+static void unreserve(int fd, off_t off, off_t end)
+{
+    off_t start = (off + WRITE_ALIGN - 1) & ~(off_t)(WRITE_ALIGN - 1);
+
+    end &= ~(off_t)(WRITE_ALIGN - 1);
+    if (end > start)
+        io_fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start, end - start);
+}
+
+/*
+ *  grow_reserve
+ *      db:     handle a bulk load is about to write to
+ *      off:    first byte the load writes
+ *      end:    end of what the load writes
+ *      limit:  the file never grows past this
+ *
+ *  Keeps the database file reserved half again past end, at least
+ *  PREALLOC_CHUNK, so a long load grows the file in a few large extents
+ *  the way a growing array doubles.  What a load leaves unused stays
+ *  reserved past the end of the file for the next one, a rebuild gives it
+ *  back.
+ */
+static void grow_reserve(sdb_t *db, off_t off, off_t end, off_t limit)
+{
+    if (end <= db->reserved)
+        return;
+    off_t to = end + (end / 2 > PREALLOC_CHUNK ? end / 2 : PREALLOC_CHUNK);
+    if (to > limit)
+        to = limit;
+    off_t from = off > db->reserved ? off : db->reserved;
+    prealloc(db->fd, from, to - from);
+    db->reserved = to;
+}
+
+//what a rebuild of src may need to reserve: the allocated size of src
+//holds every live record in either format, 0 for a mostly sparse source
+//that is better left to allocate as it is written
+static off_t rebuild_bound(sdb_t *src)
+{
+    struct stat st;
+
+    if (src->nshards || io_fstat(src->fd, &st) == -1)
+        return 0;
+    off_t used = (off_t)st.st_blocks * 512;
+    return used * 2 >= st.st_size ? used : 0;
+}
+
+static bool id_in_range(int id)
+{
+    return id >= MIN_STD_ID && id <= MAX_STD_ID;
+}
+
+static bool gpa_in_range(int gpa)
+{
+    return gpa >= MIN_STD_GPA && gpa <= MAX_STD_GPA;
+}
+
+static off_t crc_offset(uint32_t id)
+{
+    return CRC_HDR_SIZE + (off_t)id * sizeof(uint32_t);
+}
+
+//records the checksum stamp of student id, 0 marks the slot empty
+static int put_crc(sdb_t *db, uint32_t id, uint32_t stamp)
+{
+    if (io_pwrite(db->crc_fd, &stamp, sizeof(stamp), crc_offset(id)) != sizeof(stamp))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+//truncates a checksum file down to just its header
+static int reset_crc_file(int crc_fd)
+{
+    uint8_t hdr[CRC_HDR_SIZE] = {0};
+
+    memcpy(hdr, CRC_MAGIC, 4);
+    if (io_ftruncate(crc_fd, 0) == -1 || io_pwrite(crc_fd, hdr, CRC_HDR_SIZE, 0) != CRC_HDR_SIZE)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+static int load_db_version(sdb_t *db)
+{
+    db_header_t hdr = {0};
+    int version = DB_VERSION_1;
+
+    ssize_t n = io_pread(db->fd, &hdr, sizeof(hdr), 0);
+    if (n == -1)
+        return ERR_DB_FILE;
+
+    if (n == sizeof(hdr) && memcmp(hdr.magic, DB_V2_MAGIC, 4) == 0) {
+        if (hdr.version != DB_VERSION_2)
+            return ERR_DB_FILE;
+        version = DB_VERSION_2;
+    }
+
+    db->version = version;
+    db->hdr = hdr;
+    return version;
+}
+
+int write_db_header(sdb_t *db)
+{
+    if (io_pwrite(db->fd, &db->hdr, sizeof(db_header_t), 0) != sizeof(db_header_t))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+//writes the header of a version 2 database, or of every version 2 shard,
+//after a batch of adds or deletes that left it to be written once
+int sync_db_headers(sdb_t *db)
+{
+    for (int i = 0; i < db->nshards; i++) {
+        if (sync_db_headers(db->shards[i]) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    if (db->nshards == 0 && db->version == DB_VERSION_2)
+        return write_db_header(db);
+    return NO_ERROR;
+}
+
+static void init_header_v2(db_header_t *hdr)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, DB_V2_MAGIC, 4);
+    hdr->version = DB_VERSION_2;
+    hdr->dir_slots = MAX_STD_ID + 1;
+    hdr->heap_off = (dir_offset(hdr->dir_slots) + DB_V2_HEAP_ALIGN - 1) &
+                    ~(uint64_t)(DB_V2_HEAP_ALIGN - 1);
+    hdr->heap_end = hdr->heap_off;
+}
+
+//lays out an empty version 2 database in a freshly truncated file
+static int format_db_v2(sdb_t *db)
+{
+    init_header_v2(&db->hdr);
+    if (io_ftruncate(db->fd, db->hdr.heap_off) == -1 || write_db_header(db) != NO_ERROR)
+        return ERR_DB_FILE;
+    db->version = DB_VERSION_2;
+    return NO_ERROR;
+}
+
+//encodes a version 2 heap record into buf, returns its length
+static uint32_t encode_v2(uint8_t *buf, int id, const char *fname, const char *lname, int gpa)
+{
+    v2_record_t rec;
+
+    rec.id = id;
+    rec.gpa = gpa;
+    rec.flen = strnlen(fname, DB_V2_NAME_MAX);
+    rec.llen = strnlen(lname, DB_V2_NAME_MAX);
+
+    memcpy(buf, &rec, sizeof(rec));
+    memcpy(buf + sizeof(rec), fname, rec.flen);
+    memcpy(buf + sizeof(rec) + rec.flen, lname, rec.llen);
+    return sizeof(rec) + rec.flen + rec.llen;
+}
+
+//decodes a version 2 heap record, names longer than student_t holds are cut
+static int decode_v2(const uint8_t *buf, uint32_t len, student_t *s)
+{
+    v2_record_t rec;
+
+    if (len < sizeof(rec))
+        return ERR_DB_FILE;
+    memcpy(&rec, buf, sizeof(rec));
+    if (sizeof(rec) + rec.flen + rec.llen != len)
+        return ERR_DB_FILE;
+
+    memset(s, 0, sizeof(*s));
+    s->id = rec.id;
+    s->gpa = rec.gpa;
+    memcpy(s->fname, buf + sizeof(rec),
+           rec.flen < sizeof(s->fname) ? rec.flen : sizeof(s->fname) - 1);
+    memcpy(s->lname, buf + sizeof(rec) + rec.flen,
+           rec.llen < sizeof(s->lname) ? rec.llen : sizeof(s->lname) - 1);
+    return NO_ERROR;
+}
+
+static int get_student_v2(sdb_t *db, int id, student_t *s)
+{
+    uint8_t buf[V2_RECORD_MAX];
+    dir_entry_t entry;
+
+    if ((uint32_t)id >= db->hdr.dir_slots)
+        return SRCH_NOT_FOUND;
+
+    ssize_t n = io_pread(db->fd, &entry, sizeof(entry), dir_offset(id));
+    if (n == -1)
+        return ERR_DB_FILE;
+    if (n != sizeof(entry) || entry.off == 0)
+        return SRCH_NOT_FOUND;
+
+    if (entry.len > V2_RECORD_MAX ||
+        io_pread(db->fd, buf, entry.len, entry.off) != (ssize_t)entry.len)
+        return ERR_DB_FILE;
+    return decode_v2(buf, entry.len, s);
+}
+
+//logs changed ids in whichever secondary indexes the database has
+static int note_ids(sdb_t *db, const uint32_t *ids, int n)
+{
+    if (tri_note(db, ids, n) != NO_ERROR)
+        return ERR_DB_FILE;
+    return gpa_note(db, ids, n);
+}
+
+//appends a student to the version 2 heap and points its directory entry at it
+static int put_student_v2(sdb_t *db, int id, const char *fname, const char *lname,
+                          int gpa, bool sync_header)
+{
+    uint8_t buf[V2_RECORD_MAX];
+    dir_entry_t entry;
+
+    entry.len = encode_v2(buf, id, fname, lname, gpa);
+    if (db->hdr.heap_end + entry.len > UINT32_MAX)
+        return ERR_DB_FILE;
+    entry.off = db->hdr.heap_end;
+
+    if (io_pwrite(db->fd, buf, entry.len, entry.off) != (ssize_t)entry.len)
+        return ERR_DB_FILE;
+    if (io_pwrite(db->fd, &entry, sizeof(entry), dir_offset(id)) != sizeof(entry))
+        return ERR_DB_FILE;
+    if (put_crc(db, id, crc_stamp(buf, entry.len)) != NO_ERROR ||
+        note_ids(db, (uint32_t *)&id, 1) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    db->hdr.heap_end += entry.len;
+    db->hdr.count++;
+    return sync_header ? write_db_header(db) : NO_ERROR;
+}
+
+//clears the directory entry of a student, its heap bytes become dead
+static int del_student_v2(sdb_t *db, int id, bool sync_header)
+{
+    dir_entry_t entry;
+
+    if (io_pread(db->fd, &entry, sizeof(entry), dir_offset(id)) != sizeof(entry))
+        return ERR_DB_FILE;
+
+    db->hdr.dead_bytes += entry.len;
+    db->hdr.count--;
+
+    memset(&entry, 0, sizeof(entry));
+    if (io_pwrite(db->fd, &entry, sizeof(entry), dir_offset(id)) != sizeof(entry))
+        return ERR_DB_FILE;
+    if (put_crc(db, id, 0) != NO_ERROR || note_ids(db, (uint32_t *)&id, 1) != NO_ERROR)
+        return ERR_DB_FILE;
+    return sync_header ? write_db_header(db) : NO_ERROR;
+}
+
+//overwrites a version 1 slot with EMPTY_STUDENT_RECORD
+static int clear_student_v1(sdb_t *db, int id)
+{
+    if (io_pwrite(db->fd, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE, slot_offset(id)) !=
+        STUDENT_RECORD_SIZE)
+        return ERR_DB_FILE;
+    if (note_ids(db, (uint32_t *)&id, 1) != NO_ERROR)
+        return ERR_DB_FILE;
+    return put_crc(db, id, 0);
+}
+
+int store_student(sdb_t *db, const student_t *s, bool sync_header)
+{
+    if (db->version == DB_VERSION_2)
+        return put_student_v2(db, s->id, s->fname, s->lname, s->gpa, sync_header);
+
+    if (io_pwrite(db->fd, s, STUDENT_RECORD_SIZE, slot_offset(s->id)) != STUDENT_RECORD_SIZE ||
+        note_ids(db, (const uint32_t *)&s->id, 1) != NO_ERROR)
+        return ERR_DB_FILE;
+    return put_crc(db, s->id, crc_stamp(s, STUDENT_RECORD_SIZE));
+}
+
+db_scan_t *scan_open(sdb_t *db)
+{
+    db_scan_t *sc = malloc(sizeof(db_scan_t));
+    if (!sc)
+        return NULL;
+
+    sc->db = db;
+    sc->n = 0;
+    sc->next = 0;
+    sc->pos = 0;
+    sc->dir_pos = 0;
+    sc->win_off = 0;
+    sc->win_len = 0;
+    sc->raw = NULL;
+    sc->raw_len = 0;
+    sc->io_fd = -1;
+    sc->meta = (scan_win_t){0};
+    sc->heap = (scan_win_t){0};
+
+    //ids that were never written are holes, at least in a range shard or
+    //the directory of a version 2 database
+    struct stat st;
+    sc->size = 0;
+    sc->hit = false;
+    if (io_fstat(db->fd, &st) == 0 && (off_t)st.st_blocks * 512 < st.st_size)
+        sc->size = st.st_size;
+
+    if (!db->direct)
+        return sc;
+
+    //the heap window is only needed for version 2
+    if (posix_memalign((void **)&sc->meta.buf, DIRECT_ALIGN, DIRECT_BUF) != 0 ||
+        (db->version == DB_VERSION_2 &&
+         posix_memalign((void **)&sc->heap.buf, DIRECT_ALIGN, DIRECT_BUF) != 0)) {
+        scan_close(sc);
+        return NULL;
+    }
+    sc->io_fd = io_open(db->path, O_RDONLY | O_DIRECT, 0);
+    if (sc->io_fd == -1)
+        sc->io_fd = db->fd;
+    return sc;
+}
+
+//moves a scan of a sparse file from off to the next data, returns the new
+//offset or -1 when only holes follow
+static off_t skip_hole(db_scan_t *sc, off_t off)
+{
+    off_t data = io_lseek(sc->db->fd, off, SEEK_DATA);
+
+    if (data == -1 && errno != ENXIO)
+        return off;
+    IO_STAT_ADD(holes_skipped, (data == -1 ? sc->size : data) - off);
+    return data;
+}
+
+//a buffered fallback scan drops what it read, as O_DIRECT never cached it
+static void drop_window(db_scan_t *sc, scan_win_t *w)
+{
+    if (sc->io_fd == sc->db->fd && w->len)
+        io_fadvise(sc->io_fd, w->off, w->len, POSIX_FADV_DONTNEED);
+}
+
+void scan_close(db_scan_t *sc)
+{
+    if (sc->io_fd != -1) {
+        drop_window(sc, &sc->meta);
+        drop_window(sc, &sc->heap);
+        if (sc->io_fd != sc->db->fd)
+            io_close(sc->io_fd);
+    }
+    free(sc->meta.buf);
+    free(sc->heap.buf);
+    free(sc);
+}
+
+//moves a direct scan window to the aligned block holding off
+static int fill_window(db_scan_t *sc, scan_win_t *w, off_t off)
+{
+    off_t start = off & ~(off_t)(DIRECT_ALIGN - 1);
+
+    drop_window(sc, w);
+    ssize_t n = io_pread(sc->io_fd, w->buf, DIRECT_BUF, start);
+    //some filesystems accept O_DIRECT when opening but not when reading
+    if (n == -1 && errno == EINVAL && sc->io_fd != sc->db->fd) {
+        io_close(sc->io_fd);
+        sc->io_fd = sc->db->fd;
+        n = io_pread(sc->io_fd, w->buf, DIRECT_BUF, start);
+    }
+    if (n == -1)
+        return ERR_DB_FILE;
+    w->off = start;
+    w->len = n;
+    return NO_ERROR;
+}
+
+//pread() of the slots or directory, through the meta window when direct
+static ssize_t scan_read(db_scan_t *sc, void *dst, size_t len, off_t off)
+{
+    scan_win_t *w = &sc->meta;
+
+    if (sc->io_fd == -1)
+        return io_pread(sc->db->fd, dst, len, off);
+
+    if (off < w->off || off + (off_t)len > w->off + (off_t)w->len) {
+        if (fill_window(sc, w, off) != NO_ERROR)
+            return -1;
+    }
+    size_t avail = w->off + (off_t)w->len > off ? w->off + w->len - off : 0;
+    if (len > avail)
+        len = avail;
+    memcpy(dst, w->buf + (off - w->off), len);
+    return len;
+}
+
+//points sc->raw at the encoded version 2 record at off
+static int scan_heap(db_scan_t *sc, uint64_t off, uint32_t len)
+{
+    const uint8_t *base;
+    off_t base_off;
+    size_t avail;
+
+    if (sc->io_fd == -1) {
+        //refill the heap window unless the record is already inside it
+        if ((off_t)off < sc->win_off || off + len > sc->win_off + sc->win_len) {
+            ssize_t n = io_pread(sc->db->fd, sc->win, SCAN_WINDOW, off);
+            if (n < (ssize_t)len)
+                return ERR_DB_FILE;
+            sc->win_off = off;
+            sc->win_len = n;
+        }
+        base = sc->win;
+        base_off = sc->win_off;
+        avail = sc->win_len;
+    } else {
+        scan_win_t *w = &sc->heap;
+        if ((off_t)off < w->off || off + len > w->off + w->len) {
+            if (fill_window(sc, w, off) != NO_ERROR)
+                return ERR_DB_FILE;
+        }
+        base = w->buf;
+        base_off = w->off;
+        avail = w->len;
+    }
+
+    if (off + len > base_off + avail)
+        return ERR_DB_FILE;
+    sc->raw = base + (off - base_off);
+    sc->raw_len = len;
+    return NO_ERROR;
+}
+
+static int scan_next_v2(db_scan_t *sc, student_t *s)
+{
+    sdb_t *db = sc->db;
+
+    while (1) {
+        while (sc->next < sc->n) {
+            dir_entry_t *e = &sc->dir[sc->next++];
+            if (e->off == 0)
+                continue;
+            if (e->len > V2_RECORD_MAX || scan_heap(sc, e->off, e->len) != NO_ERROR ||
+                decode_v2(sc->raw, sc->raw_len, s) != NO_ERROR)
+                return ERR_DB_FILE;
+            sc->hit = true;
+            IO_STAT_ADD(records_live, 1);
+            return 1;
+        }
+
+        if (sc->size && !sc->hit && sc->dir_pos < db->hdr.dir_slots) {
+            off_t from = dir_offset(sc->dir_pos);
+            off_t data = skip_hole(sc, from);
+            //the heap follows the directory, so there is always data
+            if (data > from)
+                sc->dir_pos = data >= dir_offset(db->hdr.dir_slots) ? db->hdr.dir_slots :
+                              (data - dir_offset(0)) / sizeof(dir_entry_t);
+        }
+        if (sc->dir_pos >= db->hdr.dir_slots)
+            return 0;
+
+        uint32_t cnt = db->hdr.dir_slots - sc->dir_pos;
+        if (cnt > SCAN_BATCH)
+            cnt = SCAN_BATCH;
+        ssize_t bytes = cnt * sizeof(dir_entry_t);
+        if (scan_read(sc, sc->dir, bytes, dir_offset(sc->dir_pos)) != bytes)
+            return ERR_DB_FILE;
+
+        IO_STAT_ADD(records_scanned, cnt);
+        sc->dir_pos += cnt;
+        sc->n = cnt;
+        sc->next = 0;
+        sc->hit = false;
+    }
+}
+
+//returns 1 and fills *s with the next live student, 0 at EOF or ERR_DB_FILE
+int scan_next(db_scan_t *sc, student_t *s)
+{
+    if (sc->db->version == DB_VERSION_2)
+        return scan_next_v2(sc, s);
+
+    while (1) {
+        while (sc->next < sc->n) {
+            student_t *rec = &sc->recs[sc->next++];
+            if (memcmp(rec, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0) {
+                *s = *rec;
+                sc->hit = true;
+                IO_STAT_ADD(records_live, 1);
+                return 1;
+            }
+        }
+
+        if (sc->size && !sc->hit) {
+            sc->pos = skip_hole(sc, sc->pos);
+            if (sc->pos == -1)
+                return 0;
+            sc->pos -= sc->pos % STUDENT_RECORD_SIZE;
+        }
+        ssize_t bytes_read = scan_read(sc, sc->recs, sizeof(sc->recs), sc->pos);
+        if (bytes_read == -1)
+            return ERR_DB_FILE;
+        if (bytes_read == 0)
+            return 0;
+        if (bytes_read % STUDENT_RECORD_SIZE != 0)
+            return ERR_DB_FILE;
+
+        sc->pos += bytes_read;
+        sc->n = bytes_read / STUDENT_RECORD_SIZE;
+        sc->next = 0;
+        sc->hit = false;
+        IO_STAT_ADD(records_scanned, sc->n);
+    }
+}
+
+/*
+ *  build_db_v2
+ *      src:     database to copy from, either version
+ *      dst_fd:  empty file that receives the version 2 database
+ *
+ *  Streams every live student of src into a freshly laid out version 2
+ *  database with a packed heap.  The heap is reserved up front from the
+ *  size of the source, see rebuild_bound(), records are appended through
+ *  one write buffer flushed in whole pages, and directory entries are
+ *  written a batch at a time, so memory use is constant.  Version 2
+ *  sources are copied in their encoded form so long names survive.
+ *
+ *  returns:  <number>       the number of students copied
+ *            ERR_DB_FILE    database file I/O issue
+ */
+static int build_db_v2(sdb_t *src, int dst_fd)
+{
+    db_header_t hdr;
+    student_t student;
+    uint8_t rec[V2_RECORD_MAX];
+    uint32_t dir_base = 0;
+    bool dir_dirty = false;
+    size_t buf_len = 0;
+    int more;
+    int rc = ERR_DB_FILE;
+
+    init_header_v2(&hdr);
+
+    db_scan_t *sc = scan_open(src);
+    uint8_t *buf = malloc(SCAN_WINDOW);
+    dir_entry_t *dir = calloc(SCAN_BATCH, sizeof(dir_entry_t));
+    if (!sc || !buf || !dir)
+        goto done;
+    off_t bound = rebuild_bound(src);
+    prealloc(dst_fd, hdr.heap_off, bound);
+
+    while ((more = scan_next(sc, &student)) == 1) {
+        const uint8_t *data = rec;
+        uint32_t len;
+        uint32_t id = student.id;
+
+        if (id < MIN_STD_ID || id >= hdr.dir_slots)
+            goto done;
+
+        if (src->version == DB_VERSION_2) {
+            data = sc->raw;
+            len = sc->raw_len;
+        } else {
+            len = encode_v2(rec, student.id, student.fname, student.lname, student.gpa);
+        }
+
+        //flush the directory batch once the ids move past it
+        if (id >= dir_base + SCAN_BATCH) {
+            if (dir_dirty && io_pwrite(dst_fd, dir, SCAN_BATCH * sizeof(dir_entry_t),
+                                    dir_offset(dir_base)) == -1)
+                goto done;
+            memset(dir, 0, SCAN_BATCH * sizeof(dir_entry_t));
+            dir_base = id - id % SCAN_BATCH;
+            dir_dirty = false;
+        }
+
+        //write up to the last page boundary, the rest starts the next write
+        if (buf_len + len > SCAN_WINDOW) {
+            size_t keep = hdr.heap_end % WRITE_ALIGN;
+            size_t out = buf_len - keep;
+            if (io_pwrite(dst_fd, buf, out, hdr.heap_end - buf_len) != (ssize_t)out)
+                goto done;
+            memmove(buf, buf + out, keep);
+            buf_len = keep;
+        }
+        if (hdr.heap_end + len > UINT32_MAX)
+            goto done;
+
+        memcpy(buf + buf_len, data, len);
+        buf_len += len;
+        dir[id - dir_base].off = hdr.heap_end;
+        dir[id - dir_base].len = len;
+        dir_dirty = true;
+        hdr.heap_end += len;
+        hdr.count++;
+    }
+    if (more < 0)
+        goto done;
+
+    if (buf_len && io_pwrite(dst_fd, buf, buf_len, hdr.heap_end - buf_len) != (ssize_t)buf_len)
+        goto done;
+    unreserve(dst_fd, hdr.heap_end, hdr.heap_off + bound);
+    if (dir_dirty) {
+        uint32_t cnt = hdr.dir_slots - dir_base;
+        if (cnt > SCAN_BATCH)
+            cnt = SCAN_BATCH;
+        if (io_pwrite(dst_fd, dir, cnt * sizeof(dir_entry_t), dir_offset(dir_base)) == -1)
+            goto done;
+    }
+
+    //size the file to cover the whole directory even if the tail is a hole
+    if (io_ftruncate(dst_fd, hdr.heap_end) == -1)
+        goto done;
+    if (io_pwrite(dst_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+        goto done;
+
+    rc = hdr.count;
+
+done:
+    if (sc)
+        scan_close(sc);
+    free(buf);
+    free(dir);
+    return rc;
+}
+
+#define SLOTS_PER_BUF   (WRITE_BUF / STUDENT_RECORD_SIZE)
+
+//writes slots base..base+n-1 of a rebuild
+static int flush_slots(int fd, const student_t *buf, int base, int n)
+{
+    ssize_t bytes = (ssize_t)n * STUDENT_RECORD_SIZE;
+
+    if (n == 0)
+        return NO_ERROR;
+    return io_pwrite(fd, buf, bytes, slot_offset(base)) == bytes ? NO_ERROR : ERR_DB_FILE;
+}
+
+/*
+ *  build_db_v1
+ *      src:     database to copy from
+ *      dst_fd:  empty file that receives the version 1 database
+ *
+ *  Copies the live slots of src a WRITE_BUF aligned block at a time.  Each
+ *  block is written up to its last live slot, so the file ends where the
+ *  last student does and runs of free ids between blocks stay holes.  A
+ *  mostly dense source has the whole copy reserved up front and the part
+ *  past the last student given back at the end.
+ *
+ *  returns:  <number>       the number of students copied
+ *            ERR_DB_FILE    database file I/O issue
+ */
+static int build_db_v1(sdb_t *src, int dst_fd)
+{
+    student_t student;
+    int base = 0, n = 0;
+    int count = 0;
+    int more;
+
+    db_scan_t *sc = scan_open(src);
+    student_t *buf = malloc(WRITE_BUF);
+    if (!sc || !buf) {
+        if (sc)
+            scan_close(sc);
+        free(buf);
+        return ERR_DB_FILE;
+    }
+    off_t bound = rebuild_bound(src);
+    prealloc(dst_fd, 0, bound);
+
+    while ((more = scan_next(sc, &student)) == 1) {
+        if (student.id >= base + SLOTS_PER_BUF) {
+            if (flush_slots(dst_fd, buf, base, n) != NO_ERROR) {
+                more = ERR_DB_FILE;
+                break;
+            }
+            base = student.id - student.id % SLOTS_PER_BUF;
+            n = 0;
+        }
+        int k = student.id - base;
+        memset(&buf[n], 0, (k - n) * sizeof(student_t));
+        buf[k] = student;
+        n = k + 1;
+        count++;
+    }
+    if (more == 0 && flush_slots(dst_fd, buf, base, n) != NO_ERROR)
+        more = ERR_DB_FILE;
+    unreserve(dst_fd, slot_offset(base + n), bound);
+
+    scan_close(sc);
+    free(buf);
+    return more < 0 ? ERR_DB_FILE : count;
+}
+
+/*
+ *  build_crc_file
+ *      src:     database to checksum, either version
+ *      crc_fd:  checksum file to fill, it is reset first
+ *
+ *  Computes the checksum stamp of every live student in one scan and
+ *  writes them out a batch of ids at a time.  Used to create the checksum
+ *  file of an existing database and after a database is rebuilt.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+static int build_crc_file(sdb_t *src, int crc_fd)
+{
+    uint32_t stamps[SCAN_BATCH] = {0};
+    uint32_t base = 0;
+    bool dirty = false;
+    student_t student;
+    int more;
+
+    if (reset_crc_file(crc_fd) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    db_scan_t *sc = scan_open(src);
+    if (!sc)
+        return ERR_DB_FILE;
+
+    while ((more = scan_next(sc, &student)) == 1) {
+        uint32_t id = student.id;
+
+        if (id >= base + SCAN_BATCH) {
+            if (dirty && io_pwrite(crc_fd, stamps, sizeof(stamps), crc_offset(base)) == -1) {
+                more = ERR_DB_FILE;
+                break;
+            }
+            memset(stamps, 0, sizeof(stamps));
+            base = id - id % SCAN_BATCH;
+            dirty = false;
+        }
+
+        if (src->version == DB_VERSION_2)
+            stamps[id - base] = crc_stamp(sc->raw, sc->raw_len);
+        else
+            stamps[id - base] = crc_stamp(&student, STUDENT_RECORD_SIZE);
+        dirty = true;
+    }
+    scan_close(sc);
+
+    if (more == 0 && dirty && io_pwrite(crc_fd, stamps, sizeof(stamps), crc_offset(base)) == -1)
+        more = ERR_DB_FILE;
+    return more < 0 ? ERR_DB_FILE : NO_ERROR;
+}
+
+//opens the checksum file of db, building it if it is missing or not valid
+static int open_crc_file(sdb_t *db, bool should_truncate)
+{
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    char magic[4];
+
+    db->crc_fd = io_open(db->crc_path, O_RDWR | O_CREAT, mode);
+    if (db->crc_fd == -1)
+        return ERR_DB_FILE;
+
+    //a new or emptied database can not have any checksums yet
+    if (should_truncate || io_lseek(db->fd, 0, SEEK_END) == 0)
+        return reset_crc_file(db->crc_fd);
+    if (io_pread(db->crc_fd, magic, 4, 0) == 4 && memcmp(magic, CRC_MAGIC, 4) == 0)
+        return NO_ERROR;
+    return build_crc_file(db, db->crc_fd);
+}
+
+/*
+ *  rebuild_db
+ *      db:     database handle
+ *      as_v2:  write the rebuilt database in the version 2 format
+ *
+ *  Copies the live students into db->tmp_path, checksums the copy,
+ *  renames both over the database and checksum files and re-opens the
+ *  handle on the result.  This is how both compression and migration
+ *  reclaim space.
+ *
+ *  returns:  <number>       the number of students in the rebuilt database
+ *            ERR_DB_FILE    database file I/O issue
+ */
+static int rebuild_db(sdb_t *db, bool as_v2)
+{
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    sdb_t tmp = { .fd = -1, .crc_fd = -1, .tri_fd = -1, .gpa_fd = -1 };
+    int count = ERR_DB_FILE;
+
+    char *tmp_crc_path = malloc(strlen(db->tmp_path) + sizeof(CRC_FILE_SUFFIX));
+    if (!tmp_crc_path)
+        return ERR_DB_FILE;
+    sprintf(tmp_crc_path, "%s%s", db->tmp_path, CRC_FILE_SUFFIX);
+
+    tmp.fd = io_open(db->tmp_path, O_RDWR | O_CREAT | O_TRUNC, mode);
+    tmp.crc_fd = io_open(tmp_crc_path, O_RDWR | O_CREAT | O_TRUNC, mode);
+    if (tmp.fd == -1 || tmp.crc_fd == -1)
+        goto fail;
+
+    count = as_v2 ? build_db_v2(db, tmp.fd) : build_db_v1(db, tmp.fd);
+    if (count < 0 || load_db_version(&tmp) < 0 || build_crc_file(&tmp, tmp.crc_fd) != NO_ERROR) {
+        count = ERR_DB_FILE;
+        goto fail;
+    }
+    //a direct rebuild leaves the new file on disk instead of in the cache
+    if (db->direct && (io_fdatasync(tmp.fd) == -1 ||
+                       io_fadvise(tmp.fd, 0, 0, POSIX_FADV_DONTNEED) != 0)) {
+        count = ERR_DB_FILE;
+        goto fail;
+    }
+    if (io_rename(tmp_crc_path, db->crc_path) != 0 || io_rename(db->tmp_path, db->path) != 0) {
+        count = ERR_DB_FILE;
+        goto fail;
+    }
+
+    io_close(db->fd);
+    io_close(db->crc_fd);
+    db->fd = tmp.fd;
+    db->crc_fd = tmp.crc_fd;
+    db->reserved = 0;
+    db->version = tmp.version;
+    db->hdr = tmp.hdr;
+    free(tmp_crc_path);
+    return count;
+
+fail:
+    if (tmp.fd != -1)
+        io_close(tmp.fd);
+    if (tmp.crc_fd != -1)
+        io_close(tmp.crc_fd);
+    io_unlink(db->tmp_path);
+    io_unlink(tmp_crc_path);
+    free(tmp_crc_path);
+    return count < 0 ? count : ERR_DB_FILE;
+}
+
+/*
+ *  sdb_open
+ *      dbFile:           name of the database file
+ *      should_truncate:  indicates if opening the file also empties it
+ *      db:               receives the new handle on success
+ *
+ *  Opens (creating if needed) a database file of either version together
+ *  with its checksum file.  A database without a valid checksum file gets
+ *  one built from its current contents.  If the file is a shard manifest
+ *  every shard it lists is opened instead, see SHARD_ in db.h.
+ *
+ *  returns:  NO_ERROR       *db is a valid handle
+ *            ERR_DB_FILE    the file could not be opened or is not a
+ *                           database this library understands
+ */
+int sdb_open(const char *dbFile, bool should_truncate, sdb_t **db)
+{
+    // Set permissions: rw-rw----
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+
+    sdb_t *h = calloc(1, sizeof(sdb_t));
+    if (!h)
+        return ERR_DB_FILE;
+    h->fd = -1;
+    h->crc_fd = -1;
+    h->tri_fd = -1;
+    h->gpa_fd = -1;
+
+    // the scratch file lives next to the database as .tmp_<name>
+    const char *base = strrchr(dbFile, '/');
+    base = base ? base + 1 : dbFile;
+    h->path = strdup(dbFile);
+    h->tmp_path = malloc(strlen(dbFile) + 6);
+    h->crc_path = malloc(strlen(dbFile) + sizeof(CRC_FILE_SUFFIX));
+    h->tri_path = malloc(strlen(dbFile) + sizeof(TRI_FILE_SUFFIX));
+    h->gpa_path = malloc(strlen(dbFile) + sizeof(GPA_FILE_SUFFIX));
+    if (!h->path || !h->tmp_path || !h->crc_path || !h->tri_path || !h->gpa_path) {
+        sdb_close(h);
+        return ERR_DB_FILE;
+    }
+    sprintf(h->tmp_path, "%.*s.tmp_%s", (int)(base - dbFile), dbFile, base);
+    sprintf(h->crc_path, "%s%s", dbFile, CRC_FILE_SUFFIX);
+    sprintf(h->tri_path, "%s%s", dbFile, TRI_FILE_SUFFIX);
+    sprintf(h->gpa_path, "%s%s", dbFile, GPA_FILE_SUFFIX);
+
+    // truncating waits until we know the file is not a shard manifest
+    h->fd = io_open(dbFile, O_RDWR | O_CREAT, mode);
+    int sharded = h->fd == -1 ? ERR_DB_FILE : shard_open(h, should_truncate);
+    if (sharded == 1) {
+        *db = h;
+        return NO_ERROR;
+    }
+    if (sharded < 0 || (should_truncate && io_ftruncate(h->fd, 0) == -1) ||
+        load_db_version(h) < 0 || open_crc_file(h, should_truncate) != NO_ERROR) {
+        sdb_close(h);
+        return ERR_DB_FILE;
+    }
+
+    // the indexes are optional, they only exist once built
+    h->tri_fd = io_open(h->tri_path, O_RDWR | O_APPEND, 0);
+    h->gpa_fd = io_open(h->gpa_path, O_RDWR | O_APPEND, 0);
+    if (should_truncate && (tri_reset(h) != NO_ERROR || gpa_reset(h) != NO_ERROR)) {
+        sdb_close(h);
+        return ERR_DB_FILE;
+    }
+
+    *db = h;
+    return NO_ERROR;
+}
+
+/*
+ *  sdb_close
+ *      db:  database handle, may be NULL
+ *
+ *  Closes the database file, or every shard, and frees the handle.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE if close() failed
+ */
+int sdb_close(sdb_t *db)
+{
+    int rc = NO_ERROR;
+
+    if (!db)
+        return NO_ERROR;
+    shard_close(db);
+    if (db->fd != -1 && io_close(db->fd) == -1)
+        rc = ERR_DB_FILE;
+    if (db->crc_fd != -1 && io_close(db->crc_fd) == -1)
+        rc = ERR_DB_FILE;
+    if (db->tri_fd != -1 && io_close(db->tri_fd) == -1)
+        rc = ERR_DB_FILE;
+    if (db->gpa_fd != -1 && io_close(db->gpa_fd) == -1)
+        rc = ERR_DB_FILE;
+    free(db->path);
+    free(db->tmp_path);
+    free(db->crc_path);
+    free(db->tri_path);
+    free(db->gpa_path);
+    free(db);
+    return rc;
+}
+
+//returns DB_VERSION_1 or DB_VERSION_2
+int sdb_version(sdb_t *db)
+{
+    return db->version;
+}
+
+/*
+ *  sdb_set_direct
+ *      db:      database handle
+ *      direct:  true to read around the page cache
+ *
+ *  Makes every whole database scan (print, count, sort, export, compress
+ *  and the like) read with O_DIRECT through DIRECT_BUF windows, so a scan
+ *  of a large database neither pollutes nor evicts the page cache that
+ *  other programs depend on.  Where the filesystem does not support
+ *  O_DIRECT the scans fall back to buffered reads and drop every window
+ *  from the cache once it has been used.  A compress or migrate also
+ *  flushes the rebuilt file and drops it from the cache.  Single student
+ *  operations are not affected.
+ *
+ *  returns:  NO_ERROR       scans will use O_DIRECT
+ *            ERR_DB_OP      scans will use the buffered fallback
+ */
+int sdb_set_direct(sdb_t *db, bool direct)
+{
+    int rc = NO_ERROR;
+
+    db->direct = direct;
+    for (int i = 0; i < db->nshards; i++) {
+        if (sdb_set_direct(db->shards[i], direct) != NO_ERROR)
+            rc = ERR_DB_OP;
+    }
+    if (!direct || db->nshards)
+        return rc;
+
+    int fd = io_open(db->path, O_RDONLY | O_DIRECT, 0);
+    if (fd == -1)
+        return ERR_DB_OP;
+    io_close(fd);
+    return NO_ERROR;
+}
+
+/*
+ *  sdb_get
+ *      db:  database handle
+ *      id:  the student id we are looking for
+ *      *s:  where the student is copied if found
+ *
+ *  returns:  NO_ERROR       student located and copied into *s
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_ARGS    id out of range
+ *            SRCH_NOT_FOUND student was not located in the database
+ */
+int sdb_get(sdb_t *db, int id, student_t *s)
+{
+    if (!id_in_range(id))
+        return ERR_DB_ARGS;
+    db = shard_for(db, id);
+
+    if (db->version == DB_VERSION_2)
+        return get_student_v2(db, id, s);
+
+    ssize_t bytes_read = io_pread(db->fd, s, STUDENT_RECORD_SIZE, slot_offset(id));
+    if (bytes_read == -1)
+        return ERR_DB_FILE;
+    if (bytes_read != STUDENT_RECORD_SIZE ||
+        memcmp(s, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0)
+        return SRCH_NOT_FOUND;
+    return NO_ERROR;
+}
+
+/*
+ *  sdb_add
+ *      db:     database handle
+ *      id:     student id (range is defined in db.h)
+ *      fname:  student first name
+ *      lname:  student last name
+ *      gpa:    GPA as an integer (range defined in db.h)
+ *
+ *  Version 1 databases keep the first 23 and 31 characters of the names,
+ *  version 2 databases keep up to DB_V2_NAME_MAX.
+ *
+ *  returns:  NO_ERROR       student added to database
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_ARGS    id or gpa out of range
+ *            ERR_DB_OP      student already exists
+ */
+int sdb_add(sdb_t *db, int id, const char *fname, const char *lname, int gpa)
+{
+    student_t student = {0};
+
+    if (!id_in_range(id) || !gpa_in_range(gpa) || !fname || !lname)
+        return ERR_DB_ARGS;
+    db = shard_for(db, id);
+
+    int rc = sdb_get(db, id, &student);
+    if (rc == NO_ERROR)
+        return ERR_DB_OP;
+    if (rc != SRCH_NOT_FOUND)
+        return rc;
+
+    if (db->version == DB_VERSION_2)
+        return put_student_v2(db, id, fname, lname, gpa, true);
+
+    memset(&student, 0, sizeof(student));
+    student.id = id;
+    student.gpa = gpa;
+    strncpy(student.fname, fname, sizeof(student.fname) - 1);
+    strncpy(student.lname, lname, sizeof(student.lname) - 1);
+    return store_student(db, &student, true);
+}
+
+/*
+ *  sdb_del
+ *      db:  database handle
+ *      id:  student id to be deleted
+ *
+ *  returns:  NO_ERROR       student deleted from database
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_ARGS    id out of range
+ *            SRCH_NOT_FOUND student not in database
+ */
+int sdb_del(sdb_t *db, int id)
+{
+    student_t student;
+
+    int rc = sdb_get(db, id, &student);
+    if (rc != NO_ERROR)
+        return rc;
+
+    db = shard_for(db, id);
+    if (db->version == DB_VERSION_2)
+        return del_student_v2(db, id, true);
+    return clear_student_v1(db, id);
+}
+
+/*
+ *  sdb_update
+ *      db:     database handle
+ *      id:     id of the student to change
+ *      fname:  new first name
+ *      lname:  new last name
+ *      gpa:    new GPA as an integer (range defined in db.h)
+ *
+ *  Replaces an existing student.  A version 1 slot is rewritten in place,
+ *  a version 2 record is appended to the heap and the old one becomes dead.
+ *
+ *  returns:  NO_ERROR       student updated
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_ARGS    id or gpa out of range
+ *            SRCH_NOT_FOUND student not in database
+ */
+int sdb_update(sdb_t *db, int id, const char *fname, const char *lname, int gpa)
+{
+    student_t student = {0};
+    dir_entry_t entry;
+
+    if (!id_in_range(id) || !gpa_in_range(gpa) || !fname || !lname)
+        return ERR_DB_ARGS;
+    db = shard_for(db, id);
+
+    int rc = sdb_get(db, id, &student);
+    if (rc != NO_ERROR)
+        return rc;
+
+    if (db->version == DB_VERSION_2) {
+        if (io_pread(db->fd, &entry, sizeof(entry), dir_offset(id)) != sizeof(entry))
+            return ERR_DB_FILE;
+        //the header only counts the old record dead once the new one is in
+        rc = put_student_v2(db, id, fname, lname, gpa, false);
+        if (rc != NO_ERROR)
+            return rc;
+        db->hdr.dead_bytes += entry.len;
+        db->hdr.count--;
+        return write_db_header(db);
+    }
+
+    memset(&student, 0, sizeof(student));
+    student.id = id;
+    student.gpa = gpa;
+    strncpy(student.fname, fname, sizeof(student.fname) - 1);
+    strncpy(student.lname, lname, sizeof(student.lname) - 1);
+    return store_student(db, &student, true);
+}
+
+/*
+ *  sdb_get_batch
+ *      db:       database handle
+ *      ids:      ids to look up
+ *      n:        number of ids
+ *      out:      receives the student for every id that was found
+ *      results:  optional, receives the sdb_get() code of every id
+ *
+ *  returns:  <number>       the number of students found
+ *            ERR_DB_FILE    database file I/O issue
+ */
+int sdb_get_batch(sdb_t *db, const int *ids, int n, student_t *out, int *results)
+{
+    int found = 0;
+
+    for (int i = 0; i < n; i++) {
+        int rc = sdb_get(db, ids[i], &out[i]);
+        if (rc == ERR_DB_FILE)
+            return rc;
+        if (rc == NO_ERROR)
+            found++;
+        else
+            memset(&out[i], 0, sizeof(student_t));
+        if (results)
+            results[i] = rc;
+    }
+    return found;
+}
+
+//grows the reservation of a version 1 database for n ids in [lo, hi] that
+//are at least half dense, sparse ones are left to allocate as they write
+void reserve_ids(sdb_t *db, int lo, int hi, int n)
+{
+    if (n == 0 || (hi - lo + 1) > 2 * n)
+        return;
+    grow_reserve(db, slot_offset(lo), slot_offset(hi + 1), slot_offset(MAX_STD_ID + 1));
+}
+
+static void prealloc_batch(sdb_t *db, const student_t *students, int n)
+{
+    int lo = MAX_STD_ID, hi = MIN_STD_ID - 1, valid = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (!id_in_range(students[i].id))
+            continue;
+        lo = students[i].id < lo ? students[i].id : lo;
+        hi = students[i].id > hi ? students[i].id : hi;
+        valid++;
+    }
+    reserve_ids(db, lo, hi, valid);
+}
+
+//a new version 2 record of a batch whose heap bytes are still buffered
+typedef struct heap_put {
+    dir_entry_t entry;
+    uint32_t stamp;
+} heap_put_t;
+
+#define HEAP_PUT_MAX    1024        //records buffered by add_batch_v2()
+
+//writes the buffered heap bytes of a batch, then the directory entries and
+//checksums that point at them
+static int flush_heap_puts(sdb_t *db, const uint8_t *heap, size_t heap_len,
+                           const heap_put_t *puts, uint32_t *ids, int n)
+{
+    if (n == 0)
+        return NO_ERROR;
+
+    off_t start = puts[0].entry.off;
+    if (io_pwrite(db->fd, heap, heap_len, start) != (ssize_t)heap_len)
+        return ERR_DB_FILE;
+    for (int k = 0; k < n; k++) {
+        if (io_pwrite(db->fd, &puts[k].entry, sizeof(dir_entry_t), dir_offset(ids[k])) !=
+                sizeof(dir_entry_t) ||
+            put_crc(db, ids[k], puts[k].stamp) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    db->hdr.count += n;
+    return note_ids(db, ids, n);
+}
+
+/*
+ *  add_batch_v2
+ *
+ *  The version 2 part of sdb_add_batch().  New records are encoded into a
+ *  WRITE_BUF heap buffer and appended with one write per buffer instead of
+ *  one per student, the header is written once at the end.  Ids still in
+ *  the buffer are not on disk yet, so an id that does not ascend flushes
+ *  it before the duplicate check.  A batch of at least SCAN_BATCH students
+ *  grows the reservation of the heap first, see grow_reserve().
+ */
+static int add_batch_v2(sdb_t *db, const student_t *students, int n, int *results)
+{
+    uint8_t *heap = malloc(WRITE_BUF);
+    heap_put_t *puts = malloc(HEAP_PUT_MAX * sizeof(heap_put_t));
+    uint32_t *ids = malloc(HEAP_PUT_MAX * sizeof(uint32_t));
+    size_t heap_len = 0;
+    off_t heap_need = 0;
+    int npending = 0;
+    int added = 0;
+    int valid = 0;
+    int rc = ERR_DB_FILE;
+
+    if (!heap || !puts || !ids)
+        goto done;
+
+    //the heap only grows at its end, a big batch reserves what it may need
+    for (int i = 0; i < n; i++) {
+        if (!id_in_range(students[i].id))
+            continue;
+        heap_need += sizeof(v2_record_t) + strnlen(students[i].fname, sizeof(students[i].fname)) +
+                     strnlen(students[i].lname, sizeof(students[i].lname));
+        valid++;
+    }
+    if (valid >= SCAN_BATCH)
+        grow_reserve(db, db->hdr.heap_end, db->hdr.heap_end + heap_need, UINT32_MAX);
+
+    for (int i = 0; i < n; i++) {
+        const student_t *s = &students[i];
+        student_t existing;
+        uint8_t rec[V2_RECORD_MAX];
+
+        if (!id_in_range(s->id) || !gpa_in_range(s->gpa)) {
+            if (results)
+                results[i] = ERR_DB_ARGS;
+            continue;
+        }
+
+        uint32_t len = encode_v2(rec, s->id, s->fname, s->lname, s->gpa);
+        if (npending && ((uint32_t)s->id <= ids[npending - 1] || npending == HEAP_PUT_MAX ||
+                         heap_len + len > WRITE_BUF)) {
+            if (flush_heap_puts(db, heap, heap_len, puts, ids, npending) != NO_ERROR)
+                goto done;
+            heap_len = 0;
+            npending = 0;
+        }
+
+        int grc = get_student_v2(db, s->id, &existing);
+        if (results)
+            results[i] = grc == NO_ERROR ? ERR_DB_OP : grc == SRCH_NOT_FOUND ? NO_ERROR : grc;
+        if (grc == ERR_DB_FILE)
+            goto done;
+        if (grc != SRCH_NOT_FOUND)
+            continue;
+        if (db->hdr.heap_end + len > UINT32_MAX) {
+            if (results)
+                results[i] = ERR_DB_FILE;
+            goto done;
+        }
+
+        memcpy(heap + heap_len, rec, len);
+        heap_len += len;
+        puts[npending].entry.off = db->hdr.heap_end;
+        puts[npending].entry.len = len;
+        puts[npending].stamp = crc_stamp(rec, len);
+        ids[npending++] = s->id;
+        db->hdr.heap_end += len;
+        added++;
+    }
+
+    if (flush_heap_puts(db, heap, heap_len, puts, ids, npending) == NO_ERROR &&
+        write_db_header(db) == NO_ERROR)
+        rc = added;
+
+done:
+    free(heap);
+    free(puts);
+    free(ids);
+    return rc;
+}
+
+/*
+ *  sdb_add_batch
+ *      db:        database handle
+ *      students:  students to add
+ *      n:         number of students
+ *      results:   optional, receives the sdb_add() code of every student
+ *
+ *  On a version 1 database runs of consecutive ids are read with one
+ *  pread() and every stretch of slots that was empty is written back and
+ *  stamped with one pwrite() each, so loading sorted dense ids into an
+ *  empty range costs a few syscalls per SCAN_BATCH students.  Slots that
+ *  were already taken are left alone.  A dense batch grows the
+ *  reservation of the file first, see grow_reserve().  On a version 2
+ *  database new records are appended to the heap a buffer at a time and
+ *  the header is written once for the whole batch, see add_batch_v2().  A
+ *  sharded database adds every shard's part of the batch on its own
+ *  thread.
+ *
+ *  returns:  <number>       the number of students added
+ *            ERR_DB_FILE    database file I/O issue
+ */
+int sdb_add_batch(sdb_t *db, const student_t *students, int n, int *results)
+{
+    if (db->nshards)
+        return shard_add_batch(db, students, n, results);
+    if (db->version == DB_VERSION_2)
+        return add_batch_v2(db, students, n, results);
+    prealloc_batch(db, students, n);
+    return add_batch_v1(db, students, n, results);
+}
+
+//the version 1 part of sdb_add_batch() without the reservation, it only
+//touches the slots of its own ids so batches of disjoint ids can run on
+//several threads once the file is reserved for all of them
+int add_batch_v1(sdb_t *db, const student_t *students, int n, int *results)
+{
+    student_t run[SCAN_BATCH];
+    uint32_t stamps[SCAN_BATCH];
+    uint32_t changed[SCAN_BATCH];
+    bool fresh[SCAN_BATCH];
+    int added = 0;
+    int i = 0;
+
+    while (i < n) {
+        const student_t *s = &students[i];
+
+        if (!id_in_range(s->id) || !gpa_in_range(s->gpa)) {
+            if (results)
+                results[i] = ERR_DB_ARGS;
+            i++;
+            continue;
+        }
+
+        //gather a run of valid consecutive ids starting at s, runs end on
+        //SCAN_BATCH ids so the writes of a dense load are page aligned
+        int len = 1;
+        int max_len = SCAN_BATCH - s->id % SCAN_BATCH;
+        while (i + len < n && len < max_len &&
+               students[i + len].id == s->id + len &&
+               id_in_range(students[i + len].id) && gpa_in_range(students[i + len].gpa))
+            len++;
+
+        ssize_t bytes = (ssize_t)len * STUDENT_RECORD_SIZE;
+        ssize_t got = io_pread(db->fd, run, bytes, slot_offset(s->id));
+        if (got == -1)
+            return ERR_DB_FILE;
+        memset((char *)run + got, 0, bytes - got);
+
+        int nchanged = 0;
+        for (int k = 0; k < len; k++) {
+            int rc = ERR_DB_OP;
+            fresh[k] = false;
+            if (memcmp(&run[k], &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0) {
+                memset(&run[k], 0, sizeof(student_t));
+                run[k].id = students[i + k].id;
+                run[k].gpa = students[i + k].gpa;
+                strncpy(run[k].fname, students[i + k].fname, sizeof(run[k].fname) - 1);
+                strncpy(run[k].lname, students[i + k].lname, sizeof(run[k].lname) - 1);
+                rc = NO_ERROR;
+                stamps[k] = crc_stamp(&run[k], STUDENT_RECORD_SIZE);
+                fresh[k] = true;
+                changed[nchanged++] = run[k].id;
+                added++;
+            }
+            if (results)
+                results[i + k] = rc;
+        }
+
+        //only the slots added here are written and stamped, a slot that was
+        //taken keeps its bytes and its checksum so --scrub still sees damage
+        for (int k = 0; k < len; ) {
+            if (!fresh[k]) {
+                k++;
+                continue;
+            }
+            int end = k + 1;
+            while (end < len && fresh[end])
+                end++;
+            ssize_t rec_bytes = (ssize_t)(end - k) * STUDENT_RECORD_SIZE;
+            ssize_t crc_bytes = (ssize_t)(end - k) * sizeof(uint32_t);
+            if (io_pwrite(db->fd, &run[k], rec_bytes, slot_offset(s->id + k)) != rec_bytes ||
+                io_pwrite(db->crc_fd, &stamps[k], crc_bytes, crc_offset(s->id + k)) != crc_bytes)
+                return ERR_DB_FILE;
+            k = end;
+        }
+        if (note_ids(db, changed, nchanged) != NO_ERROR)
+            return ERR_DB_FILE;
+        i += len;
+    }
+
+    return added;
+}
+
+/*
+ *  sdb_del_batch
+ *      db:       database handle
+ *      ids:      ids of the students to delete
+ *      n:        number of ids
+ *      results:  optional, receives the sdb_del() code of every id
+ *
+ *  returns:  <number>       the number of students deleted
+ *            ERR_DB_FILE    database file I/O issue
+ */
+int sdb_del_batch(sdb_t *db, const int *ids, int n, int *results)
+{
+    student_t student;
+    int deleted = 0;
+
+    for (int i = 0; i < n; i++) {
+        int rc = sdb_get(db, ids[i], &student);
+        if (rc == NO_ERROR) {
+            sdb_t *owner = shard_for(db, ids[i]);
+            if (owner->version == DB_VERSION_2)
+                rc = del_student_v2(owner, ids[i], false);
+            else
+                rc = clear_student_v1(owner, ids[i]);
+            if (rc == NO_ERROR)
+                deleted++;
+        }
+        if (results)
+            results[i] = rc;
+        if (rc == ERR_DB_FILE)
+            return rc;
+    }
+
+    if (sync_db_headers(db) != NO_ERROR)
+        return ERR_DB_FILE;
+    return deleted;
+}
+
+//releases every fully empty page of a batch of version 1 slots at off
+static void punch_empty_pages(sdb_t *db, const student_t *recs, int n, off_t off)
+{
+    int per_page = PUNCH_PAGE / STUDENT_RECORD_SIZE;
+
+    for (int p = 0; p + per_page <= n; p += per_page) {
+        bool empty = true;
+        for (int k = p; k < p + per_page && empty; k++)
+            empty = memcmp(&recs[k], &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0;
+        //the zeros are already written, so a filesystem without hole
+        //punching just keeps the blocks
+        if (empty)
+            io_fallocate(db->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      off + (off_t)p * STUDENT_RECORD_SIZE, PUNCH_PAGE);
+    }
+}
+
+//one pass over the slots, each stretch of deleted slots in a batch is
+//written back once and the slots between them are left alone, so a live
+//record keeps its bytes and its checksum
+static int delete_where_v1(sdb_t *db, sdb_scan_fn match, void *arg, bool punch)
+{
+    student_t recs[SCAN_BATCH];
+    uint32_t stamps[SCAN_BATCH] = {0};
+    uint32_t changed[SCAN_BATCH];
+    bool gone[SCAN_BATCH];
+    int deleted = 0;
+
+    for (off_t off = 0; ; off += sizeof(recs)) {
+        ssize_t got = io_pread(db->fd, recs, sizeof(recs), off);
+        if (got == -1)
+            return ERR_DB_FILE;
+        int n = got / STUDENT_RECORD_SIZE;
+        int nchanged = 0;
+
+        for (int k = 0; k < n; k++) {
+            gone[k] = false;
+            if (memcmp(&recs[k], &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0 ||
+                !match(&recs[k], arg))
+                continue;
+            changed[nchanged++] = recs[k].id;
+            memset(&recs[k], 0, STUDENT_RECORD_SIZE);
+            gone[k] = true;
+            deleted++;
+        }
+
+        if (nchanged > 0) {
+            //an empty slot is stamped 0, stamps[] is never set otherwise
+            for (int k = 0; k < n; ) {
+                if (!gone[k]) {
+                    k++;
+                    continue;
+                }
+                int end = k + 1;
+                while (end < n && gone[end])
+                    end++;
+                ssize_t bytes = (ssize_t)(end - k) * STUDENT_RECORD_SIZE;
+                ssize_t crc_bytes = (ssize_t)(end - k) * sizeof(uint32_t);
+                uint32_t slot = off / STUDENT_RECORD_SIZE + k;
+                if (io_pwrite(db->fd, &recs[k], bytes, slot_offset(slot)) != bytes ||
+                    io_pwrite(db->crc_fd, &stamps[k], crc_bytes, crc_offset(slot)) != crc_bytes)
+                    return ERR_DB_FILE;
+                k = end;
+            }
+            if (note_ids(db, changed, nchanged) != NO_ERROR)
+                return ERR_DB_FILE;
+            if (punch)
+                punch_empty_pages(db, recs, n, off);
+        }
+
+        if (got < (ssize_t)sizeof(recs))
+            return deleted;
+    }
+}
+
+typedef struct match_ids {
+    sdb_scan_fn match;
+    void *arg;
+    int *ids;
+    int n;
+    int cap;
+} match_ids_t;
+
+//sdb_scan() callback that collects the ids of matching students
+static int collect_match(const student_t *s, void *arg)
+{
+    match_ids_t *m = arg;
+
+    if (!m->match(s, m->arg))
+        return 0;
+    if (m->n == m->cap) {
+        int cap = m->cap ? m->cap * 2 : 1024;
+        int *ids = realloc(m->ids, cap * sizeof(int));
+        if (!ids)
+            return ERR_DB_FILE;
+        m->ids = ids;
+        m->cap = cap;
+    }
+    m->ids[m->n++] = s->id;
+    return 0;
+}
+
+//one scan to find the matches, then a batch of directory entries and
+//checksums is read and written back once for all the matches inside it
+static int delete_where_v2(sdb_t *db, sdb_scan_fn match, void *arg)
+{
+    match_ids_t m = { .match = match, .arg = arg };
+    dir_entry_t dir[SCAN_BATCH];
+    uint32_t stamps[SCAN_BATCH];
+    int rc = sdb_scan(db, collect_match, &m);
+
+    for (int i = 0; rc == NO_ERROR && i < m.n; ) {
+        uint32_t base = m.ids[i] - m.ids[i] % SCAN_BATCH;
+        int j = i;
+        while (j < m.n && (uint32_t)m.ids[j] < base + SCAN_BATCH)
+            j++;
+
+        //the span from the first to the last match in this batch
+        uint32_t lo = m.ids[i], cnt = m.ids[j - 1] - lo + 1;
+        ssize_t bytes = cnt * sizeof(dir_entry_t);
+        ssize_t crc_bytes = cnt * sizeof(uint32_t);
+        if (io_pread(db->fd, dir, bytes, dir_offset(lo)) != bytes ||
+            io_pread(db->crc_fd, stamps, crc_bytes, crc_offset(lo)) != crc_bytes) {
+            rc = ERR_DB_FILE;
+            break;
+        }
+        for (int k = i; k < j; k++) {
+            dir_entry_t *e = &dir[m.ids[k] - lo];
+            db->hdr.dead_bytes += e->len;
+            db->hdr.count--;
+            memset(e, 0, sizeof(*e));
+            stamps[m.ids[k] - lo] = 0;
+        }
+        if (io_pwrite(db->fd, dir, bytes, dir_offset(lo)) != bytes ||
+            io_pwrite(db->crc_fd, stamps, crc_bytes, crc_offset(lo)) != crc_bytes)
+            rc = ERR_DB_FILE;
+        i = j;
+    }
+
+    if (rc == NO_ERROR && note_ids(db, (uint32_t *)m.ids, m.n) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    if (m.n && write_db_header(db) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    free(m.ids);
+    return rc == NO_ERROR ? m.n : ERR_DB_FILE;
+}
+
+typedef struct delete_where {
+    sdb_scan_fn match;
+    void *arg;
+    bool punch;
+} delete_where_t;
+
+static int delete_where_shard(sdb_t *shard, int idx, void *arg)
+{
+    delete_where_t *w = arg;
+
+    (void)idx;
+    return sdb_delete_where(shard, w->match, w->arg, w->punch);
+}
+
+/*
+ *  sdb_delete_where
+ *      db:     database handle
+ *      match:  called with every live student, returns non-zero for the
+ *              students to delete
+ *      arg:    passed through to match
+ *      punch:  release the storage of version 1 pages that end up empty
+ *
+ *  Deletes every matching student in a single pass over the database with
+ *  one write per batch of slots or directory entries instead of one per
+ *  student.  Hole punching applies to version 1 only, compressing is the
+ *  way to give back version 2 heap space.  The shards of a sharded
+ *  database are all searched at the same time.
+ *
+ *  returns:  <number>       the number of students deleted
+ *            ERR_DB_FILE    database file I/O issue
+ */
+int sdb_delete_where(sdb_t *db, sdb_scan_fn match, void *arg, bool punch)
+{
+    if (db->nshards) {
+        delete_where_t w = { .match = match, .arg = arg, .punch = punch };
+        return shard_fan_out(db, delete_where_shard, &w, NULL);
+    }
+    if (db->version == DB_VERSION_2)
+        return delete_where_v2(db, match, arg);
+    return delete_where_v1(db, match, arg, punch);
+}
+
+static int count_shard(sdb_t *shard, int idx, void *arg)
+{
+    (void)idx;
+    (void)arg;
+    return sdb_count(shard);
+}
+
+/*
+ *  sdb_count
+ *      db:  database handle
+ *
+ *  Version 2 databases keep the count in the header, version 1 databases
+ *  are scanned, every shard of a sharded database on its own thread.
+ *
+ *  returns:  <number>       the number of students in the database
+ *            ERR_DB_FILE    database file I/O issue
+ */
+int sdb_count(sdb_t *db)
+{
+    student_t student;
+    int count = 0;
+    int more;
+
+    if (db->nshards)
+        return shard_fan_out(db, count_shard, NULL, NULL);
+    if (db->version == DB_VERSION_2)
+        return db->hdr.count;
+
+    db_scan_t *sc = scan_open(db);
+    if (!sc)
+        return ERR_DB_FILE;
+    while ((more = scan_next(sc, &student)) == 1)
+        count++;
+    scan_close(sc);
+
+    return more < 0 ? ERR_DB_FILE : count;
+}
+
+/*
+ *  sdb_scan
+ *      db:   database handle
+ *      fn:   called with every live student in id order
+ *      arg:  passed through to fn
+ *
+ *  Sharded databases are scanned one thread per shard and merged back
+ *  into id order, see shard_scan().
+ *
+ *  returns:  NO_ERROR       every student was visited
+ *            ERR_DB_FILE    database file I/O issue
+ *            <other>        the non-zero value fn returned to stop the scan
+ */
+int sdb_scan(sdb_t *db, sdb_scan_fn fn, void *arg)
+{
+    student_t student;
+    int rc = NO_ERROR;
+    int more;
+
+    if (db->nshards)
+        return shard_scan(db, fn, arg);
+
+    db_scan_t *sc = scan_open(db);
+    if (!sc)
+        return ERR_DB_FILE;
+
+    while ((more = scan_next(sc, &student)) == 1) {
+        rc = fn(&student, arg);
+        if (rc != 0)
+            break;
+    }
+    scan_close(sc);
+
+    return more < 0 ? ERR_DB_FILE : rc;
+}
+
+static int compress_shard(sdb_t *shard, int idx, void *arg)
+{
+    (void)idx;
+    (void)arg;
+    return sdb_compress(shard);
+}
+
+/*
+ *  sdb_compress
+ *      db:  database handle
+ *
+ *  Rewrites the database without deleted records, in the same version.
+ *  The handle stays valid and refers to the compressed file afterwards.
+ *  Shards are compressed side by side.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int sdb_compress(sdb_t *db)
+{
+    if (db->nshards)
+        return shard_fan_out(db, compress_shard, NULL, NULL);
+
+    int rc = rebuild_db(db, db->version == DB_VERSION_2);
+    return rc < 0 ? rc : NO_ERROR;
+}
+
+static int migrate_shard(sdb_t *shard, int idx, void *arg)
+{
+    (void)idx;
+    (void)arg;
+    return shard->version == DB_VERSION_2 ? 0 : sdb_migrate(shard);
+}
+
+/*
+ *  sdb_migrate
+ *      db:  database handle
+ *
+ *  Converts a version 1 database into the version 2 format, streaming the
+ *  slots in id order in constant memory.  Every version 1 shard of a
+ *  sharded database is converted, side by side.
+ *
+ *  returns:  <number>       the number of students converted
+ *            ERR_DB_OP      the database is already version 2
+ *            ERR_DB_FILE    database file I/O issue
+ */
+int sdb_migrate(sdb_t *db)
+{
+    if (db->nshards) {
+        bool all_v2 = true;
+        for (int i = 0; i < db->nshards; i++)
+            all_v2 &= db->shards[i]->version == DB_VERSION_2;
+        if (all_v2)
+            return ERR_DB_OP;
+        int rc = shard_fan_out(db, migrate_shard, NULL, NULL);
+        if (rc >= 0)
+            db->version = DB_VERSION_2;
+        return rc;
+    }
+    if (db->version == DB_VERSION_2)
+        return ERR_DB_OP;
+    return rebuild_db(db, true);
+}
+
+static int zero_shard(sdb_t *shard, int idx, void *arg)
+{
+    (void)idx;
+    (void)arg;
+    return sdb_zero(shard);
+}
+
+/*
+ *  sdb_zero
+ *      db:  database handle
+ *
+ *  Removes every record.  A version 2 database stays version 2 and a
+ *  sharded one keeps its shards.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int sdb_zero(sdb_t *db)
+{
+    if (db->nshards)
+        return shard_fan_out(db, zero_shard, NULL, NULL);
+    if (io_ftruncate(db->fd, 0) == -1 || reset_crc_file(db->crc_fd) != NO_ERROR)
+        return ERR_DB_FILE;
+    db->reserved = 0;
+    if (db->version == DB_VERSION_2 && format_db_v2(db) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (tri_reset(db) != NO_ERROR)
+        return ERR_DB_FILE;
+    return gpa_reset(db);
+}
@@ -0,0 +1,144 @@
+#ifndef __SDB_LIB_H__
+    #define __SDB_LIB_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "db.h" //get student record type
+
+//libsdb is the student database as a library.  All state lives behind an
+//opaque sdb_t handle and no function writes to the console, every result is
+//reported through the return codes below.  The sdbsc command line tool is a
+//thin wrapper around this API.
+typedef struct sdb sdb_t;
+
+//error codes returned by the library
+// NO_ERROR is returned if there are no errors
+// ERR_DB_FILE is returned if there is are any issues with the database file itself
+// ERR_DB_OP is returned if an operation did not work aka add or delete a student
+// SRCH_NOT_FOUND is returned if the student is not found (get_student, and del_student)
+// ERR_DB_ARGS is returned if an id, gpa or other argument is out of range
+// ERR_ARC_FILE is returned if an archive or CSV file could not be opened, read or written
+// ERR_ARC_FORMAT is returned if an archive file is corrupt
+#define NO_ERROR        0
+#define ERR_DB_FILE     -1
+#define ERR_DB_OP       -2
+#define SRCH_NOT_FOUND  -3
+#define ERR_DB_ARGS     -4
+#define ERR_ARC_FILE    -5
+#define ERR_ARC_FORMAT  -6
+
+//orders for sdb_scan_sorted(), ties are always broken by id
+#define SDB_ORDER_ID    0
+#define SDB_ORDER_LNAME 1
+#define SDB_ORDER_GPA   2
+
+//how sdb_shard() places ids, see SHARD_ in db.h
+#define SDB_SHARD_HASH  0
+#define SDB_SHARD_RANGE 1
+
+//kinds of system call counted by the I/O statistics, see sdb_stats_get()
+#define SDB_IO_OPEN         0
+#define SDB_IO_CLOSE        1
+#define SDB_IO_PREAD        2
+#define SDB_IO_PWRITE       3
+#define SDB_IO_WRITE        4
+#define SDB_IO_LSEEK        5
+#define SDB_IO_FSTAT        6
+#define SDB_IO_FTRUNCATE    7
+#define SDB_IO_FALLOCATE    8
+#define SDB_IO_FDATASYNC    9
+#define SDB_IO_FADVISE      10
+#define SDB_IO_MMAP         11
+#define SDB_IO_MUNMAP       12
+#define SDB_IO_RENAME       13
+#define SDB_IO_UNLINK       14
+#define SDB_IO_MKSTEMP      15
+#define SDB_IO_KINDS        16
+
+//process wide I/O statistics of every open database
+typedef struct sdb_stats {
+    unsigned long long calls[SDB_IO_KINDS];
+    unsigned long long bytes_read;          //by pread(), mapped files are not counted
+    unsigned long long bytes_written;
+    unsigned long long records_scanned;     //slots or directory entries a scan looked at
+    unsigned long long records_live;        //students a scan handed back
+    unsigned long long holes_skipped;       //bytes of sparse file a scan never read
+} sdb_stats_t;
+
+//one result of sdb_search()
+typedef struct sdb_match {
+    student_t student;
+    int score;                      //percent of the query trigrams the names share
+    bool substring;                 //a name contains the query as is
+} sdb_match_t;
+
+//callback for sdb_scan() and sdb_import(), return non-zero to stop early
+typedef int (*sdb_scan_fn)(const student_t *s, void *arg);
+
+//callback that is handed a student id, see sdb_scrub()
+typedef int (*sdb_id_fn)(int id, void *arg);
+
+//callback for a row that sdb_import_csv() did not import
+typedef int (*sdb_row_fn)(int line, int id, int err, void *arg);
+
+//opening and closing
+int sdb_open(const char *dbFile, bool should_truncate, sdb_t **db);
+int sdb_close(sdb_t *db);
+int sdb_version(sdb_t *db);
+int sdb_shards(sdb_t *db);
+
+//whole database scans read around the page cache, see sdb_set_direct()
+int sdb_set_direct(sdb_t *db, bool direct);
+
+//I/O statistics, off until enabled
+void sdb_stats_enable(bool enable);
+void sdb_stats_get(sdb_stats_t *stats);
+const char *sdb_io_name(int kind);
+
+//single student operations
+int sdb_get(sdb_t *db, int id, student_t *s);
+int sdb_add(sdb_t *db, int id, const char *fname, const char *lname, int gpa);
+int sdb_del(sdb_t *db, int id);
+int sdb_update(sdb_t *db, int id, const char *fname, const char *lname, int gpa);
+
+//batch operations, results[i] (optional) gets the code for item i
+int sdb_get_batch(sdb_t *db, const int *ids, int n, student_t *out, int *results);
+int sdb_add_batch(sdb_t *db, const student_t *students, int n, int *results);
+int sdb_del_batch(sdb_t *db, const int *ids, int n, int *results);
+
+//delete every student match returns non-zero for, in one pass.  On a
+//sharded database match is called from one thread per shard at a time.
+int sdb_delete_where(sdb_t *db, sdb_scan_fn match, void *arg, bool punch);
+
+//whole database operations
+int sdb_count(sdb_t *db);
+int sdb_scan(sdb_t *db, sdb_scan_fn fn, void *arg);
+int sdb_scan_sorted(sdb_t *db, int order, size_t mem_budget, sdb_scan_fn fn, void *arg);
+int sdb_compress(sdb_t *db);
+int sdb_migrate(sdb_t *db);
+int sdb_zero(sdb_t *db);
+
+//split the database into shard files and turn it into their manifest
+int sdb_shard(sdb_t *db, int mode, int nshards, const char *const *dirs, int ndirs);
+
+//verify every record against its CRC32C checksum using nthreads threads
+int sdb_scrub(sdb_t *db, int nthreads, int *checked, sdb_id_fn on_bad, void *arg);
+
+//compact archive export and import, see the ARC_ defines in db.h
+int sdb_export(sdb_t *db, const char *arcFile);
+int sdb_import(sdb_t *db, const char *arcFile, sdb_scan_fn on_dup, void *arg);
+
+//trigram name index, see TRI_ in db.h
+int sdb_index_build(sdb_t *db);
+int sdb_search(sdb_t *db, const char *query, sdb_match_t *out, int max);
+
+//GPA index for range and rank queries, see GPA_ in db.h
+int sdb_gpa_build(sdb_t *db);
+int sdb_gpa_range(sdb_t *db, int lo, int hi, sdb_scan_fn fn, void *arg);
+int sdb_gpa_rank(sdb_t *db, int id, int *rank, int *total);
+
+//parallel bulk load of "id,first_name,last_name,gpa" rows
+int sdb_import_csv(sdb_t *db, const char *csvFile, int nthreads, sdb_row_fn on_bad, void *arg);
+
+#endif
@@ -0,0 +1,473 @@
+#include <stdlib.h>
+#include <fcntl.h> //c library for system call file routines
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// database include files
+#include "db.h"
+#include "sdbint.h"
+
+/*
+ *  Helpers shared by sdb_export() and sdb_import().
+ *
+ *  arc_writer_t and arc_reader_t each own one
+ *  fixed size buffer over a region of the archive file, and arc_dict_t is
+ *  the fixed size name dictionary described in db.h.  Nothing here grows
+ *  with the number of students, so export and import run in O(1) memory.
+ */
+#define ARC_BUF_SZ      65536       //bytes buffered per archive section
+#define ARC_NAME_MAX    32          //longest name a dictionary slot can hold
+#define ARC_ADD_BATCH   1024        //students sdb_import() adds per sdb_add_batch()
+
+typedef struct arc_writer {
+    int fd;
+    off_t off;                      //archive offset of buf[0]
+    size_t len;                     //bytes pending in buf
+    uint64_t bits;                  //pending bits of the gpa column
+    int nbits;
+    uint8_t buf[ARC_BUF_SZ];
+} arc_writer_t;
+
+typedef struct arc_reader {
+    int fd;
+    off_t off;                      //next archive offset to read from
+    off_t end;                      //end of the section being read
+    size_t len;                     //valid bytes in buf
+    size_t pos;                     //next byte in buf
+    uint64_t bits;                  //unconsumed bits of the gpa column
+    int nbits;
+    uint8_t buf[ARC_BUF_SZ];
+} arc_reader_t;
+
+typedef struct arc_dict {
+    uint8_t len[ARC_DICT_SLOTS];
+    char name[ARC_DICT_SLOTS][ARC_NAME_MAX];
+} arc_dict_t;
+
+//one column pass of sdb_export()
+typedef struct arc_pass {
+    arc_writer_t *w;
+    arc_dict_t *dict;
+    int col;
+    int n;                          //students written so far
+    int prev_id;
+} arc_pass_t;
+
+static uint32_t name_hash(const char *name, int len)
+{
+    //32 bit FNV-1a
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        h ^= (uint8_t)name[i];
+        h *= 16777619u;
+    }
+    return h & (ARC_DICT_SLOTS - 1);
+}
+
+static void put_le(uint8_t *dst, uint64_t v, int nbytes)
+{
+    for (int i = 0; i < nbytes; i++)
+        dst[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint64_t get_le(const uint8_t *src, int nbytes)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < nbytes; i++)
+        v |= (uint64_t)src[i] << (8 * i);
+    return v;
+}
+
+static int arc_flush(arc_writer_t *w)
+{
+    size_t done = 0;
+    while (done < w->len) {
+        ssize_t n = io_pwrite(w->fd, w->buf + done, w->len - done, w->off + done);
+        if (n <= 0)
+            return ERR_DB_FILE;
+        done += n;
+    }
+    w->off += w->len;
+    w->len = 0;
+    return NO_ERROR;
+}
+
+static int arc_put_byte(arc_writer_t *w, uint8_t b)
+{
+    if (w->len == ARC_BUF_SZ && arc_flush(w) != NO_ERROR)
+        return ERR_DB_FILE;
+    w->buf[w->len++] = b;
+    return NO_ERROR;
+}
+
+static int arc_put_varint(arc_writer_t *w, uint64_t v)
+{
+    while (v >= 0x80) {
+        if (arc_put_byte(w, (uint8_t)(v | 0x80)) != NO_ERROR)
+            return ERR_DB_FILE;
+        v >>= 7;
+    }
+    return arc_put_byte(w, (uint8_t)v);
+}
+
+static int arc_put_bits(arc_writer_t *w, uint32_t v, int nbits)
+{
+    w->bits |= (uint64_t)v << w->nbits;
+    w->nbits += nbits;
+    while (w->nbits >= 8) {
+        if (arc_put_byte(w, (uint8_t)w->bits) != NO_ERROR)
+            return ERR_DB_FILE;
+        w->bits >>= 8;
+        w->nbits -= 8;
+    }
+    return NO_ERROR;
+}
+
+static int arc_put_name(arc_writer_t *w, arc_dict_t *d, const char *name, int field_len)
+{
+    int len = strnlen(name, field_len);
+    uint32_t slot = name_hash(name, len);
+
+    if (d->len[slot] == len && memcmp(d->name[slot], name, len) == 0)
+        return arc_put_varint(w, slot + 1);
+
+    if (arc_put_varint(w, 0) != NO_ERROR || arc_put_byte(w, (uint8_t)len) != NO_ERROR)
+        return ERR_DB_FILE;
+    for (int i = 0; i < len; i++) {
+        if (arc_put_byte(w, (uint8_t)name[i]) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+
+    d->len[slot] = len;
+    memcpy(d->name[slot], name, len);
+    return NO_ERROR;
+}
+
+static void arc_reader_init(arc_reader_t *r, int fd, off_t start, off_t end)
+{
+    r->fd = fd;
+    r->off = start;
+    r->end = end;
+    r->len = 0;
+    r->pos = 0;
+    r->bits = 0;
+    r->nbits = 0;
+}
+
+//returns 0 and stores the next byte in *b, or -1 at the end of the section
+static int arc_get_byte(arc_reader_t *r, uint8_t *b)
+{
+    if (r->pos == r->len) {
+        off_t left = r->end - r->off;
+        if (left <= 0)
+            return -1;
+        ssize_t n = io_pread(r->fd, r->buf, left < ARC_BUF_SZ ? left : ARC_BUF_SZ, r->off);
+        if (n <= 0)
+            return -1;
+        r->off += n;
+        r->len = n;
+        r->pos = 0;
+    }
+    *b = r->buf[r->pos++];
+    return 0;
+}
+
+static int arc_get_varint(arc_reader_t *r, uint64_t *v)
+{
+    uint8_t b;
+    *v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (arc_get_byte(r, &b) != 0)
+            return -1;
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return 0;
+    }
+    return -1;
+}
+
+static int arc_get_bits(arc_reader_t *r, int nbits, uint32_t *v)
+{
+    uint8_t b;
+    while (r->nbits < nbits) {
+        if (arc_get_byte(r, &b) != 0)
+            return -1;
+        r->bits |= (uint64_t)b << r->nbits;
+        r->nbits += 8;
+    }
+    *v = (uint32_t)(r->bits & ((1u << nbits) - 1));
+    r->bits >>= nbits;
+    r->nbits -= nbits;
+    return 0;
+}
+
+static int arc_get_name(arc_reader_t *r, arc_dict_t *d, char *field, int field_len)
+{
+    uint64_t token;
+    uint8_t len;
+    uint32_t slot;
+
+    if (arc_get_varint(r, &token) != 0)
+        return -1;
+
+    if (token == 0) {
+        char name[ARC_NAME_MAX];
+        if (arc_get_byte(r, &len) != 0 || len > ARC_NAME_MAX)
+            return -1;
+        for (int i = 0; i < len; i++) {
+            if (arc_get_byte(r, (uint8_t *)&name[i]) != 0)
+                return -1;
+        }
+        slot = name_hash(name, len);
+        d->len[slot] = len;
+        memcpy(d->name[slot], name, len);
+    } else if (token <= ARC_DICT_SLOTS) {
+        slot = token - 1;
+    } else {
+        return -1;
+    }
+
+    len = d->len[slot];
+    if (len > field_len - 1)
+        len = field_len - 1;
+    memset(field, 0, field_len);
+    memcpy(field, d->name[slot], len);
+    return 0;
+}
+
+//sdb_scan() callback that writes the current column of one student
+static int export_field(const student_t *s, void *arg)
+{
+    arc_pass_t *p = arg;
+    int wrc;
+
+    switch (p->col) {
+    case 0:
+        if (s->id <= p->prev_id)
+            return ERR_DB_FILE;
+        wrc = arc_put_varint(p->w, s->id - p->prev_id);
+        p->prev_id = s->id;
+        break;
+    case 1:
+        wrc = arc_put_name(p->w, p->dict, s->fname, sizeof(s->fname));
+        break;
+    case 2:
+        wrc = arc_put_name(p->w, p->dict, s->lname, sizeof(s->lname));
+        break;
+    default:
+        wrc = arc_put_bits(p->w, s->gpa & ((1u << ARC_GPA_BITS) - 1), ARC_GPA_BITS);
+        break;
+    }
+    if (wrc != NO_ERROR)
+        return ERR_ARC_FILE;
+    p->n++;
+    return 0;
+}
+
+/*
+ *  sdb_export
+ *      db:       database handle
+ *      arcFile:  name of the archive file to create (truncated if it exists)
+ *
+ *  Writes every student in the database to a compact columnar archive, see
+ *  the ARC_ defines in db.h for the layout.  Each column is produced by its
+ *  own sdb_scan() pass over the database so only one fixed size output
+ *  buffer and one name dictionary are needed.  Because the records are
+ *  visited in id order the ids come out sorted and delta encode to one or
+ *  two bytes each.  The header is written last, once the section offsets
+ *  are known.
+ *
+ *  returns:  <number>       the number of students exported
+ *            ERR_DB_FILE    error reading the database, or the database
+ *                           changed while it was being exported
+ *            ERR_ARC_FILE   error creating or writing the archive file
+ */
+int sdb_export(sdb_t *db, const char *arcFile)
+{
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    uint64_t sect_off[ARC_SECTIONS];
+    uint8_t hdr[ARC_HDR_SIZE] = {0};
+    int count = -1;
+    int rc = ERR_DB_FILE;
+
+    arc_writer_t *w = malloc(sizeof(arc_writer_t));
+    arc_dict_t *dict = malloc(sizeof(arc_dict_t));
+    int arc_fd = io_open(arcFile, O_WRONLY | O_CREAT | O_TRUNC, mode);
+
+    if (!w || !dict || arc_fd == -1) {
+        rc = ERR_ARC_FILE;
+        goto done;
+    }
+
+    memset(w, 0, sizeof(*w));
+    w->fd = arc_fd;
+    w->off = ARC_HDR_SIZE;
+
+    for (int col = 0; col < ARC_SECTIONS; col++) {
+        arc_pass_t pass = { .w = w, .dict = dict, .col = col };
+
+        sect_off[col] = w->off + w->len;
+        memset(dict, 0, sizeof(*dict));
+
+        int src = sdb_scan(db, export_field, &pass);
+        if (src != NO_ERROR) {
+            rc = src == ERR_ARC_FILE ? ERR_ARC_FILE : ERR_DB_FILE;
+            goto done;
+        }
+
+        //a changed record count means the db was modified under us
+        if (count >= 0 && pass.n != count)
+            goto done;
+        count = pass.n;
+    }
+
+    //pad out the last partial byte of the gpa column
+    if ((w->nbits > 0 && arc_put_bits(w, 0, 8 - w->nbits) != NO_ERROR) ||
+        arc_flush(w) != NO_ERROR) {
+        rc = ERR_ARC_FILE;
+        goto done;
+    }
+
+    memcpy(hdr, ARC_MAGIC, 4);
+    put_le(hdr + 4, ARC_VERSION, 4);
+    put_le(hdr + 8, count, 4);
+    for (int col = 0; col < ARC_SECTIONS; col++)
+        put_le(hdr + 16 + 8 * col, sect_off[col], 8);
+    put_le(hdr + 16 + 8 * ARC_SECTIONS, w->off, 8);
+
+    if (io_pwrite(arc_fd, hdr, ARC_HDR_SIZE, 0) != ARC_HDR_SIZE) {
+        rc = ERR_ARC_FILE;
+        goto done;
+    }
+
+    rc = count;
+
+done:
+    if (arc_fd != -1)
+        io_close(arc_fd);
+    free(w);
+    free(dict);
+    return rc;
+}
+
+/*
+ *  sdb_import
+ *      db:       database handle
+ *      arcFile:  name of an archive file created by sdb_export()
+ *      on_dup:   optional, called with every student whose id is already
+ *                in use; a non-zero return stops the import
+ *      arg:      passed through to on_dup
+ *
+ *  Loads every student in the archive into the database.  The four columns
+ *  are decoded side by side, each through its own fixed size reader, so the
+ *  archive is streamed in O(1) memory.  Students whose id is already in use
+ *  are skipped, the rest are still imported.  The archive is in id order,
+ *  so the new students are written ARC_ADD_BATCH at a time through
+ *  sdb_add_batch(), which coalesces and preallocates dense runs.
+ *
+ *  returns:  <number>       the number of students imported
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_ARC_FILE   the archive file could not be opened
+ *            ERR_ARC_FORMAT the archive is corrupt or truncated
+ */
+int sdb_import(sdb_t *db, const char *arcFile, sdb_scan_fn on_dup, void *arg)
+{
+    uint64_t sect_off[ARC_SECTIONS + 1];
+    uint8_t hdr[ARC_HDR_SIZE];
+    student_t student;
+    struct stat st;
+    int imported = 0;
+    int rc = ERR_ARC_FORMAT;
+    uint64_t id = 0;
+    int nbatch = 0;
+
+    student_t *batch = malloc(ARC_ADD_BATCH * sizeof(student_t));
+    arc_reader_t *r = malloc(ARC_SECTIONS * sizeof(arc_reader_t));
+    arc_dict_t *fdict = calloc(1, sizeof(arc_dict_t));
+    arc_dict_t *ldict = calloc(1, sizeof(arc_dict_t));
+    int arc_fd = io_open(arcFile, O_RDONLY, 0);
+
+    if (!batch || !r || !fdict || !ldict || arc_fd == -1 || io_fstat(arc_fd, &st) == -1) {
+        rc = ERR_ARC_FILE;
+        goto done;
+    }
+
+    if (io_pread(arc_fd, hdr, ARC_HDR_SIZE, 0) != ARC_HDR_SIZE ||
+        memcmp(hdr, ARC_MAGIC, 4) != 0 || get_le(hdr + 4, 4) != ARC_VERSION) {
+        goto done;
+    }
+
+    uint32_t count = get_le(hdr + 8, 4);
+    for (int col = 0; col <= ARC_SECTIONS; col++) {
+        sect_off[col] = get_le(hdr + 16 + 8 * col, 8);
+        uint64_t prev = col ? sect_off[col - 1] : ARC_HDR_SIZE;
+        if (sect_off[col] < prev || sect_off[col] > (uint64_t)st.st_size) {
+            goto done;
+        }
+    }
+    for (int col = 0; col < ARC_SECTIONS; col++)
+        arc_reader_init(&r[col], arc_fd, sect_off[col], sect_off[col + 1]);
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t delta;
+        uint32_t gpa;
+
+        memset(&student, 0, sizeof(student));
+        if (arc_get_varint(&r[0], &delta) != 0 || delta == 0 ||
+            arc_get_name(&r[1], fdict, student.fname, sizeof(student.fname)) != 0 ||
+            arc_get_name(&r[2], ldict, student.lname, sizeof(student.lname)) != 0 ||
+            arc_get_bits(&r[3], ARC_GPA_BITS, &gpa) != 0) {
+            goto done;
+        }
+
+        id += delta;
+        if (id > MAX_STD_ID || gpa > MAX_STD_GPA)
+            goto done;
+        student.id = (int)id;
+        student.gpa = (int)gpa;
+
+        student_t existing;
+        int grc = sdb_get(db, student.id, &existing);
+        if (grc == NO_ERROR) {
+            if (on_dup && on_dup(&student, arg) != 0)
+                break;
+            continue;
+        }
+        if (grc != SRCH_NOT_FOUND) {
+            rc = ERR_DB_FILE;
+            goto done;
+        }
+        batch[nbatch++] = student;
+        if (nbatch == ARC_ADD_BATCH) {
+            int added = sdb_add_batch(db, batch, nbatch, NULL);
+            if (added < 0) {
+                rc = ERR_DB_FILE;
+                goto done;
+            }
+            imported += added;
+            nbatch = 0;
+        }
+    }
+
+    rc = imported;
+
+done:
+    //students decoded before an early stop or a corrupt section still go in
+    if (nbatch > 0) {
+        int added = sdb_add_batch(db, batch, nbatch, NULL);
+        if (added < 0)
+            rc = ERR_DB_FILE;
+        else if (rc >= 0)
+            rc += added;
+    }
+    if (arc_fd != -1)
+        io_close(arc_fd);
+    free(batch);
+    free(r);
+    free(fdict);
+    free(ldict);
+    return rc;
+}
@@ -0,0 +1,611 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+
+// database include files
+#include "db.h"
+#include "sdb.h"
+
+/*
+ *  sdbbench runs a fixed set of workloads against libsdb for each id
+ *  distribution and database version, and optionally compares the library
+ *  with running one sdbsc process per operation.  Everything happens in a
+ *  scratch directory so the student.db in the current directory is never
+ *  touched.
+ *
+ *  The workload generator is seeded, so two runs with the same options do
+ *  the same operations in the same order.  Per operation latency is taken
+ *  with CLOCK_MONOTONIC, syscall and byte counts come from /proc/self/io.
+ *  After every workload the extents of the database file are counted the
+ *  way filefrag does, so scans after per op adds can be compared with
+ *  scans after a bulk load; -D makes the scans read around the page cache
+ *  where the layout actually matters.
+ *
+ *  usage:  sdbbench [-n ops] [-s seed] [-d dist] [-v version] [-D]
+ *                   [-c path/to/sdbsc] [-C cli_ops] [-j out.json]
+ */
+#define DEF_OPS         20000
+#define DEF_CLI_OPS     500
+#define DEF_SEED        283
+#define SCAN_PASSES     5
+#define CLUSTERS        16
+#define BULK_BATCH      4096    //students per sdb_add_batch() in the bulk load
+#define MAX_RESULTS     64
+
+//the id distributions the generator knows about
+#define DIST_DENSE      0       //1..n in order
+#define DIST_SPARSE     1       //n ids spread over the whole range, random order
+#define DIST_CLUSTERED  2       //CLUSTERS runs of consecutive ids at random places
+#define DIST_COUNT      3
+
+static const char *dist_names[DIST_COUNT] = { "dense", "sparse", "clustered" };
+
+//counters from /proc/self/io
+typedef struct bench_io {
+    long long rchar;            //bytes read by read-like syscalls
+    long long wchar;            //bytes written by write-like syscalls
+    long long syscr;            //read-like syscalls
+    long long syscw;            //write-like syscalls
+} bench_io_t;
+
+typedef struct bench_result {
+    char workload[24];
+    const char *dist;
+    int version;
+    long ops;
+    long items;                 //records touched, differs from ops for scans
+    double secs;
+    double p50, p99, p999;      //latency in microseconds
+    bench_io_t io;
+    long extents;               //of the database file afterwards, -1 if unknown
+} bench_result_t;
+
+typedef struct bench {
+    bench_result_t results[MAX_RESULTS];
+    int nresults;
+    double *lat;                //per op latency of the running workload
+    long cap;
+    long nlat;
+    bench_io_t io0;
+    double t0;
+    uint64_t rng;
+    bool direct;                //scans bypass the page cache
+} bench_t;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//splitmix64, small and good enough to drive a workload
+static uint64_t rng_next(bench_t *b)
+{
+    uint64_t z = (b->rng += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static int rng_below(bench_t *b, int n)
+{
+    return (int)(rng_next(b) % (uint64_t)n);
+}
+
+static void read_io(bench_io_t *io)
+{
+    char key[32];
+    long long val;
+
+    memset(io, 0, sizeof(*io));
+    FILE *f = fopen("/proc/self/io", "r");
+    if (!f)
+        return;
+    while (fscanf(f, "%31[^:]: %lld\n", key, &val) == 2) {
+        if (strcmp(key, "rchar") == 0)
+            io->rchar = val;
+        else if (strcmp(key, "wchar") == 0)
+            io->wchar = val;
+        else if (strcmp(key, "syscr") == 0)
+            io->syscr = val;
+        else if (strcmp(key, "syscw") == 0)
+            io->syscw = val;
+    }
+    fclose(f);
+}
+
+//extents of a file as filefrag counts them, -1 where FIEMAP is missing
+static long count_extents(const char *path)
+{
+    struct fiemap fm;
+    long n = -1;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    //no extent array, the kernel only counts; SYNC allocates delayed writes
+    memset(&fm, 0, sizeof(fm));
+    fm.fm_length = FIEMAP_MAX_OFFSET;
+    fm.fm_flags = FIEMAP_FLAG_SYNC;
+    if (ioctl(fd, FS_IOC_FIEMAP, &fm) == 0)
+        n = fm.fm_mapped_extents;
+    close(fd);
+    return n;
+}
+
+/*
+ *  The ids for a run.  Sparse ids are a walk with a stride that is coprime
+ *  with the id range, so they never repeat; clustered ids are CLUSTERS runs
+ *  that start on a random multiple of the run length so runs never overlap.
+ */
+static void gen_ids(bench_t *b, int dist, int n, int *ids)
+{
+    int range = MAX_STD_ID - MIN_STD_ID + 1;
+
+    if (dist == DIST_DENSE) {
+        for (int i = 0; i < n; i++)
+            ids[i] = MIN_STD_ID + i;
+    } else if (dist == DIST_SPARSE) {
+        int start = rng_below(b, range);
+        for (int i = 0; i < n; i++)
+            ids[i] = MIN_STD_ID + (int)((start + (long)i * 7919) % range);
+    } else {
+        int run = (n + CLUSTERS - 1) / CLUSTERS;
+        int slots = range / run;
+        int used[CLUSTERS];
+        for (int c = 0, i = 0; c < CLUSTERS && i < n; c++) {
+            int slot;
+            bool dup;
+            do {
+                slot = rng_below(b, slots);
+                dup = false;
+                for (int k = 0; k < c; k++)
+                    dup |= used[k] == slot;
+            } while (dup);
+            used[c] = slot;
+            for (int j = 0; j < run && i < n; j++)
+                ids[i++] = MIN_STD_ID + slot * run + j;
+        }
+    }
+}
+
+static void gen_name(bench_t *b, char *buf, size_t len)
+{
+    static const char *syl[] = { "an", "bel", "cor", "da", "el", "fin", "gar", "ho",
+                                 "is", "jo", "ka", "lem", "mor", "na", "os", "pra",
+                                 "qui", "ro", "sal", "tor", "ul", "ven", "wil", "zan" };
+    int nsyl = 1 + rng_below(b, 4);
+
+    buf[0] = '\0';
+    for (int i = 0; i < nsyl; i++)
+        strncat(buf, syl[rng_below(b, sizeof(syl) / sizeof(syl[0]))], len - strlen(buf) - 1);
+    buf[0] -= 'a' - 'A';
+}
+
+static void bench_begin(bench_t *b)
+{
+    b->nlat = 0;
+    read_io(&b->io0);
+    b->t0 = now_sec();
+}
+
+static double op_begin(void)
+{
+    return now_sec();
+}
+
+static void op_end(bench_t *b, double t)
+{
+    if (b->nlat < b->cap)
+        b->lat[b->nlat++] = (now_sec() - t) * 1e6;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, long n, double p)
+{
+    if (n == 0)
+        return 0;
+    long i = (long)(p * n);
+    return sorted[i < n ? i : n - 1];
+}
+
+static void bench_end(bench_t *b, const char *workload, const char *dist, int version, long items)
+{
+    double secs = now_sec() - b->t0;
+    bench_io_t io;
+
+    read_io(&io);
+    if (b->nresults == MAX_RESULTS)
+        return;
+
+    bench_result_t *r = &b->results[b->nresults++];
+    snprintf(r->workload, sizeof(r->workload), "%s", workload);
+    r->dist = dist;
+    r->version = version;
+    r->ops = b->nlat;
+    r->items = items;
+    r->secs = secs;
+    r->io.rchar = io.rchar - b->io0.rchar;
+    r->io.wchar = io.wchar - b->io0.wchar;
+    r->io.syscr = io.syscr - b->io0.syscr;
+    r->io.syscw = io.syscw - b->io0.syscw;
+    r->extents = count_extents(DB_FILE);
+
+    qsort(b->lat, b->nlat, sizeof(double), cmp_double);
+    r->p50 = percentile(b->lat, b->nlat, 0.50);
+    r->p99 = percentile(b->lat, b->nlat, 0.99);
+    r->p999 = percentile(b->lat, b->nlat, 0.999);
+}
+
+static int count_cb(const student_t *s, void *arg)
+{
+    (void)s;
+    (*(long *)arg)++;
+    return 0;
+}
+
+/*
+ *  One full pass for a distribution and version:
+ *      add       every generated id, in generator order
+ *      get       90% ids that exist, 10% random ids that may not
+ *      mix       50% get, 20% update, 15% del, 15% add of a random id
+ *      scan      SCAN_PASSES full scans, one op per scan
+ *      compress  every third live student deleted, then one compress
+ *      scrub     one full checksum verify
+ *      bulk      every generated id again into an empty database, through
+ *                sdb_add_batch() BULK_BATCH students at a time
+ *      bulkscan  SCAN_PASSES full scans of the bulk loaded database
+ */
+static int run_workloads(bench_t *b, int dist, int version, int n)
+{
+    const char *dname = dist_names[dist];
+    char fname[32], lname[32];
+    student_t student;
+    sdb_t *db;
+    long items;
+
+    int *ids = malloc(n * sizeof(int));
+    if (!ids || sdb_open(DB_FILE, true, &db) != NO_ERROR) {
+        free(ids);
+        return -1;
+    }
+    if (version == DB_VERSION_2)
+        sdb_migrate(db);
+    sdb_set_direct(db, b->direct);
+    gen_ids(b, dist, n, ids);
+
+    bench_begin(b);
+    for (int i = 0; i < n; i++) {
+        gen_name(b, fname, sizeof(fname));
+        gen_name(b, lname, sizeof(lname));
+        int gpa = rng_below(b, MAX_STD_GPA + 1);
+        double t = op_begin();
+        sdb_add(db, ids[i], fname, lname, gpa);
+        op_end(b, t);
+    }
+    bench_end(b, "add", dname, version, n);
+
+    bench_begin(b);
+    for (int i = 0; i < n; i++) {
+        int id = rng_below(b, 10) ? ids[rng_below(b, n)]
+                                  : MIN_STD_ID + rng_below(b, MAX_STD_ID);
+        double t = op_begin();
+        sdb_get(db, id, &student);
+        op_end(b, t);
+    }
+    bench_end(b, "get", dname, version, n);
+
+    bench_begin(b);
+    for (int i = 0; i < n; i++) {
+        int id = ids[rng_below(b, n)];
+        int op = rng_below(b, 100);
+        if (op >= 50 && op < 70) {
+            gen_name(b, lname, sizeof(lname));
+        } else if (op >= 85) {
+            gen_name(b, fname, sizeof(fname));
+            gen_name(b, lname, sizeof(lname));
+        }
+        int gpa = rng_below(b, MAX_STD_GPA + 1);
+        double t = op_begin();
+        if (op < 50)
+            sdb_get(db, id, &student);
+        else if (op < 70)
+            sdb_update(db, id, fname, lname, gpa);
+        else if (op < 85)
+            sdb_del(db, id);
+        else
+            sdb_add(db, id, fname, lname, gpa);
+        op_end(b, t);
+    }
+    bench_end(b, "mix", dname, version, n);
+
+    bench_begin(b);
+    items = 0;
+    for (int i = 0; i < SCAN_PASSES; i++) {
+        double t = op_begin();
+        sdb_scan(db, count_cb, &items);
+        op_end(b, t);
+    }
+    bench_end(b, "scan", dname, version, items);
+
+    for (int i = 0; i < n; i += 3)
+        sdb_del(db, ids[i]);
+    bench_begin(b);
+    double t = op_begin();
+    sdb_compress(db);
+    op_end(b, t);
+    bench_end(b, "compress", dname, version, sdb_count(db));
+
+    int checked = 0;
+    bench_begin(b);
+    t = op_begin();
+    sdb_scrub(db, 0, &checked, NULL, NULL);
+    op_end(b, t);
+    bench_end(b, "scrub", dname, version, checked);
+
+    sdb_close(db);
+    if (sdb_open(DB_FILE, true, &db) != NO_ERROR) {
+        free(ids);
+        return -1;
+    }
+    if (version == DB_VERSION_2)
+        sdb_migrate(db);
+    sdb_set_direct(db, b->direct);
+
+    student_t *batch = malloc(BULK_BATCH * sizeof(student_t));
+    bench_begin(b);
+    for (int i = 0; batch && i < n; i += BULK_BATCH) {
+        int cnt = n - i < BULK_BATCH ? n - i : BULK_BATCH;
+        for (int k = 0; k < cnt; k++) {
+            memset(&batch[k], 0, sizeof(student_t));
+            batch[k].id = ids[i + k];
+            gen_name(b, batch[k].fname, sizeof(batch[k].fname));
+            gen_name(b, batch[k].lname, sizeof(batch[k].lname));
+            batch[k].gpa = rng_below(b, MAX_STD_GPA + 1);
+        }
+        t = op_begin();
+        sdb_add_batch(db, batch, cnt, NULL);
+        op_end(b, t);
+    }
+    bench_end(b, "bulk", dname, version, n);
+    free(batch);
+
+    bench_begin(b);
+    items = 0;
+    for (int i = 0; i < SCAN_PASSES; i++) {
+        t = op_begin();
+        sdb_scan(db, count_cb, &items);
+        op_end(b, t);
+    }
+    bench_end(b, "bulkscan", dname, version, items);
+
+    sdb_close(db);
+    free(ids);
+    return 0;
+}
+
+//runs sdbsc with its output thrown away, returns its exit status
+static int run_cli(const char *sdbsc, char *const argv[])
+{
+    pid_t pid = fork();
+    if (pid == -1)
+        return -1;
+
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull != -1)
+            dup2(devnull, STDOUT_FILENO);
+        execv(sdbsc, argv);
+        _exit(127);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status))
+        return -1;
+    return WEXITSTATUS(status);
+}
+
+//the same adds and finds as the dense run, one sdbsc process per operation
+static void run_cli_workloads(bench_t *b, char *sdbsc, int n)
+{
+    char idbuf[16];
+
+    char *zero_argv[] = { sdbsc, "-z", NULL };
+    run_cli(sdbsc, zero_argv);
+
+    bench_begin(b);
+    for (int i = 0; i < n; i++) {
+        snprintf(idbuf, sizeof(idbuf), "%d", MIN_STD_ID + i);
+        char *add_argv[] = { sdbsc, "-a", idbuf, "bench", "student", "300", NULL };
+        double t = op_begin();
+        run_cli(sdbsc, add_argv);
+        op_end(b, t);
+    }
+    bench_end(b, "cli_add", dist_names[DIST_DENSE], DB_VERSION_1, n);
+
+    bench_begin(b);
+    for (int i = 0; i < n; i++) {
+        snprintf(idbuf, sizeof(idbuf), "%d", MIN_STD_ID + i);
+        char *find_argv[] = { sdbsc, "-f", idbuf, NULL };
+        double t = op_begin();
+        run_cli(sdbsc, find_argv);
+        op_end(b, t);
+    }
+    bench_end(b, "cli_get", dist_names[DIST_DENSE], DB_VERSION_1, n);
+}
+
+static void print_results(const bench_t *b)
+{
+    printf("%-9s %-9s %2s %8s %12s %9s %9s %9s %9s %9s %11s %11s %7s\n",
+           "workload", "dist", "v", "ops", "ops/s", "p50 us", "p99 us", "p999 us",
+           "rd calls", "wr calls", "rd bytes", "wr bytes", "extents");
+    for (int i = 0; i < b->nresults; i++) {
+        const bench_result_t *r = &b->results[i];
+        printf("%-9s %-9s %2d %8ld %12.0f %9.1f %9.1f %9.1f %9lld %9lld %11lld %11lld %7ld\n",
+               r->workload, r->dist, r->version, r->ops, r->ops / r->secs,
+               r->p50, r->p99, r->p999, r->io.syscr, r->io.syscw,
+               r->io.rchar, r->io.wchar, r->extents);
+    }
+}
+
+static int write_json(const bench_t *b, const char *path, int ops, unsigned long long seed)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return -1;
+
+    fprintf(f, "{\n  \"ops\": %d,\n  \"seed\": %llu,\n  \"results\": [\n", ops, seed);
+    for (int i = 0; i < b->nresults; i++) {
+        const bench_result_t *r = &b->results[i];
+        fprintf(f, "    {\"workload\": \"%s\", \"dist\": \"%s\", \"version\": %d, "
+                   "\"ops\": %ld, \"items\": %ld, \"secs\": %.6f, \"ops_per_sec\": %.1f, "
+                   "\"p50_us\": %.2f, \"p99_us\": %.2f, \"p999_us\": %.2f, "
+                   "\"read_syscalls\": %lld, \"write_syscalls\": %lld, "
+                   "\"bytes_read\": %lld, \"bytes_written\": %lld, \"extents\": %ld}%s\n",
+                r->workload, r->dist, r->version, r->ops, r->items, r->secs,
+                r->ops / r->secs, r->p50, r->p99, r->p999,
+                r->io.syscr, r->io.syscw, r->io.rchar, r->io.wchar, r->extents,
+                i + 1 < b->nresults ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+static void usage(const char *exe)
+{
+    printf("usage: %s [-n ops] [-s seed] [-d dense|sparse|clustered] [-v 1|2] [-D]\n"
+           "       %*s [-c path/to/sdbsc] [-C cli_ops] [-j out.json]\n",
+           exe, (int)strlen(exe), "");
+}
+
+int main(int argc, char *argv[])
+{
+    static bench_t b;
+    char sdbsc[PATH_MAX];
+    char json[PATH_MAX];
+    char dir[] = "/tmp/sdbbench.XXXXXX";
+    int ops = DEF_OPS;
+    int cli_ops = DEF_CLI_OPS;
+    int dist = -1;
+    int version = 0;
+    unsigned long long seed = DEF_SEED;
+    int opt;
+
+    sdbsc[0] = json[0] = '\0';
+    while ((opt = getopt(argc, argv, "n:s:d:v:Dc:C:j:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            ops = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'd':
+            for (dist = 0; dist < DIST_COUNT && strcmp(optarg, dist_names[dist]) != 0; dist++)
+                ;
+            if (dist == DIST_COUNT) {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        case 'v':
+            version = atoi(optarg);
+            if (version != DB_VERSION_1 && version != DB_VERSION_2) {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        case 'D':
+            b.direct = true;
+            break;
+        case 'c':
+            if (!realpath(optarg, sdbsc)) {
+                perror(optarg);
+                exit(1);
+            }
+            break;
+        case 'C':
+            cli_ops = atoi(optarg);
+            break;
+        case 'j':
+            //resolved now, the run changes directory
+            if (optarg[0] == '/')
+                snprintf(json, sizeof(json), "%s", optarg);
+            else if (getcwd(json, sizeof(json)))
+                snprintf(json + strlen(json), sizeof(json) - strlen(json), "/%s", optarg);
+            break;
+        default:
+            usage(argv[0]);
+            exit(opt == 'h' ? 0 : 1);
+        }
+    }
+    if (ops < 1 || ops > MAX_STD_ID)
+        ops = ops < 1 ? 1 : MAX_STD_ID;
+    if (cli_ops < 1 || cli_ops > MAX_STD_ID)
+        cli_ops = cli_ops < 1 ? 1 : MAX_STD_ID;
+
+    b.rng = seed;
+    b.cap = ops > cli_ops ? ops : cli_ops;
+    b.lat = malloc(b.cap * sizeof(double));
+    if (!b.lat || !mkdtemp(dir) || chdir(dir) == -1) {
+        perror("sdbbench");
+        exit(1);
+    }
+
+    for (int d = 0; d < DIST_COUNT; d++) {
+        if (dist != -1 && d != dist)
+            continue;
+        for (int v = DB_VERSION_1; v <= DB_VERSION_2; v++) {
+            if (version && v != version)
+                continue;
+            if (run_workloads(&b, d, v, ops) != 0)
+                printf("sdbbench: cant open %s/%s\n", dir, DB_FILE);
+        }
+    }
+    if (sdbsc[0])
+        run_cli_workloads(&b, sdbsc, cli_ops);
+
+    unlink(DB_FILE);
+    unlink(DB_FILE CRC_FILE_SUFFIX);
+    if (chdir("/") == 0)
+        rmdir(dir);
+
+    print_results(&b);
+    if (sdbsc[0] && b.nresults >= 2) {
+        const bench_result_t *add = NULL, *get = NULL;
+        for (int i = 0; i < b.nresults; i++) {
+            if (!add && strcmp(b.results[i].workload, "add") == 0)
+                add = &b.results[i];
+            if (!get && strcmp(b.results[i].workload, "get") == 0)
+                get = &b.results[i];
+        }
+        const bench_result_t *cli_add = &b.results[b.nresults - 2];
+        const bench_result_t *cli_get = &b.results[b.nresults - 1];
+        if (add && get)
+            printf("in process speedup:  add %.0fx  get %.0fx\n",
+                   (add->ops / add->secs) / (cli_add->ops / cli_add->secs),
+                   (get->ops / get->secs) / (cli_get->ops / cli_get->secs));
+    }
+    if (json[0] && write_json(&b, json, ops, seed) != 0) {
+        perror(json);
+        exit(1);
+    }
+    free(b.lat);
+    return 0;
+}
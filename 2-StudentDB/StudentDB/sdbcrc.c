@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#endif
+
+// database include files
+#include "db.h"
+#include "sdbint.h"
+
+/*
+ *  Record checksums
+ *
+ *  Every live student has a CRC32C of its stored bytes (the 64 byte slot
+ *  for version 1, the encoded heap record for version 2) in the checksum
+ *  file kept next to the database, see CRC_ defines in db.h.  The library
+ *  updates it on every write, and sdb_scrub() verifies the whole database
+ *  against it.
+ *
+ *  crc32c() uses the SSE4.2 crc32 instruction when the CPU has it and a
+ *  slicing-by-8 table otherwise, picked once on first use.
+ */
+#define CRC32C_POLY     0x82F63B78u     //Castagnoli, bit reflected
+
+static uint32_t crc_table[8][256];
+static uint32_t (*crc_impl)(uint32_t, const uint8_t *, size_t);
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static uint32_t crc32c_table(uint32_t crc, const uint8_t *p, size_t len)
+{
+    while (len && ((uintptr_t)p & 7)) {
+        crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        v ^= crc;
+        crc = crc_table[7][v & 0xff] ^ crc_table[6][(v >> 8) & 0xff] ^
+              crc_table[5][(v >> 16) & 0xff] ^ crc_table[4][(v >> 24) & 0xff] ^
+              crc_table[3][(v >> 32) & 0xff] ^ crc_table[2][(v >> 40) & 0xff] ^
+              crc_table[1][(v >> 48) & 0xff] ^ crc_table[0][v >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *p, size_t len)
+{
+    uint64_t c = crc;
+
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)c;
+    while (len--)
+        crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+#endif
+
+static void crc_init(void)
+{
+    for (int i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c >> 1) ^ (CRC32C_POLY & (0u - (c & 1)));
+        crc_table[0][i] = c;
+    }
+    for (int i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++)
+            crc_table[t][i] = (crc_table[t - 1][i] >> 8) ^ crc_table[0][crc_table[t - 1][i] & 0xff];
+    }
+
+    crc_impl = crc32c_table;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        crc_impl = crc32c_sse42;
+#endif
+}
+
+uint32_t crc32c(const void *buf, size_t len)
+{
+    pthread_once(&crc_once, crc_init);
+    return ~crc_impl(~0u, buf, len);
+}
+
+//the value stored in the checksum file for a record, 0 means empty slot
+uint32_t crc_stamp(const void *rec, size_t len)
+{
+    if (!rec)
+        return 0;
+    uint32_t crc = crc32c(rec, len);
+    return crc ? crc : 1;
+}
+
+/*
+ *  Scrub workers
+ *
+ *  Both files are mapped read only and the id range is cut into one
+ *  contiguous piece per thread.  Each thread recomputes the stamp of every
+ *  slot in its piece and compares it with the checksum file, so an
+ *  occupied slot with a wrong or missing checksum and an empty slot that
+ *  still has one are both reported.  Bad ids are collected per thread and
+ *  reported in id order once every thread is done.
+ */
+typedef struct scrub_job {
+    const uint8_t *data;            //mapped database
+    size_t data_len;
+    const uint32_t *crcs;           //mapped checksum entries, index = id
+    size_t ncrcs;
+    const db_header_t *hdr;         //NULL for version 1
+    uint32_t lo, hi;                //ids [lo, hi) to check
+    int checked;
+    int nbad;
+    int cap;
+    int *bad;
+    bool failed;                    //bad ids could not be recorded
+} scrub_job_t;
+
+static const uint8_t *scrub_record(scrub_job_t *job, uint32_t id, size_t *len, bool *broken)
+{
+    *broken = false;
+
+    if (!job->hdr) {
+        size_t off = (size_t)id * STUDENT_RECORD_SIZE;
+        if (off + STUDENT_RECORD_SIZE > job->data_len)
+            return NULL;
+        const uint8_t *rec = job->data + off;
+        if (memcmp(rec, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0)
+            return NULL;
+        *len = STUDENT_RECORD_SIZE;
+        return rec;
+    }
+
+    dir_entry_t e;
+    size_t doff = sizeof(db_header_t) + (size_t)id * sizeof(dir_entry_t);
+    if (id >= job->hdr->dir_slots || doff + sizeof(e) > job->data_len)
+        return NULL;
+    memcpy(&e, job->data + doff, sizeof(e));
+    if (e.off == 0)
+        return NULL;
+    if (e.off < job->hdr->heap_off || e.len > V2_RECORD_MAX ||
+        (size_t)e.off + e.len > job->data_len) {
+        *broken = true;
+        return NULL;
+    }
+    *len = e.len;
+    return job->data + e.off;
+}
+
+static void *scrub_worker(void *arg)
+{
+    scrub_job_t *job = arg;
+
+    for (uint32_t id = job->lo; id < job->hi; id++) {
+        size_t len = 0;
+        bool broken;
+        const uint8_t *rec = scrub_record(job, id, &len, &broken);
+        uint32_t stored = id < job->ncrcs ? job->crcs[id] : 0;
+
+        if (rec || broken)
+            job->checked++;
+        if (!broken && stored == crc_stamp(rec, len))
+            continue;
+
+        if (job->nbad == job->cap) {
+            int cap = job->cap ? job->cap * 2 : 64;
+            int *bad = realloc(job->bad, cap * sizeof(int));
+            if (!bad) {
+                job->failed = true;
+                break;
+            }
+            job->bad = bad;
+            job->cap = cap;
+        }
+        job->bad[job->nbad++] = id;
+    }
+    return NULL;
+}
+
+/*
+ *  sdb_scrub
+ *      db:        database handle
+ *      nthreads:  number of threads to verify with, <= 0 for one per CPU
+ *      checked:   optional, receives the number of occupied slots checked
+ *      on_bad:    optional, called in id order for every slot that failed
+ *      arg:       passed through to on_bad
+ *
+ *  returns:  <number>       the number of slots that failed verification
+ *            ERR_DB_FILE    database or checksum file I/O issue
+ */
+int sdb_scrub(sdb_t *db, int nthreads, int *checked, sdb_id_fn on_bad, void *arg)
+{
+    struct stat dst, cst;
+    void *data = MAP_FAILED;
+    void *crcs = MAP_FAILED;
+    scrub_job_t *jobs = NULL;
+    pthread_t *tids = NULL;
+    int rc = ERR_DB_FILE;
+
+    if (db->nshards)
+        return shard_scrub(db, nthreads, checked, on_bad, arg);
+    if (io_fstat(db->fd, &dst) == -1 || io_fstat(db->crc_fd, &cst) == -1)
+        return ERR_DB_FILE;
+
+    if (dst.st_size > 0) {
+        data = io_mmap(dst.st_size, PROT_READ, MAP_SHARED, db->fd);
+        if (data == MAP_FAILED)
+            goto done;
+        madvise(data, dst.st_size, MADV_SEQUENTIAL);
+    }
+    if (cst.st_size > CRC_HDR_SIZE) {
+        crcs = io_mmap(cst.st_size, PROT_READ, MAP_SHARED, db->crc_fd);
+        if (crcs == MAP_FAILED)
+            goto done;
+    }
+
+    //check every id either file has room for
+    uint32_t nids = db->version == DB_VERSION_2 ? db->hdr.dir_slots
+                                                : dst.st_size / STUDENT_RECORD_SIZE;
+    size_t ncrcs = cst.st_size > CRC_HDR_SIZE ? (cst.st_size - CRC_HDR_SIZE) / sizeof(uint32_t) : 0;
+    if (ncrcs > nids)
+        nids = ncrcs;
+
+    if (nthreads <= 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 1)
+        nthreads = 1;
+    if ((uint32_t)nthreads > nids / SCAN_BATCH + 1)
+        nthreads = nids / SCAN_BATCH + 1;
+
+    jobs = calloc(nthreads, sizeof(scrub_job_t));
+    tids = calloc(nthreads, sizeof(pthread_t));
+    if (!jobs || !tids)
+        goto done;
+
+    uint32_t per = (nids + nthreads - 1) / nthreads;
+    for (int t = 0; t < nthreads; t++) {
+        scrub_job_t *job = &jobs[t];
+        job->data = data == MAP_FAILED ? NULL : data;
+        job->data_len = data == MAP_FAILED ? 0 : dst.st_size;
+        job->crcs = crcs == MAP_FAILED ? NULL : (const uint32_t *)((uint8_t *)crcs + CRC_HDR_SIZE);
+        job->ncrcs = ncrcs;
+        job->hdr = db->version == DB_VERSION_2 ? &db->hdr : NULL;
+        job->lo = t * per < MIN_STD_ID ? MIN_STD_ID : t * per;
+        job->hi = (t + 1) * per < nids ? (t + 1) * per : nids;
+    }
+
+    int started = 0;
+    for (; started < nthreads; started++) {
+        if (pthread_create(&tids[started], NULL, scrub_worker, &jobs[started]) != 0)
+            break;
+    }
+    //run whatever could not get a thread on this one
+    for (int t = started; t < nthreads; t++)
+        scrub_worker(&jobs[t]);
+    for (int t = 0; t < started; t++)
+        pthread_join(tids[t], NULL);
+
+    for (int t = 0; t < nthreads; t++) {
+        if (jobs[t].failed)
+            goto done;
+    }
+
+    int nbad = 0;
+    int nchecked = 0;
+    for (int t = 0; t < nthreads; t++) {
+        nchecked += jobs[t].checked;
+        for (int i = 0; i < jobs[t].nbad; i++) {
+            if (on_bad)
+                on_bad(jobs[t].bad[i], arg);
+            nbad++;
+        }
+    }
+    if (checked)
+        *checked = nchecked;
+    rc = nbad;
+
+done:
+    if (jobs) {
+        for (int t = 0; t < nthreads; t++)
+            free(jobs[t].bad);
+    }
+    free(jobs);
+    free(tids);
+    if (data != MAP_FAILED)
+        io_munmap(data, dst.st_size);
+    if (crcs != MAP_FAILED)
+        io_munmap(crcs, cst.st_size);
+    return rc;
+}
@@ -0,0 +1,372 @@
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+// database include files
+#include "db.h"
+#include "sdbint.h"
+
+/*
+ *  CSV import
+ *
+ *  Rows are "id,first_name,last_name,gpa" where gpa is either the 3 digit
+ *  integer the -a option takes or a decimal like 3.45.  A first line that
+ *  does not start with a digit is taken to be a header and skipped.
+ *
+ *  The file is mapped read only and cut into chunks of about CSV_CHUNK
+ *  bytes that end on a newline.  A pool of threads takes chunks off a
+ *  shared counter and parses each into student_t rows.  Duplicate ids are
+ *  then dropped in one ordered pass so the first row in the file always
+ *  wins, and the rows are written chunk by chunk with sdb_add_batch().  On
+ *  a version 1 database the file is reserved once for every row and the
+ *  chunks are then written by the pool as well, a v1 batch only touches
+ *  the slots of its own ids and the ids of different chunks are disjoint
+ *  by then.  A version 2 database appends to a shared heap and a sharded
+ *  one already spreads each batch over a thread per shard, so their
+ *  chunks are written in order by the calling thread.
+ *
+ *  Problems are reported through on_bad in line order once everything is
+ *  written, so the report is the same however the chunks were scheduled.
+ */
+#define CSV_CHUNK       (1 << 20)   //bytes of input per chunk
+#define CSV_FIELDS      4
+
+typedef struct csv_issue {
+    int line;
+    int id;                         //0 if the row could not be parsed
+    int err;                        //ERR_DB_ARGS bad row, ERR_DB_OP duplicate
+} csv_issue_t;
+
+typedef struct csv_chunk {
+    const char *start, *end;
+    int nlines;                     //lines that start in this chunk
+    int first_line;                 //file line number of the first one
+    student_t *rows;
+    int *row_lines;                 //line of each row, chunk relative until fixed up
+    int *results;                   //sdb_add_batch() result of each row
+    int nrows;
+    csv_issue_t *issues;            //parse errors, chunk relative lines
+    int nissues;
+    int icap;
+    int rc;                         //ERR_DB_FILE if writing the chunk failed
+} csv_chunk_t;
+
+typedef struct csv_pool {
+    sdb_t *db;
+    csv_chunk_t *chunks;
+    int nchunks;
+    atomic_int next;                //next chunk nobody has taken yet
+    bool reserved;                  //the v1 file is reserved for every row
+    void (*work)(struct csv_pool *pool, csv_chunk_t *chunk);
+} csv_pool_t;
+
+static void *pool_worker(void *arg)
+{
+    csv_pool_t *pool = arg;
+    int c;
+
+    while ((c = atomic_fetch_add(&pool->next, 1)) < pool->nchunks)
+        pool->work(pool, &pool->chunks[c]);
+    return NULL;
+}
+
+//runs work on every chunk with up to nthreads threads, including this one
+static void run_pool(csv_pool_t *pool, int nthreads, void (*work)(csv_pool_t *, csv_chunk_t *))
+{
+    pthread_t tids[nthreads > 1 ? nthreads - 1 : 1];
+    int started = 0;
+
+    pool->work = work;
+    atomic_store(&pool->next, 0);
+    for (; started < nthreads - 1; started++) {
+        if (pthread_create(&tids[started], NULL, pool_worker, pool) != 0)
+            break;
+    }
+    pool_worker(pool);
+    for (int t = 0; t < started; t++)
+        pthread_join(tids[t], NULL);
+}
+
+static const char *trim(const char *p, const char *end, const char **field_end)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+        end--;
+    *field_end = end;
+    return p;
+}
+
+static bool parse_uint(const char *p, const char *end, int *val)
+{
+    if (p == end || end - p > 9)
+        return false;
+    *val = 0;
+    for (; p < end; p++) {
+        if (*p < '0' || *p > '9')
+            return false;
+        *val = *val * 10 + (*p - '0');
+    }
+    return true;
+}
+
+//gpa as 345 or 3.45, a single decimal digit counts as tenths
+static bool parse_gpa(const char *p, const char *end, int *gpa)
+{
+    const char *dot = memchr(p, '.', end - p);
+    int whole, frac = 0;
+
+    if (!dot)
+        return parse_uint(p, end, gpa);
+    if (!parse_uint(p, dot, &whole) || end - dot > 3 ||
+        (end - dot > 1 && !parse_uint(dot + 1, end, &frac)))
+        return false;
+    *gpa = whole * 100 + (end - dot == 2 ? frac * 10 : frac);
+    return true;
+}
+
+static int parse_row(const char *p, const char *end, student_t *s)
+{
+    const char *f[CSV_FIELDS], *fend[CSV_FIELDS];
+    size_t len;
+
+    for (int i = 0; i < CSV_FIELDS; i++) {
+        const char *comma = i < CSV_FIELDS - 1 ? memchr(p, ',', end - p) : end;
+        if (!comma)
+            return ERR_DB_ARGS;
+        f[i] = trim(p, comma, &fend[i]);
+        p = comma + 1;
+    }
+
+    memset(s, 0, sizeof(*s));
+    if (!parse_uint(f[0], fend[0], &s->id) || !parse_gpa(f[3], fend[3], &s->gpa) ||
+        s->id < MIN_STD_ID || s->id > MAX_STD_ID ||
+        s->gpa < MIN_STD_GPA || s->gpa > MAX_STD_GPA ||
+        f[1] == fend[1] || f[2] == fend[2])
+        return ERR_DB_ARGS;
+
+    len = fend[1] - f[1];
+    memcpy(s->fname, f[1], len < sizeof(s->fname) - 1 ? len : sizeof(s->fname) - 1);
+    len = fend[2] - f[2];
+    memcpy(s->lname, f[2], len < sizeof(s->lname) - 1 ? len : sizeof(s->lname) - 1);
+    return NO_ERROR;
+}
+
+static void add_issue(csv_chunk_t *chunk, int line, int id, int err)
+{
+    if (chunk->nissues == chunk->icap) {
+        int cap = chunk->icap ? chunk->icap * 2 : 16;
+        csv_issue_t *issues = realloc(chunk->issues, cap * sizeof(csv_issue_t));
+        if (!issues)
+            return;
+        chunk->issues = issues;
+        chunk->icap = cap;
+    }
+    chunk->issues[chunk->nissues++] = (csv_issue_t){ line, id, err };
+}
+
+static void parse_chunk(csv_pool_t *pool, csv_chunk_t *chunk)
+{
+    const char *p = chunk->start;
+    int cap = 0;
+
+    //a row is at least "1,a,b,0\n"
+    int most = (chunk->end - chunk->start) / 8 + 1;
+    chunk->rows = malloc(most * sizeof(student_t));
+    chunk->row_lines = malloc(most * sizeof(int));
+    if (chunk->rows && chunk->row_lines)
+        cap = most;
+
+    while (p < chunk->end) {
+        const char *nl = memchr(p, '\n', chunk->end - p);
+        const char *eol = nl ? nl : chunk->end;
+        const char *lend;
+        const char *l = trim(p, eol, &lend);
+        int line = ++chunk->nlines;
+
+        p = eol + 1;
+        if (l == lend)
+            continue;
+
+        //a header row
+        if (chunk->start == pool->chunks[0].start && line == 1 && (*l < '0' || *l > '9'))
+            continue;
+
+        if (chunk->nrows == cap || parse_row(l, lend, &chunk->rows[chunk->nrows]) != NO_ERROR) {
+            add_issue(chunk, line, 0, ERR_DB_ARGS);
+            continue;
+        }
+        chunk->row_lines[chunk->nrows++] = line;
+    }
+}
+
+static void write_chunk(csv_pool_t *pool, csv_chunk_t *chunk)
+{
+    if (chunk->nrows == 0)
+        return;
+    int (*add)(sdb_t *, const student_t *, int, int *) = pool->reserved ? add_batch_v1
+                                                                        : sdb_add_batch;
+    chunk->results = malloc(chunk->nrows * sizeof(int));
+    if (!chunk->results ||
+        add(pool->db, chunk->rows, chunk->nrows, chunk->results) < 0)
+        chunk->rc = ERR_DB_FILE;
+}
+
+static int cmp_issue(const void *a, const void *b)
+{
+    const csv_issue_t *x = a, *y = b;
+    return x->line - y->line;
+}
+
+/*
+ *  sdb_import_csv
+ *      db:        database handle
+ *      csvFile:   name of the CSV file to load
+ *      nthreads:  number of threads to parse with, <= 0 for one per CPU
+ *      on_bad:    optional, called in line order for every row that was
+ *                 not imported, with ERR_DB_ARGS for a row that is not a
+ *                 valid student and ERR_DB_OP for an id that already
+ *                 exists in the database or earlier in the file
+ *      arg:       passed through to on_bad
+ *
+ *  returns:  <number>       the number of students imported
+ *            ERR_ARC_FILE   the CSV file could not be opened or mapped
+ *            ERR_DB_FILE    database file I/O issue
+ */
+int sdb_import_csv(sdb_t *db, const char *csvFile, int nthreads, sdb_row_fn on_bad, void *arg)
+{
+    csv_pool_t pool = { .db = db };
+    struct stat st;
+    char *data = MAP_FAILED;
+    uint8_t *seen = NULL;
+    csv_issue_t *issues = NULL;
+    int imported = 0;
+    int rc = ERR_ARC_FILE;
+
+    int fd = io_open(csvFile, O_RDONLY, 0);
+    if (fd == -1 || io_fstat(fd, &st) == -1)
+        goto done;
+    if (st.st_size == 0) {
+        rc = 0;
+        goto done;
+    }
+    data = io_mmap(st.st_size, PROT_READ, MAP_PRIVATE, fd);
+    if (data == MAP_FAILED)
+        goto done;
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    //cut the file into chunks that end just after a newline
+    rc = ERR_DB_FILE;
+    pool.chunks = calloc(st.st_size / CSV_CHUNK + 1, sizeof(csv_chunk_t));
+    seen = calloc(MAX_STD_ID / 8 + 1, 1);
+    if (!pool.chunks || !seen)
+        goto done;
+    for (off_t off = 0; off < st.st_size; ) {
+        off_t cut = off + CSV_CHUNK < st.st_size ? off + CSV_CHUNK : st.st_size;
+        const char *nl = memchr(data + cut - 1, '\n', st.st_size - cut + 1);
+        off_t next = nl ? nl - data + 1 : st.st_size;
+        pool.chunks[pool.nchunks].start = data + off;
+        pool.chunks[pool.nchunks].end = data + next;
+        pool.nchunks++;
+        off = next;
+    }
+
+    if (nthreads <= 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 1)
+        nthreads = 1;
+    if (nthreads > pool.nchunks)
+        nthreads = pool.nchunks;
+
+    run_pool(&pool, nthreads, parse_chunk);
+
+    //line numbers, and the first row in the file wins for every id
+    int line = 1;
+    int nissues = 0;
+    int lo = MAX_STD_ID, hi = MIN_STD_ID - 1, nkept = 0;
+    for (int c = 0; c < pool.nchunks; c++) {
+        csv_chunk_t *chunk = &pool.chunks[c];
+        int kept = 0;
+
+        chunk->first_line = line;
+        line += chunk->nlines;
+        for (int i = 0; i < chunk->nissues; i++)
+            chunk->issues[i].line += chunk->first_line - 1;
+        for (int i = 0; i < chunk->nrows; i++) {
+            int id = chunk->rows[i].id;
+            int row_line = chunk->row_lines[i] + chunk->first_line - 1;
+            if (seen[id / 8] & (1 << (id % 8))) {
+                add_issue(chunk, row_line, id, ERR_DB_OP);
+                continue;
+            }
+            seen[id / 8] |= 1 << (id % 8);
+            lo = id < lo ? id : lo;
+            hi = id > hi ? id : hi;
+            nkept++;
+            chunk->rows[kept] = chunk->rows[i];
+            chunk->row_lines[kept++] = row_line;
+        }
+        chunk->nrows = kept;
+    }
+
+    if (db->nshards || db->version == DB_VERSION_2) {
+        for (int c = 0; c < pool.nchunks; c++)
+            write_chunk(&pool, &pool.chunks[c]);
+    } else {
+        //the writers would race on the reservation, so it is grown here
+        reserve_ids(db, lo, hi, nkept);
+        pool.reserved = true;
+        run_pool(&pool, nthreads, write_chunk);
+    }
+
+    for (int c = 0; c < pool.nchunks; c++) {
+        csv_chunk_t *chunk = &pool.chunks[c];
+        if (chunk->rc != NO_ERROR)
+            goto done;
+        for (int i = 0; i < chunk->nrows; i++) {
+            if (chunk->results[i] == NO_ERROR)
+                imported++;
+            else
+                add_issue(chunk, chunk->row_lines[i], chunk->rows[i].id, chunk->results[i]);
+        }
+        nissues += chunk->nissues;
+    }
+
+    //every problem in line order
+    issues = malloc((nissues ? nissues : 1) * sizeof(csv_issue_t));
+    if (!issues)
+        goto done;
+    nissues = 0;
+    for (int c = 0; c < pool.nchunks; c++) {
+        memcpy(issues + nissues, pool.chunks[c].issues,
+               pool.chunks[c].nissues * sizeof(csv_issue_t));
+        nissues += pool.chunks[c].nissues;
+    }
+    qsort(issues, nissues, sizeof(csv_issue_t), cmp_issue);
+    for (int i = 0; on_bad && i < nissues; i++)
+        on_bad(issues[i].line, issues[i].id, issues[i].err, arg);
+    rc = imported;
+
+done:
+    for (int c = 0; c < pool.nchunks; c++) {
+        free(pool.chunks[c].rows);
+        free(pool.chunks[c].row_lines);
+        free(pool.chunks[c].results);
+        free(pool.chunks[c].issues);
+    }
+    free(pool.chunks);
+    free(seen);
+    free(issues);
+    if (data != MAP_FAILED)
+        io_munmap(data, st.st_size);
+    if (fd != -1)
+        io_close(fd);
+    return rc;
+}
@@ -0,0 +1,505 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// database include files
+#include "db.h"
+#include "sdbint.h"
+
+/*
+ *  GPA index
+ *
+ *  The index file (see GPA_ in db.h) is a counting sort of every student
+ *  by GPA, built in one scan and kept current the same way as the trigram
+ *  index: a change only appends the id to the log at the end of the file,
+ *  queries treat logged ids as dirty and read them from the database, and
+ *  once the log holds more than GPA_LOG_MAX ids the next query rebuilds
+ *  the index.
+ *
+ *  A range query walks the buckets of the range, a rank query only needs
+ *  the bucket starts and the old GPA of every dirty id.
+ */
+#define GPA_LOG_MAX     4096        //logged ids before a query rebuilds
+
+typedef struct gpa_build {
+    uint16_t *gpa_of;               //GPA + 1 per id, 0 for no student
+    uint32_t count[GPA_BUCKETS];
+    uint32_t total;
+    uint32_t max_id;
+} gpa_build_t;
+
+//a mapped index and its dirty ids
+typedef struct gpa_view {
+    gpa_header_t hdr;
+    uint8_t *map;
+    size_t size;
+    const uint32_t *start;
+    const uint32_t *ids;
+    const uint16_t *gpa_of;
+    uint32_t *dirty;                //every logged id once
+    int ndirty;
+    uint8_t *is_dirty;              //per id
+} gpa_view_t;
+
+//students collected for a sorted hand out
+typedef struct gpa_list {
+    student_t *recs;
+    int n;
+    int cap;
+} gpa_list_t;
+
+//sdb_scan() callback that records the GPA of every student
+static int build_collect(const student_t *s, void *arg)
+{
+    gpa_build_t *b = arg;
+
+    if (s->gpa < MIN_STD_GPA || s->gpa > MAX_STD_GPA)
+        return 0;
+    b->gpa_of[s->id] = s->gpa + 1;
+    b->count[s->gpa]++;
+    b->total++;
+    if ((uint32_t)s->id > b->max_id)
+        b->max_id = s->id;
+    return 0;
+}
+
+static int build_shard(sdb_t *shard, int idx, void *arg)
+{
+    (void)idx;
+    (void)arg;
+    return sdb_gpa_build(shard);
+}
+
+/*
+ *  sdb_gpa_build
+ *      db:  database handle
+ *
+ *  Builds the GPA index from scratch in one pass over the database, or
+ *  creates it if the database has none yet.  Once an index exists the
+ *  library keeps it current on every change.  Every shard has an index of
+ *  its own.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int sdb_gpa_build(sdb_t *db)
+{
+    gpa_build_t b = {0};
+    uint8_t *file = NULL;
+    char *tmp_path = NULL;
+    int rc = ERR_DB_FILE;
+    int fd = -1;
+
+    if (db->nshards)
+        return shard_fan_out(db, build_shard, NULL, NULL);
+
+    b.gpa_of = calloc(MAX_STD_ID + 1, sizeof(uint16_t));
+    if (!b.gpa_of || sdb_scan(db, build_collect, &b) != NO_ERROR)
+        goto done;
+
+    gpa_header_t hdr = { .version = GPA_VERSION, .count = b.total, .max_id = b.max_id };
+    memcpy(hdr.magic, GPA_MAGIC, 4);
+    hdr.start_off = sizeof(gpa_header_t);
+    hdr.ids_off = hdr.start_off + (GPA_BUCKETS + 1) * sizeof(uint32_t);
+    hdr.gpa_off = hdr.ids_off + (uint64_t)b.total * sizeof(uint32_t);
+    hdr.log_off = hdr.gpa_off + ((uint64_t)b.max_id + 1) * sizeof(uint16_t);
+    hdr.log_off = (hdr.log_off + 3) & ~(uint64_t)3;
+
+    file = calloc(hdr.log_off, 1);
+    if (!file)
+        goto done;
+    memcpy(file, &hdr, sizeof(hdr));
+    memcpy(file + hdr.gpa_off, b.gpa_of, ((size_t)b.max_id + 1) * sizeof(uint16_t));
+
+    //ids come out of the table in order, so every bucket is sorted
+    uint32_t *start = (uint32_t *)(file + hdr.start_off);
+    uint32_t *ids = (uint32_t *)(file + hdr.ids_off);
+    uint32_t pos[GPA_BUCKETS];
+    for (int g = 0; g < GPA_BUCKETS; g++) {
+        pos[g] = start[g];
+        start[g + 1] = start[g] + b.count[g];
+    }
+    for (uint32_t id = 0; id <= b.max_id; id++) {
+        if (b.gpa_of[id])
+            ids[pos[b.gpa_of[id] - 1]++] = id;
+    }
+
+    //written beside the old index and renamed over it
+    tmp_path = malloc(strlen(db->gpa_path) + 5);
+    if (!tmp_path)
+        goto done;
+    sprintf(tmp_path, "%s.tmp", db->gpa_path);
+    fd = io_open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (fd == -1 || io_write(fd, file, hdr.log_off) != (ssize_t)hdr.log_off ||
+        io_rename(tmp_path, db->gpa_path) != 0) {
+        io_unlink(tmp_path);
+        goto done;
+    }
+
+    if (db->gpa_fd != -1)
+        io_close(db->gpa_fd);
+    db->gpa_fd = fd;
+    fd = -1;
+    rc = NO_ERROR;
+
+done:
+    if (fd != -1)
+        io_close(fd);
+    free(tmp_path);
+    free(file);
+    free(b.gpa_of);
+    return rc;
+}
+
+//appends changed ids to the index log
+int gpa_note(sdb_t *db, const uint32_t *ids, int n)
+{
+    if (db->gpa_fd == -1 || n <= 0)
+        return NO_ERROR;
+    ssize_t bytes = (ssize_t)n * sizeof(uint32_t);
+    return io_write(db->gpa_fd, ids, bytes) == bytes ? NO_ERROR : ERR_DB_FILE;
+}
+
+//an emptied database gets an empty index if it had one
+int gpa_reset(sdb_t *db)
+{
+    return db->gpa_fd == -1 ? NO_ERROR : sdb_gpa_build(db);
+}
+
+static void gpa_unmap(gpa_view_t *v)
+{
+    if (v->map)
+        io_munmap(v->map, v->size);
+    free(v->dirty);
+    free(v->is_dirty);
+    memset(v, 0, sizeof(*v));
+}
+
+//true when the mapped file is laid out the way sdb_gpa_build() writes it:
+//every section inside the file, in order and aligned, and bucket starts
+//that ascend to the id count
+static bool gpa_layout_ok(gpa_view_t *v)
+{
+    const gpa_header_t *h = &v->hdr;
+
+    if (memcmp(h->magic, GPA_MAGIC, 4) != 0 || h->version != GPA_VERSION ||
+        h->count > MAX_STD_ID || h->max_id > MAX_STD_ID)
+        return false;
+    if (h->start_off > v->size || h->ids_off > v->size || h->gpa_off > v->size ||
+        h->log_off > v->size)
+        return false;
+    if (h->start_off < sizeof(gpa_header_t) ||
+        h->ids_off < h->start_off + (GPA_BUCKETS + 1) * sizeof(uint32_t) ||
+        h->gpa_off < h->ids_off + (uint64_t)h->count * sizeof(uint32_t) ||
+        h->log_off < h->gpa_off + ((uint64_t)h->max_id + 1) * sizeof(uint16_t))
+        return false;
+    if ((h->start_off | h->ids_off | h->log_off) % sizeof(uint32_t) ||
+        h->gpa_off % sizeof(uint16_t))
+        return false;
+
+    v->start = (const uint32_t *)(v->map + h->start_off);
+    v->ids = (const uint32_t *)(v->map + h->ids_off);
+    v->gpa_of = (const uint16_t *)(v->map + h->gpa_off);
+    for (int g = 0; g < GPA_BUCKETS; g++) {
+        if (v->start[g] > v->start[g + 1])
+            return false;
+    }
+    return v->start[0] == 0 && v->start[GPA_BUCKETS] == h->count;
+}
+
+//maps the index, building or rebuilding it first when needed, a file that
+//is damaged is rebuilt the same way as one with a full log
+static int gpa_map(sdb_t *db, gpa_view_t *v)
+{
+    struct stat st;
+    bool rebuilt = false;
+
+    memset(v, 0, sizeof(*v));
+    if (db->gpa_fd == -1) {
+        if (sdb_gpa_build(db) != NO_ERROR)
+            return ERR_DB_FILE;
+        rebuilt = true;
+    }
+    for (;;) {
+        if (io_fstat(db->gpa_fd, &st) == -1)
+            return ERR_DB_FILE;
+        if ((size_t)st.st_size >= sizeof(gpa_header_t)) {
+            v->size = st.st_size;
+            v->map = io_mmap(v->size, PROT_READ, MAP_SHARED, db->gpa_fd);
+            if (v->map == MAP_FAILED) {
+                v->map = NULL;
+                return ERR_DB_FILE;
+            }
+            memcpy(&v->hdr, v->map, sizeof(v->hdr));
+            if (gpa_layout_ok(v) &&
+                (v->size - v->hdr.log_off) / sizeof(uint32_t) <= GPA_LOG_MAX)
+                break;
+            io_munmap(v->map, v->size);
+            v->map = NULL;
+        }
+        if (rebuilt || sdb_gpa_build(db) != NO_ERROR)
+            return ERR_DB_FILE;
+        rebuilt = true;
+    }
+
+    size_t nlog = (v->size - v->hdr.log_off) / sizeof(uint32_t);
+    const uint32_t *log = (const uint32_t *)(v->map + v->hdr.log_off);
+    v->is_dirty = calloc(MAX_STD_ID + 1, 1);
+    v->dirty = malloc((nlog ? nlog : 1) * sizeof(uint32_t));
+    if (!v->is_dirty || !v->dirty) {
+        gpa_unmap(v);
+        return ERR_DB_FILE;
+    }
+    for (size_t i = 0; i < nlog; i++) {
+        if (log[i] <= MAX_STD_ID && !v->is_dirty[log[i]]) {
+            v->is_dirty[log[i]] = 1;
+            v->dirty[v->ndirty++] = log[i];
+        }
+    }
+    return NO_ERROR;
+}
+
+//GPA order, ties by id
+static int cmp_gpa(const void *x, const void *y)
+{
+    const student_t *a = x, *b = y;
+
+    if (a->gpa != b->gpa)
+        return a->gpa - b->gpa;
+    return (a->id > b->id) - (a->id < b->id);
+}
+
+static int list_add(const student_t *s, void *arg)
+{
+    gpa_list_t *l = arg;
+
+    if (l->n == l->cap) {
+        int cap = l->cap ? l->cap * 2 : 64;
+        student_t *recs = realloc(l->recs, cap * sizeof(student_t));
+        if (!recs)
+            return ERR_DB_FILE;
+        l->recs = recs;
+        l->cap = cap;
+    }
+    l->recs[l->n++] = *s;
+    return 0;
+}
+
+//one shard's range, collected for the merge
+typedef struct shard_range {
+    int lo;
+    int hi;
+    gpa_list_t lists[SHARD_MAX];
+} shard_range_t;
+
+static int range_shard(sdb_t *shard, int idx, void *arg)
+{
+    shard_range_t *sr = arg;
+
+    return sdb_gpa_range(shard, sr->lo, sr->hi, list_add, &sr->lists[idx]);
+}
+
+//queries every shard at once and hands out their students in GPA order
+static int range_shards(sdb_t *db, int lo, int hi, sdb_scan_fn fn, void *arg)
+{
+    shard_range_t *sr = calloc(1, sizeof(shard_range_t));
+    gpa_list_t all = {0};
+    int rc = ERR_DB_FILE;
+
+    if (!sr)
+        return ERR_DB_FILE;
+    sr->lo = lo;
+    sr->hi = hi;
+    if (shard_fan_out(db, range_shard, sr, NULL) < 0)
+        goto done;
+
+    for (int i = 0; i < db->nshards; i++) {
+        for (int k = 0; k < sr->lists[i].n; k++) {
+            if (list_add(&sr->lists[i].recs[k], &all) != 0)
+                goto done;
+        }
+    }
+    qsort(all.recs, all.n, sizeof(student_t), cmp_gpa);
+    rc = NO_ERROR;
+    for (int i = 0; i < all.n && rc == NO_ERROR; i++)
+        rc = fn(&all.recs[i], arg);
+
+done:
+    for (int i = 0; i < db->nshards; i++)
+        free(sr->lists[i].recs);
+    free(sr);
+    free(all.recs);
+    return rc;
+}
+
+/*
+ *  sdb_gpa_range
+ *      db:   database handle
+ *      lo:   lowest GPA wanted, in hundredths
+ *      hi:   highest GPA wanted, in hundredths
+ *      fn:   called with every live student in the range
+ *      arg:  passed through to fn
+ *
+ *  Walks the GPA index buckets from lo to hi, so students come out by GPA
+ *  and then by id without a scan of the database.  The index is built
+ *  first if the database does not have one yet.  Shards are queried side
+ *  by side.
+ *
+ *  returns:  NO_ERROR       every student in the range was visited
+ *            ERR_DB_ARGS    lo or hi out of range, or lo above hi
+ *            ERR_DB_FILE    database or index file I/O issue
+ *            <other>        the non-zero value fn returned to stop early
+ */
+int sdb_gpa_range(sdb_t *db, int lo, int hi, sdb_scan_fn fn, void *arg)
+{
+    gpa_view_t v;
+    gpa_list_t changed = {0};
+    int rc = ERR_DB_FILE;
+
+    if (lo < MIN_STD_GPA || hi > MAX_STD_GPA || lo > hi)
+        return ERR_DB_ARGS;
+    if (db->nshards)
+        return range_shards(db, lo, hi, fn, arg);
+    if (gpa_map(db, &v) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    //dirty students are read as they are now and merged in GPA order
+    for (int i = 0; i < v.ndirty; i++) {
+        student_t s;
+        int grc = sdb_get(db, v.dirty[i], &s);
+        if (grc == SRCH_NOT_FOUND || grc == ERR_DB_ARGS)
+            continue;
+        if (grc != NO_ERROR)
+            goto done;
+        if (s.gpa >= lo && s.gpa <= hi && list_add(&s, &changed) != 0)
+            goto done;
+    }
+    qsort(changed.recs, changed.n, sizeof(student_t), cmp_gpa);
+
+    int next = 0;
+    rc = NO_ERROR;
+    for (int g = lo; g <= hi && rc == NO_ERROR; g++) {
+        for (uint32_t i = v.start[g]; i < v.start[g + 1] && rc == NO_ERROR; i++) {
+            student_t s;
+            uint32_t id = v.ids[i];
+            if (id > MAX_STD_ID || v.is_dirty[id])
+                continue;
+            int grc = sdb_get(db, id, &s);
+            if (grc == SRCH_NOT_FOUND)
+                continue;
+            if (grc != NO_ERROR) {
+                rc = ERR_DB_FILE;
+                break;
+            }
+            while (rc == NO_ERROR && next < changed.n && cmp_gpa(&changed.recs[next], &s) < 0)
+                rc = fn(&changed.recs[next++], arg);
+            if (rc == NO_ERROR)
+                rc = fn(&s, arg);
+        }
+    }
+    while (rc == NO_ERROR && next < changed.n)
+        rc = fn(&changed.recs[next++], arg);
+
+done:
+    gpa_unmap(&v);
+    free(changed.recs);
+    return rc;
+}
+
+//counts the students of one database, and those with a GPA above gpa
+static int gpa_count(sdb_t *db, int gpa, int *above, int *total)
+{
+    gpa_view_t v;
+
+    if (gpa_map(db, &v) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    *total = v.hdr.count;
+    *above = v.hdr.count - v.start[gpa + 1];
+    for (int i = 0; i < v.ndirty; i++) {
+        uint32_t id = v.dirty[i];
+        student_t s;
+
+        //take out what the index remembers, put in what is there now
+        if (id <= v.hdr.max_id && v.gpa_of[id]) {
+            (*total)--;
+            if (v.gpa_of[id] - 1 > gpa)
+                (*above)--;
+        }
+        int grc = sdb_get(db, id, &s);
+        if (grc == SRCH_NOT_FOUND || grc == ERR_DB_ARGS)
+            continue;
+        if (grc != NO_ERROR) {
+            gpa_unmap(&v);
+            return ERR_DB_FILE;
+        }
+        (*total)++;
+        if (s.gpa > gpa)
+            (*above)++;
+    }
+    gpa_unmap(&v);
+    return NO_ERROR;
+}
+
+typedef struct shard_count {
+    int gpa;
+    int above[SHARD_MAX];
+    int total[SHARD_MAX];
+} shard_count_t;
+
+static int count_shard(sdb_t *shard, int idx, void *arg)
+{
+    shard_count_t *sc = arg;
+
+    return gpa_count(shard, sc->gpa, &sc->above[idx], &sc->total[idx]);
+}
+
+/*
+ *  sdb_gpa_rank
+ *      db:     database handle
+ *      id:     the student to rank
+ *      rank:   receives 1 plus the number of students with a higher GPA,
+ *              so students with the same GPA share a rank
+ *      total:  receives the number of students in the database
+ *
+ *  Reads both counts off the GPA index bucket starts, which is built
+ *  first if the database does not have one yet.  Shards are counted side
+ *  by side.
+ *
+ *  returns:  NO_ERROR        *rank and *total are set
+ *            SRCH_NOT_FOUND  there is no student with that id
+ *            ERR_DB_ARGS     id out of range
+ *            ERR_DB_FILE     database or index file I/O issue
+ */
+int sdb_gpa_rank(sdb_t *db, int id, int *rank, int *total)
+{
+    student_t s;
+    int above = 0;
+
+    int rc = sdb_get(db, id, &s);
+    if (rc != NO_ERROR)
+        return rc;
+    if (s.gpa < MIN_STD_GPA || s.gpa > MAX_STD_GPA)
+        return ERR_DB_FILE;
+
+    if (db->nshards) {
+        shard_count_t sc = { .gpa = s.gpa };
+        if (shard_fan_out(db, count_shard, &sc, NULL) < 0)
+            return ERR_DB_FILE;
+        *total = 0;
+        for (int i = 0; i < db->nshards; i++) {
+            above += sc.above[i];
+            *total += sc.total[i];
+        }
+    } else if (gpa_count(db, s.gpa, &above, total) != NO_ERROR) {
+        return ERR_DB_FILE;
+    }
+
+    *rank = above + 1;
+    return NO_ERROR;
+}
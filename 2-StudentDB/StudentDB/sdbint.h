@@ -0,0 +1,181 @@
+#ifndef __SDB_INT_H__
+    #define __SDB_INT_H__
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "sdb.h"
+
+//Internals shared by the libsdb source files.  Nothing in here is part of
+//the public API in sdb.h.
+
+#define SCAN_BATCH      256         //slots or directory entries per read
+#define SCAN_WINDOW     65536       //bytes of version 2 heap read at a time
+#define PUNCH_PAGE      4096        //unit sdb_delete_where() releases storage in
+
+//bulk writers (batch adds, imports, rebuilds) reserve file space before
+//filling it, at least PREALLOC_CHUNK at a time, and write in buffers of up
+//to WRITE_BUF bytes that start on a WRITE_ALIGN page.
+#define PREALLOC_CHUNK  (1 << 20)
+#define WRITE_BUF       65536
+#define WRITE_ALIGN     4096
+
+//direct scans (sdb_set_direct) read DIRECT_BUF bytes at a time from offsets
+//and into buffers aligned to DIRECT_ALIGN, which O_DIRECT requires.  A
+//DIRECT_ALIGN page always holds whole 64 byte version 1 slots.
+#define DIRECT_ALIGN    4096
+#define DIRECT_BUF      (2 << 20)
+
+//sdb_scan_sorted() memory budget.  With at least SORT_MEM_MIN every run
+//of a full database still gets a read buffer, so one merge pass is enough.
+#define SORT_MEM_DEFAULT    (64 << 20)
+#define SORT_MEM_MIN        65536
+
+//the state behind an sdb_t handle
+struct sdb {
+    int fd;
+    int version;                    //DB_VERSION_1 or DB_VERSION_2
+    db_header_t hdr;                //version 2 header, kept in sync on disk
+    char *path;                     //database file name
+    char *tmp_path;                 //scratch file used to rebuild it
+    int crc_fd;                     //checksum file, see CRC_ defines in db.h
+    char *crc_path;
+    int tri_fd;                     //trigram index, -1 if there is none
+    char *tri_path;
+    int gpa_fd;                     //GPA index, -1 if there is none
+    char *gpa_path;
+    bool direct;                    //scans bypass the page cache
+    off_t reserved;                 //fd is reserved up to here, see grow_reserve()
+    int nshards;                    //0 unless the file is a shard manifest
+    int shard_mode;                 //SDB_SHARD_HASH or SDB_SHARD_RANGE
+    sdb_t **shards;                 //a handle per shard file
+    int *shard_first;               //range mode: lowest id of every shard
+};
+
+//an aligned read window of a direct scan
+typedef struct scan_win {
+    uint8_t *buf;                   //DIRECT_BUF bytes
+    off_t off;                      //file offset of buf[0]
+    size_t len;                     //valid bytes in buf
+} scan_win_t;
+
+//db_scan_t walks either version in id order and hands back only the live
+//students.  Version 1 is read a batch of slots per pread(), version 2 a
+//batch of directory entries per pread() plus a window over the heap.  A
+//direct scan serves those same reads from two DIRECT_BUF windows, one over
+//the slots or directory and one over the heap, filled through io_fd.  A
+//batch without a live student in a sparse file seeks to the next data
+//instead of reading the zeros of a hole.
+typedef struct db_scan {
+    sdb_t *db;
+    int n;                          //slots or entries currently buffered
+    int next;                       //next buffered slot or entry to look at
+    off_t pos;                      //v1: offset of the next slot to read
+    uint32_t dir_pos;               //v2: id of the next entry to read
+    student_t recs[SCAN_BATCH];     //v1: buffered slots
+    dir_entry_t dir[SCAN_BATCH];    //v2: buffered directory entries
+    off_t win_off;                  //v2: file offset of win[0]
+    size_t win_len;                 //v2: valid bytes in win
+    const uint8_t *raw;             //v2: encoded form of the last student
+    uint32_t raw_len;
+    uint8_t win[SCAN_WINDOW];
+    off_t size;                     //file size when sparse, else 0
+    bool hit;                       //the buffered batch had a live student
+    int io_fd;                      //direct: O_DIRECT fd, or db->fd as fallback
+    scan_win_t meta;                //direct: slots or directory
+    scan_win_t heap;                //direct: v2 heap
+} db_scan_t;
+
+db_scan_t *scan_open(sdb_t *db);
+int scan_next(db_scan_t *sc, student_t *s);
+void scan_close(db_scan_t *sc);
+
+//write one student without the duplicate check, sync_header=false lets a
+//batch of version 2 adds write the header once at the end
+int store_student(sdb_t *db, const student_t *s, bool sync_header);
+int write_db_header(sdb_t *db);
+int sync_db_headers(sdb_t *db);
+
+//version 1 batch adds split in two so an import can reserve the file once
+//for ids added from several threads, see sdb_add_batch()
+void reserve_ids(sdb_t *db, int lo, int hi, int n);
+int add_batch_v1(sdb_t *db, const student_t *students, int n, int *results);
+
+//Sharded databases, see sdbshard.c.  A sharded handle has no data, crc or
+//index file of its own, every public function either routes to the one
+//shard holding an id or fans out to all of them.
+typedef int (*shard_fn)(sdb_t *shard, int idx, void *arg);
+
+int shard_open(sdb_t *db, bool should_truncate);
+void shard_close(sdb_t *db);
+sdb_t *shard_for(sdb_t *db, int id);
+int shard_fan_out(sdb_t *db, shard_fn fn, void *arg, int *results);
+int shard_scan(sdb_t *db, sdb_scan_fn fn, void *arg);
+int shard_add_batch(sdb_t *db, const student_t *students, int n, int *results);
+int shard_scrub(sdb_t *db, int nthreads, int *checked, sdb_id_fn on_bad, void *arg);
+
+//records changed ids in the trigram index log, a no-op without an index
+int tri_note(sdb_t *db, const uint32_t *ids, int n);
+int tri_reset(sdb_t *db);
+
+//the same for the GPA index
+int gpa_note(sdb_t *db, const uint32_t *ids, int n);
+int gpa_reset(sdb_t *db);
+
+//I/O statistics, see sdbstats.c.  io_stats is NULL until sdb_stats_enable()
+//so a disabled counter costs one branch.  The counters are shared by every
+//thread, additions are atomic but need no ordering.
+extern sdb_stats_t *io_stats;
+
+#define IO_STAT_ADD(field, n) \
+    do { \
+        if (__builtin_expect(io_stats != NULL, 0)) \
+            __atomic_fetch_add(&io_stats->field, (n), __ATOMIC_RELAXED); \
+    } while (0)
+
+//every system call of the library goes through an io_ wrapper that counts
+//it, the data path ones are inline
+static inline ssize_t io_pread(int fd, void *buf, size_t len, off_t off)
+{
+    ssize_t n = pread(fd, buf, len, off);
+    IO_STAT_ADD(calls[SDB_IO_PREAD], 1);
+    IO_STAT_ADD(bytes_read, n > 0 ? n : 0);
+    return n;
+}
+
+static inline ssize_t io_pwrite(int fd, const void *buf, size_t len, off_t off)
+{
+    ssize_t n = pwrite(fd, buf, len, off);
+    IO_STAT_ADD(calls[SDB_IO_PWRITE], 1);
+    IO_STAT_ADD(bytes_written, n > 0 ? n : 0);
+    return n;
+}
+
+static inline ssize_t io_write(int fd, const void *buf, size_t len)
+{
+    ssize_t n = write(fd, buf, len);
+    IO_STAT_ADD(calls[SDB_IO_WRITE], 1);
+    IO_STAT_ADD(bytes_written, n > 0 ? n : 0);
+    return n;
+}
+
+struct stat;
+int io_open(const char *path, int flags, mode_t mode);
+int io_close(int fd);
+off_t io_lseek(int fd, off_t off, int whence);
+int io_fstat(int fd, struct stat *st);
+int io_ftruncate(int fd, off_t len);
+int io_fallocate(int fd, int mode, off_t off, off_t len);
+int io_fdatasync(int fd);
+int io_fadvise(int fd, off_t off, off_t len, int advice);
+void *io_mmap(size_t len, int prot, int flags, int fd);
+int io_munmap(void *addr, size_t len);
+int io_rename(const char *from, const char *to);
+int io_unlink(const char *path);
+int io_mkstemp(char *path);
+
+//CRC32C of a buffer, and the checksum file value for a record (NULL = empty)
+uint32_t crc32c(const void *buf, size_t len);
+uint32_t crc_stamp(const void *rec, size_t len);
+
+#endif
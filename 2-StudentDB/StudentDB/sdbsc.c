@@ -1,56 +1,86 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <fcntl.h> //c library for system call file routines
 #include <string.h>
-#include <sys/stat.h>
-#include <unistd.h>
 #include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
 
 // database include files
 #include "db.h"
 #include "sdbsc.h"
 
+/*
+ *  The database itself lives in libsdb (see sdb.h), which never writes to
+ *  the console.  The functions in this file wrap the library calls and
+ *  turn their return codes into the M_ messages from sdbsc.h.
+ */
+
+//monotonic clock in milliseconds, used for session timing trailers
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+//--stats state, the library counts the I/O and we time the phases
+static int stats_mode = STATS_OFF;
+static int phase_calls[PHASES];
+static double phase_ms[PHASES];
+static const char *phase_names[PHASES] = { "open", "lookup", "scan", "write", "close" };
+
+static void phase_add(int phase, double start)
+{
+    if (stats_mode == STATS_OFF || phase < 0)
+        return;
+    phase_calls[phase]++;
+    phase_ms[phase] += now_ms() - start;
+}
+
+//the phase an option spends its time in, -1 for options that do no I/O
+static int option_phase(char opt)
+{
+    switch (opt)
+    {
+    case 'f': case 'g': case 'k':
+        return PHASE_LOOKUP;
+    case 'c': case 'e': case 'p': case 'q': case 'S':
+        return PHASE_SCAN;
+    case 'a': case 'd': case 'D': case 'I': case 'm': case 'r': case 'x': case 'z': case 'H':
+        return PHASE_WRITE;
+    }
+    return -1;
+}
+
 /*
  *  open_db
  *      dbFile:  name of the database file
  *      should_truncate:  indicates if opening the file also empties it
  *
- *  returns:  File descriptor on success, or ERR_DB_FILE on failure
+ *  returns:  Database handle on success, or NULL on failure
  *
  *  console:  Does not produce any console I/O on success
  *            M_ERR_DB_OPEN on error
  *
  */
-int open_db(char *dbFile, bool should_truncate)
+sdb_t *open_db(char *dbFile, bool should_truncate)
 {
-    // Set permissions: rw-rw----
-    // see sys/stat.h for constants
-    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
-
-    // open the file if it exists for Read and Write,
-    // create it if it does not exist
-    int flags = O_RDWR | O_CREAT;
+    sdb_t *db;
 
-    if (should_truncate)
-        flags += O_TRUNC;
-
-    // Now open file
-    int fd = open(dbFile, flags, mode);
-
-    if (fd == -1)
+    if (sdb_open(dbFile, should_truncate, &db) != NO_ERROR)
     {
         // Handle the error
         printf(M_ERR_DB_OPEN);
-        return ERR_DB_FILE;
+        return NULL;
     }
 
-    return fd;
+    return db;
 }
 
 /*
  *  get_student
- *      fd:  linux file descriptor
- *      id:  the student id we are looking forname of the
+ *      db:  database handle
+ *      id:  the student id we are looking for
  *      *s:  a pointer where the located (if found) student data will be
  *           copied
  *
@@ -60,56 +90,27 @@ int open_db(char *dbFile, bool should_truncate)
  *
  *  console:  Does not produce any console I/O used by other functions
  */
-int get_student(int fd, int id, student_t *s)
+int get_student(sdb_t *db, int id, student_t *s)
 {
-    //Check if id is in valid range
-    if ((id < MIN_STD_ID) || (id > MAX_STD_ID)) {
-        return ERR_DB_OP;
-    }
-
-    //Calculate the offset to the student record
-    off_t offset = id * STUDENT_RECORD_SIZE;
-
-    //Seek to the student record
-    if (lseek(fd, offset, SEEK_SET) == -1) {
-        return ERR_DB_FILE;
-    }
-    
-    //Read the student record
-    ssize_t bytes_read = read(fd, s, STUDENT_RECORD_SIZE);
-
-    //Check for read error
-    if (bytes_read == -1) {
-        return ERR_DB_FILE;
-    }
+    int rc = sdb_get(db, id, s);
 
-    //Check if we have the complete record
-    if (bytes_read != STUDENT_RECORD_SIZE) {
+    //an id out of range can not be in the database
+    if (rc == ERR_DB_ARGS) {
         return SRCH_NOT_FOUND;
     }
-
-    //Check if the student record is empty
-    if (memcmp(s, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0) {
-        return SRCH_NOT_FOUND;
-    }
-
-    //Student record found
-    return NO_ERROR;
-
+    return rc;
 }
 
 /*
  *  add_student
- *      fd:     linux file descriptor
+ *      db:     database handle
  *      id:     student id (range is defined in db.h )
  *      fname:  student first name
  *      lname:  student last name
  *      gpa:    GPA as an integer (range defined in db.h)
  *
- *  Adds a new student to the database.  After calculating the index for the
- *  student, check if there is another student already at that location.  A good
- *  way is to use something like memcmp() to ensure that the location for this
- *  student contains all zero byes indicating the space is empty.
+ *  Adds a new student to the database, sdb_add() checks that the id is not
+ *  already in use.
  *
  *  returns:  NO_ERROR       student added to database
  *            ERR_DB_FILE    database file I/O issue
@@ -119,61 +120,36 @@ int get_student(int fd, int id, student_t *s)
  *
  *  console:  M_STD_ADDED       on success
  *            M_ERR_DB_ADD_DUP  student already exists
- *            M_ERR_DB_READ     error reading or seeking the database file
+ *            M_ERR_STD_RNG     id or gpa out of range
  *            M_ERR_DB_WRITE    error writing to db file (adding student)
  *
  */
-int add_student(int fd, int id, char *fname, char *lname, int gpa)
+int add_student(sdb_t *db, int id, char *fname, char *lname, int gpa)
 {
-    student_t new_student = {0};
-    student_t existing_student = {0};
-
-    //Validate range(though this should already be done by caller)
-    if (validate_range(id, gpa) != NO_ERROR) {
-        return ERR_DB_OP;
-    }
+    int rc = sdb_add(db, id, fname, lname, gpa);
 
-    //Check if student already exists
-    int rc = get_student(fd, id, &existing_student);
-    if (rc == NO_ERROR) {
+    switch (rc) {
+    case NO_ERROR:
+        printf(M_STD_ADDED, id);
+        return NO_ERROR;
+    case ERR_DB_OP:
         printf(M_ERR_DB_ADD_DUP, id);
         return ERR_DB_OP;
-    }
-
-    //Prepare new student record
-    new_student.id = id;
-    new_student.gpa = gpa;
-    strncpy(new_student.fname, fname, sizeof(new_student.fname) - 1);
-    strncpy(new_student.lname, lname, sizeof(new_student.lname) - 1);
-
-    //Calculate offset for writing student record
-    off_t offset = id * STUDENT_RECORD_SIZE;
-
-    //Seek to position 
-    if (lseek(fd, offset, SEEK_SET) == -1) {
-        printf(M_ERR_DB_WRITE);
-        return ERR_DB_FILE;
-    }
-
-    //Write student record
-    if (write(fd, &new_student, STUDENT_RECORD_SIZE) != STUDENT_RECORD_SIZE) {
+    case ERR_DB_ARGS:
+        printf(M_ERR_STD_RNG);
+        return ERR_DB_OP;
+    default:
         printf(M_ERR_DB_WRITE);
         return ERR_DB_FILE;
     }
-
-    printf(M_STD_ADDED, id);
-    return NO_ERROR;
 }
 
 /*
  *  del_student
- *      fd:     linux file descriptor
+ *      db:     database handle
  *      id:     student id to be deleted
  *
- *  Removes a student to the database.  Use the get_student() function to
- *  locate the student to be deleted. If there is a student at that location
- *  write an empty student record - see EMPTY_STUDENT_RECORD from db.h at
- *  that location.
+ *  Removes a student from the database.
  *
  *  returns:  NO_ERROR       student deleted from database
  *            ERR_DB_FILE    database file I/O issue
@@ -183,97 +159,51 @@ int add_student(int fd, int id, char *fname, char *lname, int gpa)
  *
  *  console:  M_STD_DEL_MSG      on success
  *            M_STD_NOT_FND_MSG  student not in database, cant be deleted
- *            M_ERR_DB_READ      error reading or seeking the database file
- *            M_ERR_DB_WRITE     error writing to db file (adding student)
+ *            M_ERR_DB_WRITE     error reading or writing the db file
  *
  */
-int del_student(int fd, int id)
+int del_student(sdb_t *db, int id)
 {
-    student_t student = {0};
-
-   //First, try to find the student
-   int rc = get_student(fd, id, &student);
-    if (rc != NO_ERROR) {
-         printf(M_STD_NOT_FND_MSG, id);
-         return ERR_DB_OP;
-    }
-
-    //Calculate offset
-    off_t offset = id * STUDENT_RECORD_SIZE;
-
-    //Seek to position
-    if (lseek(fd, offset, SEEK_SET) == -1) {
-        printf(M_ERR_DB_READ);
-        return ERR_DB_FILE;
-    }
-
-    //Write empty student record
-    if (write(fd, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != STUDENT_RECORD_SIZE) {
+    int rc = sdb_del(db, id);
+
+    switch (rc) {
+    case NO_ERROR:
+        printf(M_STD_DEL_MSG, id);
+        return NO_ERROR;
+    case SRCH_NOT_FOUND:
+    case ERR_DB_ARGS:
+        printf(M_STD_NOT_FND_MSG, id);
+        return ERR_DB_OP;
+    default:
         printf(M_ERR_DB_WRITE);
         return ERR_DB_FILE;
     }
-
-    printf(M_STD_DEL_MSG, id);
-    return NO_ERROR;
-
 }
 
 /*
  *  count_db_records
- *      fd:     linux file descriptor
+ *      db:     database handle
  *
- *  Counts the number of records in the database.  Start by reading the
- *  database at the beginning, and continue reading individual records
- *  until you it EOF.  EOF is when the read() syscall returns 0. Check
- *  if a slot is empty or previously deleted by investigating if all of
- *  the bytes in the record read are zeros - I would suggest using memory
- *  compare memcmp() for this. Create a counter variable and initialize it
- *  to zero, every time a non-zero record is read increment the counter.
+ *  Counts the number of records in the database.
  *
  *  returns:  <number>       returns the number of records in db on success
  *            ERR_DB_FILE    database file I/O issue
- *            ERR_DB_OP      database operation logically failed (aka student
- *                           not in database)
  *
  *
  *  console:  M_DB_RECORD_CNT  on success, to report the number of students in db
  *            M_DB_EMPTY       on success if the record count in db is zero
  *            M_ERR_DB_READ    error reading or seeking the database file
- *            M_ERR_DB_WRITE   error writing to db file (adding student)
  *
  */
-int count_db_records(int fd)
+int count_db_records(sdb_t *db)
 {
-    student_t student = {0};
-    int count = 0;
+    int count = sdb_count(db);
 
-    //Seek to beginning of file
-    if (lseek(fd, 0, SEEK_SET) == -1) {
+    if (count < 0) {
         printf(M_ERR_DB_READ);
         return ERR_DB_FILE;
     }
 
-    //REad records until EOF
-    while (1) {
-        ssize_t bytes_read = read(fd, &student, STUDENT_RECORD_SIZE);
-
-        if (bytes_read == -1) {
-            printf(M_ERR_DB_READ);
-            return ERR_DB_FILE;
-        }
-        if (bytes_read == 0) {
-            break;
-        }
-        if (bytes_read != STUDENT_RECORD_SIZE) {
-            printf(M_ERR_DB_READ);
-            return ERR_DB_FILE;
-        }
-
-        //If record is not empty, increment count
-        if (memcmp(&student, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0) {
-            count++;
-        }
-    }
     //Print count
     if (count == 0) {
         printf(M_DB_EMPTY);
@@ -284,17 +214,29 @@ int count_db_records(int fd)
     return count;
 }
 
+//sdb_scan() callback for print_db, arg points at the header_printed flag
+static int print_db_row(const student_t *student, void *arg)
+{
+    bool *header_printed = arg;
+
+    // Print header before first record
+    if (!*header_printed) {
+        printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+        *header_printed = true;
+    }
+
+    // Print student record
+    float gpa = student->gpa / 100.0;
+    printf(STUDENT_PRINT_FMT_STRING, student->id, student->fname, student->lname, gpa);
+    return 0;
+}
+
 /*
  *  print_db
- *      fd:     linux file descriptor
+ *      db:     database handle
  *
- *  Prints all records in the database.  Start by reading the
- *  database at the beginning, and continue reading individual records
- *  until you it EOF.  EOF is when the read() syscall returns 0. Check
- *  if a slot is empty or previously deleted by investigating if all of
- *  the bytes in the record read are zeros - I would suggest using memory
- *  compare memcmp() for this. Be careful as the database might be empty.
- *  on the first real row encountered print the header for the required output:
+ *  Prints all records in the database in id order.  On the first real row
+ *  encountered print the header for the required output:
  *
  *     printf(STUDENT_PRINT_HDR_STRING, "ID",
  *                  "FIRST_NAME", "LAST_NAME", "GPA");
@@ -304,11 +246,6 @@ int count_db_records(int fd)
  *     printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname,
  *                    student.lname, calculated_gpa_from_student);
  *
- *  The code above assumes you are reading student records into a local
- *  variable named student that is of type student_t. Also dont forget that
- *  the GPA in the student structure is an int, to convert it into a real
- *  gpa divide by 100.0 and store in a float variable.
- *
  *  returns:  NO_ERROR       on success
  *            ERR_DB_FILE    database file I/O issue
  *
@@ -317,54 +254,40 @@ int count_db_records(int fd)
  *            M_ERR_DB_READ    error reading or seeking the database file
  *
  */
-int print_db(int fd)
+int print_db(sdb_t *db)
+{
+    return print_db_sorted(db, SDB_ORDER_ID, 0);
+}
+
+/*
+ *  print_db_sorted
+ *      db:          database handle
+ *      order:       SDB_ORDER_ID, SDB_ORDER_LNAME or SDB_ORDER_GPA
+ *      mem_budget:  bytes the sort may use, 0 for the library default
+ *
+ *  Prints all records like print_db(), in the order asked for.  Databases
+ *  larger than the budget are sorted on disk, see sdb_scan_sorted().
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database or scratch file I/O issue
+ *
+ *  console:  <see print_db>   on success, print table or database empty
+ *            M_ERR_DB_READ    error reading the database or sorting it
+ */
+int print_db_sorted(sdb_t *db, int order, size_t mem_budget)
 {
-    student_t student = {0};
     bool header_printed = false;
-    
-    // Seek to beginning of file
-    if (lseek(fd, 0, SEEK_SET) == -1) {
+
+    if (sdb_scan_sorted(db, order, mem_budget, print_db_row, &header_printed) != NO_ERROR) {
         printf(M_ERR_DB_READ);
         return ERR_DB_FILE;
     }
-    
-    // Read records until EOF
-    while (1) {
-        ssize_t bytes_read = read(fd, &student, STUDENT_RECORD_SIZE);
-        
-        if (bytes_read == -1) {
-            printf(M_ERR_DB_READ);
-            return ERR_DB_FILE;
-        }
-        
-        if (bytes_read == 0) {  // EOF
-            break;
-        }
-        
-        if (bytes_read != STUDENT_RECORD_SIZE) {
-            printf(M_ERR_DB_READ);
-            return ERR_DB_FILE;
-        }
-        
-        // If record is not empty/deleted
-        if (memcmp(&student, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0) {
-            // Print header before first record
-            if (!header_printed) {
-                printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
-                header_printed = true;
-            }
-            
-            // Print student record
-            float gpa = student.gpa / 100.0;
-            printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname, student.lname, gpa);
-        }
-    }
-    
+
     // If no records were found
     if (!header_printed) {
         printf(M_DB_EMPTY);
     }
-    
+
     return NO_ERROR;
 }
 
@@ -413,10 +336,8 @@ void print_student(student_t *s)
 }
 
 /*
- *  NOTE IMPLEMENTING THIS FUNCTION IS EXTRA CREDIT
- *
  *  compress_db
- *      fd:     linux file descriptor
+ *      db:     database handle
  *
  *  This assignment takes advantage of the way Linux handles sparse files
  *  on disk. Thus if there is a large hole between student records, Linux
@@ -424,231 +345,649 @@ void print_student(student_t *s)
  *  deleted storage is used to write a blank - see EMPTY_STUDENT_RECORD from
  *  db.h - record.
  *
- *  Since Linux provides no way to delete data in the middle of a file, and
- *  deleted records take up physical storage, this function will compress the
- *  database by rewriting a new database file that only includes valid student
- *  records. There are a number of ways to do this, but since this is extra credit
- *  you need to figure this out on your own.
- *
- *  At a high level create a temporary database file then copy all valid students from
- *  the active database (passed in via fd) to the temporary file. When this is done
- *  rename the temporary database file to the name of the real database file. See
- *  the constants in db.h for required file names:
- *
- *         #define DB_FILE     "student.db"        //name of database file
- *         #define TMP_DB_FILE ".tmp_student.db"   //for extra credit
+ *  sdb_compress() rewrites the live records into a temporary file next to
+ *  the database (.tmp_student.db for DB_FILE), renames it over the real
+ *  file and re-opens the handle on it, so the caller keeps using db.
  *
- *  Note that you are passed in the fd of the database file to be compressed,
- *  it is very likely you will need to close it to overwrite it with the
- *  compressed version of the file.  To ensure the caller can work with the
- *  compressed file after you create it, it is a good design to return the fd
- *  of the new compressed file from this function
- *
- *  returns:  <number>       returns the fd of the compressed database file
+ *  returns:  NO_ERROR       the database was compressed
  *            ERR_DB_FILE    database file I/O issue
  *
  *
  *  console:  M_DB_COMPRESSED_OK  on success, the db was successfully compressed.
- *            M_ERR_DB_OPEN    error when opening/creating temporary database file.
- *                             this error should also be returned after you
- *                             compressed the database file and if you are unable
- *                             to open it to pass the fd back to the caller
- *            M_ERR_DB_CREATE  error creating the db file. For instance the
- *                             inability to copy the temporary file back as
- *                             the primary database file.
- *            M_ERR_DB_READ    error reading or seeking the the db or tempdb file
- *            M_ERR_DB_WRITE   error writing to db or tempdb file (adding student)
+ *            M_ERR_DB_CREATE     error creating or renaming the compressed file
  *
  */
-int compress_db(int fd)
+int compress_db(sdb_t *db)
 {
-    student_t student = {0};
-    int tmp_fd;
-    
-    // Create temporary database file
-    tmp_fd = open_db(TMP_DB_FILE, true);
-    if (tmp_fd < 0) {
-        printf(M_ERR_DB_OPEN);
-        return ERR_DB_FILE;
-    }
-    
-    // Seek to beginning of original file
-    if (lseek(fd, 0, SEEK_SET) == -1) {
-        printf(M_ERR_DB_READ);
-        close(tmp_fd);
+    if (sdb_compress(db) != NO_ERROR) {
+        printf(M_ERR_DB_CREATE);
         return ERR_DB_FILE;
     }
-    
-    // Read and copy valid records
-    while (1) {
-        ssize_t bytes_read = read(fd, &student, STUDENT_RECORD_SIZE);
-        
-        if (bytes_read == -1) {
-            printf(M_ERR_DB_READ);
-            close(tmp_fd);
-            return ERR_DB_FILE;
-        }
-        
-        if (bytes_read == 0) {  // EOF
-            break;
-        }
-        
-        if (bytes_read != STUDENT_RECORD_SIZE) {
-            printf(M_ERR_DB_READ);
-            close(tmp_fd);
-            return ERR_DB_FILE;
-        }
-        
-        // If record is not empty/deleted, write to temp file
-        if (memcmp(&student, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0) {
-            off_t offset = student.id * STUDENT_RECORD_SIZE;
-            
-            if (lseek(tmp_fd, offset, SEEK_SET) == -1) {
-                printf(M_ERR_DB_WRITE);
-                close(tmp_fd);
-                return ERR_DB_FILE;
-            }
-            
-            if (write(tmp_fd, &student, STUDENT_RECORD_SIZE) != STUDENT_RECORD_SIZE) {
-                printf(M_ERR_DB_WRITE);
-                close(tmp_fd);
-                return ERR_DB_FILE;
-            }
-        }
+
+    printf(M_DB_COMPRESSED_OK);
+    return NO_ERROR;
+}
+
+/*
+ *  migrate_db
+ *      db:     database handle
+ *
+ *  Converts a version 1 database into the variable length version 2
+ *  format described in db.h.  Migrating a database that is already
+ *  version 2 leaves it alone.
+ *
+ *  returns:  <number>       the number of students converted
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_DB_MIGRATED    on success
+ *            M_DB_IS_V2       the database was already version 2
+ *            M_ERR_DB_CREATE  error creating or renaming the migrated file
+ */
+int migrate_db(sdb_t *db)
+{
+    int rc = sdb_migrate(db);
+
+    if (rc == ERR_DB_OP) {
+        printf(M_DB_IS_V2);
+        return 0;
     }
-    
-    // Close both files
-    close(fd);
-    close(tmp_fd);
-    
-    // Replace original with compressed version
-    if (rename(TMP_DB_FILE, DB_FILE) != 0) {
+    if (rc < 0) {
         printf(M_ERR_DB_CREATE);
         return ERR_DB_FILE;
     }
-    
-    // Reopen compressed database
-    fd = open_db(DB_FILE, false);
-    if (fd < 0) {
-        printf(M_ERR_DB_OPEN);
-        return ERR_DB_FILE;
-    }
-    
-    printf(M_DB_COMPRESSED_OK);
-    return fd;
+
+    printf(M_DB_MIGRATED, rc);
+    return rc;
 }
 
 /*
- *  validate_range
- *      id:  proposed student id
- *      gpa: proposed gpa
- *
- *  This function validates that the id and gpa are in the allowable ranges
- *  as per the specifications.  It checks if the values are within the
- *  inclusive range using constents in db.h
+ *  export_db
+ *      db:       database handle
+ *      arcFile:  name of the archive file to create (truncated if it exists)
  *
- *  returns:    NO_ERROR       on success, both ID and GPA are in range
- *              EXIT_FAIL_ARGS if either ID or GPA is out of range
+ *  Writes every student to a compact columnar archive, see sdb_export().
  *
- *  console:  This function does not produce any output
+ *  returns:  <number>       the number of students exported
+ *            ERR_DB_FILE    database or archive file I/O issue
  *
+ *  console:  M_DB_EXPORTED    on success
+ *            M_ERR_ARC_WRITE  error creating or writing the archive file
+ *            M_ERR_DB_READ    error reading the database, or the database
+ *                             changed while it was being exported
  */
-int validate_range(int id, int gpa)
+int export_db(sdb_t *db, char *arcFile)
 {
+    int rc = sdb_export(db, arcFile);
 
-    if ((id < MIN_STD_ID) || (id > MAX_STD_ID))
-        return EXIT_FAIL_ARGS;
+    if (rc == ERR_ARC_FILE) {
+        printf(M_ERR_ARC_WRITE);
+        return ERR_DB_FILE;
+    }
+    if (rc < 0) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
 
-    if ((gpa < MIN_STD_GPA) || (gpa > MAX_STD_GPA))
-        return EXIT_FAIL_ARGS;
+    printf(M_DB_EXPORTED, rc, arcFile);
+    return rc;
+}
 
-    return NO_ERROR;
+//sdb_import() callback, reports a student that is already in the database
+static int report_dup(const student_t *s, void *arg)
+{
+    int *dups = arg;
+
+    printf(M_ERR_DB_ADD_DUP, s->id);
+    (*dups)++;
+    return 0;
 }
 
 /*
- *  usage
- *      exename:  the name of the executable from argv[0]
- *
- *  Prints this programs expected usage
+ *  import_db
+ *      db:       database handle
+ *      arcFile:  name of an archive file created by export_db()
  *
- *  returns:    nothing, this is a void function
+ *  Loads every student in the archive into the database.  Students whose
+ *  id is already in use are reported and skipped, the rest are still
+ *  imported.
  *
- *  console:  This function prints the usage information
+ *  returns:  <number>       the number of students imported
+ *            ERR_DB_FILE    database or archive file I/O issue, or the
+ *                           archive is not valid
+ *            ERR_DB_OP      one or more students already existed
  *
+ *  console:  M_DB_IMPORTED     on completion
+ *            M_ERR_DB_ADD_DUP  for every student that already exists
+ *            M_ERR_ARC_OPEN    error opening the archive file
+ *            M_ERR_ARC_FORMAT  the archive is corrupt or truncated
+ *            M_ERR_DB_WRITE    error writing to db file
  */
-void usage(char *exename)
+int import_db(sdb_t *db, char *arcFile)
 {
-    printf("usage: %s -[h|a|c|d|f|p|z] options.  Where:\n", exename);
-    printf("\t-h:  prints help\n");
-    printf("\t-a id first_name last_name gpa(as 3 digit int):  adds a student\n");
-    printf("\t-c:  counts the records in the database\n");
-    printf("\t-d id:  deletes a student\n");
-    printf("\t-f id:  finds and prints a student in the database\n");
-    printf("\t-p:  prints all records in the student database\n");
-    printf("\t-x:  compress the database file [EXTRA CREDIT]\n");
-    printf("\t-z:  zero db file (remove all records)\n");
+    int dups = 0;
+    int rc = sdb_import(db, arcFile, report_dup, &dups);
+
+    switch (rc) {
+    case ERR_ARC_FILE:
+        printf(M_ERR_ARC_OPEN);
+        return ERR_DB_FILE;
+    case ERR_ARC_FORMAT:
+        printf(M_ERR_ARC_FORMAT);
+        return ERR_DB_FILE;
+    case ERR_DB_FILE:
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    printf(M_DB_IMPORTED, rc, arcFile);
+    return dups ? ERR_DB_OP : rc;
 }
 
-// Welcome to main()
-int main(int argc, char *argv[])
+//sdb_import_csv() callback, reports one row that was not imported
+static int report_bad_row(int line, int id, int err, void *arg)
 {
-    char opt;      // user selected option
-    int fd;        // file descriptor of database files
-    int rc;        // return code from various operations
-    int exit_code; // exit code to shell
-    int id;        // userid from argv[2]
-    int gpa;       // gpa from argv[5]
+    int *bad = arg;
+
+    if (err == ERR_DB_OP)
+        printf(M_ERR_CSV_DUP, line, id);
+    else
+        printf(M_ERR_CSV_ROW, line);
+    (*bad)++;
+    return 0;
+}
 
-    // space for a student structure which we will get back from
-    // some of the functions we will be writing such as get_student(),
-    // and print_student().
-    student_t student = {0};
+/*
+ *  import_csv
+ *      db:        database handle
+ *      csvFile:   name of a CSV file of id,first_name,last_name,gpa rows
+ *      nthreads:  threads to parse with, 0 for one per CPU
+ *
+ *  Bulk loads students from a CSV file, see sdb_import_csv().  Rows that
+ *  are not valid students or whose id already exists, in the database or
+ *  on an earlier line of the file, are reported in line order and
+ *  skipped, the rest are still imported.
+ *
+ *  returns:  <number>       the number of students imported
+ *            ERR_DB_FILE    database or CSV file I/O issue
+ *            ERR_DB_OP      one or more rows were not imported
+ *
+ *  console:  M_DB_IMPORTED    on completion
+ *            M_ERR_CSV_ROW    for every row that is not a valid student
+ *            M_ERR_CSV_DUP    for every row whose student already exists
+ *            M_ERR_CSV_OPEN   error opening the CSV file
+ *            M_ERR_DB_WRITE   error writing to db file
+ */
+int import_csv(sdb_t *db, char *csvFile, int nthreads)
+{
+    int bad = 0;
+    int rc = sdb_import_csv(db, csvFile, nthreads, report_bad_row, &bad);
 
-    // This function must have at least one arg, and the arg must start
-    // with a dash
-    if ((argc < 2) || (*argv[1] != '-'))
-    {
-        usage(argv[0]);
-        exit(1);
+    if (rc == ERR_ARC_FILE) {
+        printf(M_ERR_CSV_OPEN);
+        return ERR_DB_FILE;
     }
-
-    // The option is the first character after the dash for example
-    //-h -a -c -d -f -p -x -z
-    opt = (char)*(argv[1] + 1); // get the option flag
-
-    // handle the help flag and then exit normally
-    if (opt == 'h')
-    {
-        usage(argv[0]);
-        exit(EXIT_OK);
+    if (rc < 0) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
     }
 
-    // now lets open the file and continue if there is no error
-    // note we are not truncating the file using the second
-    // parameter
-    fd = open_db(DB_FILE, false);
-    if (fd < 0)
-    {
-        exit(EXIT_FAIL_DB);
-    }
+    printf(M_DB_IMPORTED, rc, csvFile);
+    return bad ? ERR_DB_OP : rc;
+}
 
-    // set rc to the return code of the operation to ensure the program
-    // use that to determine the proper exit_code.  Look at the header
-    // sdbsc.h for expected values.
+//one "field op value" term of a -D filter
+typedef struct filter_term {
+    char field;                     //'i'd, 'g'pa, 'f'name or 'l'name
+    char op[3];                     //=, !=, <, <=, > or >=
+    int num;                        //value of an id or gpa term
+    const char *str;                //value of a name term
+} filter_term_t;
 
-    exit_code = EXIT_OK;
-    switch (opt)
-    {
-    case 'a':
-        //   arv[0] arv[1]  arv[2]      arv[3]    arv[4]  arv[5]
-        // prog_name     -a      id  first_name last_name     gpa
-        //-------------------------------------------------------
-        // example:  prog_name -a 1 John Doe 341
-        if (argc != 6)
-        {
-            usage(argv[0]);
-            exit_code = EXIT_FAIL_ARGS;
-            break;
+typedef struct filter {
+    filter_term_t terms[FILTER_MAX_TERMS];
+    int nterms;
+} filter_t;
+
+/*
+ *  parse_filter
+ *      text:  filter from the command line, changed in place
+ *      f:     receives the parsed terms
+ *
+ *  A filter is one or more comma separated terms that must all match, for
+ *  example "gpa<200" or "lname=doe,gpa>=3.5".  Fields are id, gpa, fname
+ *  and lname, and a gpa may be written as 350 or 3.5.  Only -D and CSV
+ *  import take the decimal form, -a and -g want the integer.  Names
+ *  compare as strings.
+ *
+ *  returns:  NO_ERROR or ERR_DB_ARGS
+ */
+static int parse_filter(char *text, filter_t *f)
+{
+    static const char *ops[] = { "<=", ">=", "!=", "<", ">", "=" };
+    static const char *fields[] = { "id", "gpa", "fname", "lname" };
+
+    f->nterms = 0;
+    for (char *term = strtok(text, ","); term; term = strtok(NULL, ",")) {
+        if (f->nterms == FILTER_MAX_TERMS)
+            return ERR_DB_ARGS;
+        filter_term_t *t = &f->terms[f->nterms++];
+
+        size_t flen = strcspn(term, "<>=!");
+        size_t o;
+        for (o = 0; o < sizeof(ops) / sizeof(ops[0]); o++) {
+            if (strncmp(term + flen, ops[o], strlen(ops[o])) == 0)
+                break;
+        }
+        if (o == sizeof(ops) / sizeof(ops[0]))
+            return ERR_DB_ARGS;
+        strcpy(t->op, ops[o]);
+        char *value = term + flen + strlen(ops[o]);
+
+        t->field = 0;
+        for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+            if (strlen(fields[i]) == flen && strncmp(term, fields[i], flen) == 0)
+                t->field = fields[i][0];
+        }
+        if (!t->field || !*value)
+            return ERR_DB_ARGS;
+
+        if (t->field == 'f' || t->field == 'l') {
+            t->str = value;
+            continue;
+        }
+        char *end;
+        double v = strtod(value, &end);
+        if (*end)
+            return ERR_DB_ARGS;
+        t->num = (int)(t->field == 'g' && strchr(value, '.') ? v * 100 + 0.5 : v);
+    }
+    return f->nterms ? NO_ERROR : ERR_DB_ARGS;
+}
+
+//sdb_delete_where() predicate, true if a student matches every term
+static int filter_match(const student_t *s, void *arg)
+{
+    const filter_t *f = arg;
+
+    for (int i = 0; i < f->nterms; i++) {
+        const filter_term_t *t = &f->terms[i];
+        int cmp;
+        switch (t->field) {
+        case 'i':
+            cmp = (s->id > t->num) - (s->id < t->num);
+            break;
+        case 'g':
+            cmp = (s->gpa > t->num) - (s->gpa < t->num);
+            break;
+        case 'f':
+            cmp = strcmp(s->fname, t->str);
+            break;
+        default:
+            cmp = strcmp(s->lname, t->str);
+            break;
+        }
+
+        bool ok;
+        if (strcmp(t->op, "=") == 0)
+            ok = cmp == 0;
+        else if (strcmp(t->op, "!=") == 0)
+            ok = cmp != 0;
+        else if (strcmp(t->op, "<") == 0)
+            ok = cmp < 0;
+        else if (strcmp(t->op, "<=") == 0)
+            ok = cmp <= 0;
+        else if (strcmp(t->op, ">") == 0)
+            ok = cmp > 0;
+        else
+            ok = cmp >= 0;
+        if (!ok)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ *  delete_matching
+ *      db:      database handle
+ *      filter:  filter text, see parse_filter()
+ *      punch:   release the storage of pages that end up empty
+ *
+ *  Deletes every student that matches the filter in a single pass over
+ *  the database, see sdb_delete_where().
+ *
+ *  returns:  <number>       the number of students deleted
+ *            ERR_DB_ARGS    the filter is not valid
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_DB_DEL_MATCHES  on success
+ *            M_ERR_FILTER      the filter is not valid
+ *            M_ERR_DB_WRITE    error reading or writing the db file
+ */
+int delete_matching(sdb_t *db, char *filter, bool punch)
+{
+    filter_t f;
+    char text[FILTER_TEXT_MAX];
+
+    //parse a copy so the message can show the filter as given
+    if (strlen(filter) >= sizeof(text) ||
+        parse_filter(strcpy(text, filter), &f) != NO_ERROR) {
+        printf(M_ERR_FILTER, filter);
+        return ERR_DB_ARGS;
+    }
+
+    int rc = sdb_delete_where(db, filter_match, &f, punch);
+    if (rc < 0) {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    printf(M_DB_DEL_MATCHES, rc, filter);
+    return rc;
+}
+
+/*
+ *  search_students
+ *      db:     database handle
+ *      query:  part of a first or last name, possibly misspelled
+ *
+ *  Looks the query up in the trigram name index, which is built on first
+ *  use and kept current from then on, see sdb_search().  Students whose
+ *  names contain the query come first, then the closest fuzzy matches.
+ *
+ *  returns:  <number>       the number of students printed
+ *            ERR_DB_FILE    database or index file I/O issue
+ *
+ *  console:  a table of up to QUERY_MAX_RESULTS students and how much of
+ *            the query each matched
+ *            M_QUERY_NONE   nothing matched
+ *            M_ERR_DB_READ  error reading the database or its index
+ */
+int search_students(sdb_t *db, char *query)
+{
+    sdb_match_t matches[QUERY_MAX_RESULTS];
+    int n = sdb_search(db, query, matches, QUERY_MAX_RESULTS);
+
+    if (n < 0) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    if (n == 0) {
+        printf(M_QUERY_NONE, query);
+        return 0;
+    }
+
+    printf(QUERY_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA", "MATCH");
+    for (int i = 0; i < n; i++) {
+        student_t *s = &matches[i].student;
+        printf(QUERY_PRINT_FMT_STRING, s->id, s->fname, s->lname, s->gpa / 100.0,
+               matches[i].substring ? 100 : matches[i].score);
+    }
+    return n;
+}
+
+/*
+ *  print_gpa_range
+ *      db:  database handle
+ *      lo:  lowest GPA to print, as a 3 digit int
+ *      hi:  highest GPA to print, as a 3 digit int
+ *
+ *  Prints every student with a GPA from lo to hi, lowest GPA first and
+ *  then by id, straight from the GPA index, see sdb_gpa_range().
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_ARGS    lo or hi out of range, or lo above hi
+ *            ERR_DB_FILE    database or index file I/O issue
+ *
+ *  console:  <see print_db>   on success, print table
+ *            M_GPA_NONE       no student in the range
+ *            M_ERR_GPA_RNG    bad range
+ *            M_ERR_DB_READ    error reading the database or its index
+ */
+int print_gpa_range(sdb_t *db, int lo, int hi)
+{
+    bool header_printed = false;
+
+    int rc = sdb_gpa_range(db, lo, hi, print_db_row, &header_printed);
+    if (rc == ERR_DB_ARGS) {
+        printf(M_ERR_GPA_RNG, MIN_STD_GPA, MAX_STD_GPA);
+        return ERR_DB_ARGS;
+    }
+    if (rc != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    if (!header_printed)
+        printf(M_GPA_NONE, lo / 100.0, hi / 100.0);
+    return NO_ERROR;
+}
+
+/*
+ *  print_gpa_rank
+ *      db:  database handle
+ *      id:  the student to rank
+ *
+ *  Ranks a student by GPA among all students, highest GPA first, using
+ *  the GPA index, see sdb_gpa_rank().  Students with the same GPA share
+ *  a rank.
+ *
+ *  returns:  NO_ERROR        on success
+ *            SRCH_NOT_FOUND  student not in database
+ *            ERR_DB_FILE     database or index file I/O issue
+ *
+ *  console:  M_GPA_RANK         on success
+ *            M_STD_NOT_FND_MSG  student not in database
+ *            M_ERR_DB_READ      error reading the database or its index
+ */
+int print_gpa_rank(sdb_t *db, int id)
+{
+    int rank, total;
+
+    int rc = sdb_gpa_rank(db, id, &rank, &total);
+    if (rc == SRCH_NOT_FOUND || rc == ERR_DB_ARGS) {
+        printf(M_STD_NOT_FND_MSG, id);
+        return SRCH_NOT_FOUND;
+    }
+    if (rc != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    printf(M_GPA_RANK, id, rank, total);
+    return NO_ERROR;
+}
+
+//sdb_scrub() callback, reports one slot that failed verification
+static int report_bad_slot(int id, void *arg)
+{
+    (void)arg;
+    printf(M_DB_SCRUB_BAD, id);
+    return 0;
+}
+
+/*
+ *  scrub_db
+ *      db:        database handle
+ *      nthreads:  threads to verify with, 0 for one per CPU
+ *
+ *  Verifies every slot of the database against the CRC32C checksums the
+ *  library keeps next to it and lists the slots that do not match, which
+ *  catches bit rot and torn record writes.
+ *
+ *  returns:  <number>       the number of bad slots
+ *            ERR_DB_FILE    database or checksum file I/O issue
+ *
+ *  console:  M_DB_SCRUB_BAD   for every slot that failed
+ *            M_DB_SCRUB_OK    summary on completion
+ *            M_ERR_DB_READ    error reading the database
+ */
+int scrub_db(sdb_t *db, int nthreads)
+{
+    int checked = 0;
+    int bad = sdb_scrub(db, nthreads, &checked, report_bad_slot, NULL);
+
+    if (bad < 0) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    printf(M_DB_SCRUB_OK, checked, bad);
+    return bad;
+}
+
+/*
+ *  shard_db
+ *      db:       database handle
+ *      mode:     SDB_SHARD_HASH or SDB_SHARD_RANGE
+ *      nshards:  number of shard files
+ *      dirs:     directories to spread the shard files over, round robin
+ *      ndirs:    number of dirs, 0 keeps them next to the database
+ *
+ *  Moves every student into nshards new database files and turns the
+ *  database file into a manifest listing them, see sdb_shard().  From then
+ *  on lookups touch one shard and whole database commands run on all the
+ *  shards at once.
+ *
+ *  returns:  <number>       the number of students moved
+ *            ERR_DB_ARGS    nshards out of range
+ *            ERR_DB_OP      the database is already sharded
+ *            ERR_DB_FILE    database or shard file I/O issue
+ *
+ *  console:  M_DB_SHARDED      on success
+ *            M_ERR_SHARD_RNG   nshards out of range
+ *            M_DB_IS_SHARDED   the database is already sharded
+ *            M_ERR_DB_WRITE    error creating or writing a shard file
+ */
+int shard_db(sdb_t *db, int mode, int nshards, char **dirs, int ndirs)
+{
+    int rc = sdb_shard(db, mode, nshards, (const char *const *)dirs, ndirs);
+
+    switch (rc) {
+    case ERR_DB_ARGS:
+        printf(M_ERR_SHARD_RNG, SHARD_MAX);
+        return rc;
+    case ERR_DB_OP:
+        printf(M_DB_IS_SHARDED);
+        return rc;
+    case ERR_DB_FILE:
+        printf(M_ERR_DB_WRITE);
+        return rc;
+    default:
+        printf(M_DB_SHARDED, nshards, rc);
+        return rc;
+    }
+}
+
+/*
+ *  validate_range
+ *      id:  proposed student id
+ *      gpa: proposed gpa
+ *
+ *  This function validates that the id and gpa are in the allowable ranges
+ *  as per the specifications.  It checks if the values are within the
+ *  inclusive range using constents in db.h
+ *
+ *  returns:    NO_ERROR       on success, both ID and GPA are in range
+ *              EXIT_FAIL_ARGS if either ID or GPA is out of range
+ *
+ *  console:  This function does not produce any output
+ *
+ */
+int validate_range(int id, int gpa)
+{
+
+    if ((id < MIN_STD_ID) || (id > MAX_STD_ID))
+        return EXIT_FAIL_ARGS;
+
+    if ((gpa < MIN_STD_GPA) || (gpa > MAX_STD_GPA))
+        return EXIT_FAIL_ARGS;
+
+    return NO_ERROR;
+}
+
+/*
+ *  usage
+ *      exename:  the name of the executable from argv[0]
+ *
+ *  Prints this programs expected usage
+ *
+ *  returns:    nothing, this is a void function
+ *
+ *  console:  This function prints the usage information
+ *
+ */
+void usage(char *exename)
+{
+    printf("usage: %s -[h|a|c|d|D|e|f|g|i|I|k|m|p|q|r|x|z] options.  Where:\n", exename);
+    printf("\t-h:  prints help\n");
+    printf("\t-a id first_name last_name gpa(as 3 digit int):  adds a student\n");
+    printf("\t-c:  counts the records in the database\n");
+    printf("\t-d id:  deletes a student\n");
+    printf("\t-D filter [--punch]:  deletes every student matching a filter like gpa<200,lname=doe\n");
+    printf("\t-e file:  exports the database to a compact archive file\n");
+    printf("\t-f id:  finds and prints a student in the database\n");
+    printf("\t-g lo hi (as 3 digit ints):  prints students with a GPA from lo to hi\n");
+    printf("\t-i [-t] [script]:  runs add/find/del/count/print commands from script or stdin, -t times them\n");
+    printf("\t-I file.csv [threads]:  bulk loads id,first_name,last_name,gpa rows\n");
+    printf("\t-k id:  ranks a student by GPA among all students\n");
+    printf("\t-m:  migrates the database to the variable length version 2 format\n");
+    printf("\t-p [--order-by lname|gpa] [--mem KB]:  prints all records in the student database\n");
+    printf("\t-q text:  searches first and last names for text, close spellings match too\n");
+    printf("\t-r file:  restores (imports) students from an archive file\n");
+    printf("\t-x:  compress the database file [EXTRA CREDIT]\n");
+    printf("\t-z:  zero db file (remove all records)\n");
+    printf("\t--scrub [threads]:  verifies every record against its checksum\n");
+    printf("\t--shard hash|range N [dir...]:  splits the database into N shard files spread over dirs\n");
+    printf("\t--direct:  added to any option, full database scans bypass the page cache\n");
+    printf("\t--stats[=json]:  added to any option, reports I/O statistics on stderr (or SDB_STATS=1|json)\n");
+}
+
+/*
+ *  run_option
+ *      db:    database handle
+ *      opt:   option character, see usage()
+ *      argc:  argument count, laid out like main()
+ *      argv:  arguments, argv[0] is the program and argv[1] the option
+ *
+ *  Runs one database option against an open handle.  main() calls this
+ *  once per process, run_session() once per command.
+ *
+ *  returns:  the exit code for the shell, see EXIT_ codes in sdbsc.h
+ *
+ *  console:  whatever the option prints, usage on bad arguments
+ */
+int run_option(sdb_t *db, char opt, int argc, char *argv[])
+{
+    int rc;        // return code from various operations
+    int exit_code; // exit code to shell
+    int id;        // userid from argv[2]
+    int gpa;       // gpa from argv[5]
+    int order;     // sort order from --order-by
+    int mem_kb;    // sort memory budget from --mem
+
+    // space for a student structure which we will get back from
+    // some of the functions we will be writing such as get_student(),
+    // and print_student().
+    student_t student = {0};
+    double start = stats_mode != STATS_OFF ? now_ms() : 0;
+
+    // set rc to the return code of the operation to ensure the program
+    // use that to determine the proper exit_code.  Look at the header
+    // sdbsc.h for expected values.
+
+    exit_code = EXIT_OK;
+    switch (opt)
+    {
+    case 'a':
+        //   arv[0] arv[1]  arv[2]      arv[3]    arv[4]  arv[5]
+        // prog_name     -a      id  first_name last_name     gpa
+        //-------------------------------------------------------
+        // example:  prog_name -a 1 John Doe 341
+        if (argc != 6)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
         }
 
         // convert id and gpa to ints from argv.  For this assignment assume
@@ -663,7 +1002,7 @@ int main(int argc, char *argv[])
             break;
         }
 
-        rc = add_student(fd, id, argv[3], argv[4], gpa);
+        rc = add_student(db, id, argv[3], argv[4], gpa);
         if (rc < 0)
             exit_code = EXIT_FAIL_DB;
 
@@ -674,7 +1013,7 @@ int main(int argc, char *argv[])
         // prog_name     -c
         //-----------------
         // example:  prog_name -c
-        rc = count_db_records(fd);
+        rc = count_db_records(db);
         if (rc < 0)
             exit_code = EXIT_FAIL_DB;
         break;
@@ -691,12 +1030,66 @@ int main(int argc, char *argv[])
             break;
         }
         id = atoi(argv[2]);
-        rc = del_student(fd, id);
+        rc = del_student(db, id);
         if (rc < 0)
             exit_code = EXIT_FAIL_DB;
 
         break;
 
+    case 'D':
+        //    arv[0] arv[1]  arv[2]    [arv[3]]
+        // prog_name     -D  filter   [--punch]
+        //--------------------------------------
+        // example:  prog_name -D gpa<200 --punch
+        if ((argc != 3 && argc != 4) || (argc == 4 && strcmp(argv[3], "--punch") != 0))
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = delete_matching(db, argv[2], argc == 4);
+        if (rc == ERR_DB_ARGS)
+            exit_code = EXIT_FAIL_ARGS;
+        else if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'e':
+    case 'r':
+        //    arv[0] arv[1]  arv[2]
+        // prog_name  -e|-r    file
+        //-------------------------
+        // example:  prog_name -e students.sdba
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        if (opt == 'e')
+            rc = export_db(db, argv[2]);
+        else
+            rc = import_db(db, argv[2]);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'I':
+        //    arv[0] arv[1]    arv[2]   [arv[3]]
+        // prog_name     -I  file.csv  [threads]
+        //--------------------------------------
+        // example:  prog_name -I students.csv 4
+        if (argc != 3 && argc != 4)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = import_csv(db, argv[2], argc == 4 ? atoi(argv[3]) : 0);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
     case 'f':
         //    arv[0] arv[1]  arv[2]
         // prog_name     -f      id
@@ -709,7 +1102,7 @@ int main(int argc, char *argv[])
             break;
         }
         id = atoi(argv[2]);
-        rc = get_student(fd, id, &student);
+        rc = get_student(db, id, &student);
 
         switch (rc)
         {
@@ -727,12 +1120,84 @@ int main(int argc, char *argv[])
         }
         break;
 
+    case 'g':
+        //    arv[0] arv[1]  arv[2]  arv[3]
+        // prog_name     -g      lo      hi
+        //---------------------------------
+        // example:  prog_name -g 350 400
+        if (argc != 4)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = print_gpa_range(db, atoi(argv[2]), atoi(argv[3]));
+        if (rc == ERR_DB_ARGS)
+            exit_code = EXIT_FAIL_ARGS;
+        else if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'k':
+        //    arv[0] arv[1]  arv[2]
+        // prog_name     -k      id
+        //-------------------------
+        // example:  prog_name -k 100
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = print_gpa_rank(db, atoi(argv[2]));
+        if (rc != NO_ERROR)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
     case 'p':
-        //    arv[0] arv[1]
-        // prog_name     -p
-        //-----------------
-        // example:  prog_name -p
-        rc = print_db(fd);
+        //    arv[0] arv[1]  [arv[2]     arv[3]]    [arv[4]  arv[5]]
+        // prog_name     -p  [--order-by lname|gpa] [--mem       KB]
+        //----------------------------------------------------------
+        // example:  prog_name -p --order-by gpa --mem 1024
+        order = SDB_ORDER_ID;
+        mem_kb = 0;
+        for (int arg = 2; arg < argc; arg += 2)
+        {
+            if (arg + 1 < argc && strcmp(argv[arg], "--order-by") == 0 &&
+                strcmp(argv[arg + 1], "lname") == 0)
+                order = SDB_ORDER_LNAME;
+            else if (arg + 1 < argc && strcmp(argv[arg], "--order-by") == 0 &&
+                     strcmp(argv[arg + 1], "gpa") == 0)
+                order = SDB_ORDER_GPA;
+            else if (arg + 1 < argc && strcmp(argv[arg], "--mem") == 0 &&
+                     atoi(argv[arg + 1]) > 0)
+                mem_kb = atoi(argv[arg + 1]);
+            else
+                order = -1;
+        }
+        if (order == -1)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = print_db_sorted(db, order, (size_t)mem_kb * 1024);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'q':
+        //    arv[0] arv[1]  arv[2]
+        // prog_name     -q    text
+        //-------------------------
+        // example:  prog_name -q smth
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = search_students(db, argv[2]);
         if (rc < 0)
             exit_code = EXIT_FAIL_DB;
         break;
@@ -743,10 +1208,57 @@ int main(int argc, char *argv[])
         //-----------------
         // example:  prog_name -x
 
-        // remember compress_db returns a fd of the compressed database.
+        // the handle refers to the compressed database afterwards,
         // we close it after this switch statement
-        fd = compress_db(fd);
-        if (fd < 0)
+        rc = compress_db(db);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'm':
+        //    arv[0] arv[1]
+        // prog_name     -m
+        //-----------------
+        // example:  prog_name -m
+
+        // like compress_db, the handle refers to the new file afterwards
+        rc = migrate_db(db);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'S':
+        //    arv[0]  arv[1]   [arv[2]]
+        // prog_name --scrub  [threads]
+        //-----------------------------
+        // example:  prog_name --scrub 4
+        if (argc > 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = scrub_db(db, argc == 3 ? atoi(argv[2]) : 0);
+        if (rc != 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'H':
+        //    arv[0]  arv[1]      arv[2]  arv[3]    [arv[4]...]
+        // prog_name --shard  hash|range       N    [dir...]
+        //---------------------------------------------------
+        // example:  prog_name --shard hash 4 /mnt/a /mnt/b
+        if (argc < 4 || (strcmp(argv[2], "hash") != 0 && strcmp(argv[2], "range") != 0))
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = shard_db(db, strcmp(argv[2], "hash") == 0 ? SDB_SHARD_HASH : SDB_SHARD_RANGE,
+                      atoi(argv[3]), argv + 4, argc - 4);
+        if (rc == ERR_DB_ARGS)
+            exit_code = EXIT_FAIL_ARGS;
+        else if (rc < 0)
             exit_code = EXIT_FAIL_DB;
         break;
 
@@ -755,12 +1267,10 @@ int main(int argc, char *argv[])
         // prog_name     -x
         //-----------------
         // example:  prog_name -x
-        // HINT:  close the db file, we already have fd
-        //       and reopen db indicating truncate=true
-        close(fd);
-        fd = open_db(DB_FILE, true);
-        if (fd < 0)
+        // a version 2 database stays version 2 once emptied
+        if (sdb_zero(db) != NO_ERROR)
         {
+            printf(M_ERR_DB_WRITE);
             exit_code = EXIT_FAIL_DB;
             break;
         }
@@ -772,8 +1282,276 @@ int main(int argc, char *argv[])
         exit_code = EXIT_FAIL_ARGS;
     }
 
+    phase_add(option_phase(opt), start);
+    return exit_code;
+}
+
+//session commands and the option each one runs, nargs counts the command
+static const struct {
+    const char *name;
+    char opt;
+    int nargs;
+} session_cmds[] = {
+    { "add",   'a', 5 },
+    { "find",  'f', 2 },
+    { "del",   'd', 2 },
+    { "count", 'c', 1 },
+    { "print", 'p', 1 },
+};
+
+/*
+ *  run_session
+ *      db:      database handle
+ *      in:      script file or stdin
+ *      timing:  print a timing trailer after every command
+ *      exename: the name of the executable from argv[0]
+ *
+ *  Reads one command per line and runs it against the already open
+ *  database, so a script of many commands pays for one open and one
+ *  exit instead of one per command.  Commands are the long forms of the
+ *  options they run:
+ *
+ *      add id first_name last_name gpa
+ *      find id
+ *      del id
+ *      count
+ *      print
+ *      quit
+ *
+ *  Blank lines and lines starting with # are skipped.  Output is fully
+ *  buffered unless the session is interactive, in which case a prompt is
+ *  shown and output is flushed after every command.
+ *
+ *  returns:  EXIT_OK if every command succeeded, otherwise the exit code
+ *            of the last command that failed
+ *
+ *  console:  the output of every command
+ *            M_SESSION_TIME     after every command when timing is on
+ *            M_ERR_SESSION_CMD  unknown command or wrong argument count
+ */
+int run_session(sdb_t *db, FILE *in, bool timing, char *exename)
+{
+    char line[SESSION_LINE_MAX];
+    char *args[SESSION_MAX_ARGS + 1];
+    int exit_code = EXIT_OK;
+    int lineno = 0;
+    bool interactive = isatty(fileno(in)) && isatty(STDOUT_FILENO);
+
+    if (!interactive)
+        setvbuf(stdout, NULL, _IOFBF, SESSION_OUT_BUF);
+
+    for (;;) {
+        if (interactive) {
+            printf(M_SESSION_PROMPT);
+            fflush(stdout);
+        }
+        if (!fgets(line, sizeof(line), in))
+            break;
+        lineno++;
+
+        //args is laid out like main()'s argv so run_option() can use it
+        int nargs = 2;
+        args[0] = exename;
+        char *cmd = strtok(line, " \t\r\n");
+        if (!cmd || *cmd == '#')
+            continue;
+        if (strcmp(cmd, "quit") == 0)
+            break;
+        char *tok;
+        while (nargs < SESSION_MAX_ARGS && (tok = strtok(NULL, " \t\r\n")))
+            args[nargs++] = tok;
+        args[nargs] = NULL;
+
+        size_t c;
+        for (c = 0; c < sizeof(session_cmds) / sizeof(session_cmds[0]); c++) {
+            if (strcmp(cmd, session_cmds[c].name) == 0)
+                break;
+        }
+        if (c == sizeof(session_cmds) / sizeof(session_cmds[0]) ||
+            nargs - 1 != session_cmds[c].nargs) {
+            printf(M_ERR_SESSION_CMD, lineno, cmd);
+            exit_code = EXIT_FAIL_ARGS;
+            continue;
+        }
+        args[1] = cmd;
+
+        double start = timing ? now_ms() : 0;
+        int rc = run_option(db, session_cmds[c].opt, nargs, args);
+        if (rc != EXIT_OK)
+            exit_code = rc;
+        if (timing)
+            printf(M_SESSION_TIME, cmd, now_ms() - start);
+        if (interactive)
+            fflush(stdout);
+    }
+
+    fflush(stdout);
+    return exit_code;
+}
+
+/*
+ *  print_stats
+ *      mode:  STATS_TEXT or STATS_JSON
+ *
+ *  Reports the phase timings and the library I/O statistics of the whole
+ *  run.  The report goes to stderr so it never mixes with the output of
+ *  the options.
+ *
+ *  returns:  nothing, this is a void function
+ *
+ *  console:  M_STATS_ lines, or one JSON object, on stderr
+ */
+void print_stats(int mode)
+{
+    sdb_stats_t st;
+    sdb_stats_get(&st);
+
+    const char *names[] = { "bytes_read", "bytes_written", "records_scanned",
+                            "records_live", "holes_skipped" };
+    unsigned long long counts[] = { st.bytes_read, st.bytes_written, st.records_scanned,
+                                    st.records_live, st.holes_skipped };
+    int ncounts = sizeof(counts) / sizeof(counts[0]);
+
+    if (mode == STATS_JSON)
+    {
+        fprintf(stderr, "{\"phases\":{");
+        for (int p = 0; p < PHASES; p++)
+            fprintf(stderr, "%s\"%s\":{\"calls\":%d,\"ms\":%.3f}", p ? "," : "",
+                    phase_names[p], phase_calls[p], phase_ms[p]);
+        fprintf(stderr, "},\"syscalls\":{");
+        for (int k = 0; k < SDB_IO_KINDS; k++)
+            fprintf(stderr, "%s\"%s\":%llu", k ? "," : "", sdb_io_name(k), st.calls[k]);
+        fprintf(stderr, "}");
+        for (int c = 0; c < ncounts; c++)
+            fprintf(stderr, ",\"%s\":%llu", names[c], counts[c]);
+        fprintf(stderr, "}\n");
+        return;
+    }
+
+    fprintf(stderr, M_STATS_HDR);
+    for (int p = 0; p < PHASES; p++)
+        fprintf(stderr, M_STATS_PHASE, phase_names[p], phase_calls[p], phase_ms[p]);
+    for (int k = 0; k < SDB_IO_KINDS; k++)
+    {
+        if (st.calls[k])
+            fprintf(stderr, M_STATS_CALLS, sdb_io_name(k), st.calls[k]);
+    }
+    for (int c = 0; c < ncounts; c++)
+        fprintf(stderr, M_STATS_COUNT, names[c], counts[c]);
+}
+
+// Welcome to main()
+int main(int argc, char *argv[])
+{
+    char opt;      // user selected option
+    sdb_t *db;     // handle of the open database
+    int exit_code; // exit code to shell
+    bool direct;   // --direct given
+
+    // SDB_STATS=1 or SDB_STATS=json turns the statistics report on
+    const char *env = getenv("SDB_STATS");
+    if (env && *env && strcmp(env, "0") != 0)
+        stats_mode = strcmp(env, "json") == 0 ? STATS_JSON : STATS_TEXT;
+
+    // --direct and --stats[=json] can go anywhere on the command line, they
+    // change how every option runs rather than being options themselves
+    direct = false;
+    for (int arg = 1; arg < argc; arg++)
+    {
+        if (strcmp(argv[arg], "--direct") == 0)
+            direct = true;
+        else if (strcmp(argv[arg], "--stats") == 0)
+            stats_mode = STATS_TEXT;
+        else if (strcmp(argv[arg], "--stats=json") == 0)
+            stats_mode = STATS_JSON;
+        else
+            continue;
+        memmove(&argv[arg], &argv[arg + 1], (argc - arg) * sizeof(char *));
+        argc--;
+        arg--;
+    }
+    if (stats_mode != STATS_OFF)
+        sdb_stats_enable(true);
+
+    // This function must have at least one arg, and the arg must start
+    // with a dash
+    if ((argc < 2) || (*argv[1] != '-'))
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    // The option is the first character after the dash for example
+    //-h -a -c -d -f -p -x -z
+    opt = (char)*(argv[1] + 1); // get the option flag
+
+    // long options are mapped onto an option character of their own
+    if (strcmp(argv[1], "--scrub") == 0)
+        opt = 'S';
+    else if (strcmp(argv[1], "--shard") == 0)
+        opt = 'H';
+
+    // handle the help flag and then exit normally
+    if (opt == 'h')
+    {
+        usage(argv[0]);
+        exit(EXIT_OK);
+    }
+
+    // now lets open the file and continue if there is no error
+    // note we are not truncating the file using the second
+    // parameter
+    double start = stats_mode != STATS_OFF ? now_ms() : 0;
+    db = open_db(DB_FILE, false);
+    phase_add(PHASE_OPEN, start);
+    if (!db)
+    {
+        exit(EXIT_FAIL_DB);
+    }
+
+    // without O_DIRECT support the library falls back on its own
+    if (direct)
+        sdb_set_direct(db, true);
+
+    if (opt == 'i')
+    {
+        //    arv[0] arv[1]  [arv[2]]  [arv[3]]
+        // prog_name     -i      [-t]  [script]
+        //--------------------------------------
+        // example:  prog_name -i -t commands.txt
+        int arg = 2;
+        bool timing = arg < argc && strcmp(argv[arg], "-t") == 0;
+        if (timing)
+            arg++;
+        FILE *in = stdin;
+        if (argc > arg + 1)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+        }
+        else if (arg < argc && !(in = fopen(argv[arg], "r")))
+        {
+            printf(M_ERR_SESSION_OPEN, argv[arg]);
+            exit_code = EXIT_FAIL_ARGS;
+        }
+        else
+        {
+            exit_code = run_session(db, in, timing, argv[0]);
+            if (in != stdin)
+                fclose(in);
+        }
+    }
+    else
+    {
+        exit_code = run_option(db, opt, argc, argv);
+    }
+
     // dont forget to close the file before exiting, and setting the
     // proper exit code - see the header file for expected values
-    close(fd);
+    start = stats_mode != STATS_OFF ? now_ms() : 0;
+    sdb_close(db);
+    phase_add(PHASE_CLOSE, start);
+    if (stats_mode != STATS_OFF)
+        print_stats(stats_mode);
     exit(exit_code);
 }
\ No newline at end of file
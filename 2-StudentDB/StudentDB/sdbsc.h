@@ -1,31 +1,64 @@
 #ifndef __SDB_H__
 
+#include <stdio.h>
+
 #include "db.h" //get student record type
+#include "sdb.h" //libsdb, also defines the error codes below
 
 //prototypes for functions go below for this assignment
-int open_db(char *dbFile, bool should_truncate);
-int add_student(int fd, int id, char *fname, char *lname, int gpa);
-int get_student(int fd, int id, student_t *s);
-int del_student(int fd, int id);
-int compress_db(int fd);
+sdb_t *open_db(char *dbFile, bool should_truncate);
+int add_student(sdb_t *db, int id, char *fname, char *lname, int gpa);
+int get_student(sdb_t *db, int id, student_t *s);
+int del_student(sdb_t *db, int id);
+int compress_db(sdb_t *db);
+int migrate_db(sdb_t *db);
 void print_student(student_t *s);
 int validate_range(int id, int gpa);
-int count_db_records(int fd);
-int print_db(int fd);
+int count_db_records(sdb_t *db);
+int print_db(sdb_t *db);
+int print_db_sorted(sdb_t *db, int order, size_t mem_budget);
+int export_db(sdb_t *db, char *arcFile);
+int import_db(sdb_t *db, char *arcFile);
+int import_csv(sdb_t *db, char *csvFile, int nthreads);
+int delete_matching(sdb_t *db, char *filter, bool punch);
+int search_students(sdb_t *db, char *query);
+int print_gpa_range(sdb_t *db, int lo, int hi);
+int print_gpa_rank(sdb_t *db, int id);
+int scrub_db(sdb_t *db, int nthreads);
+int shard_db(sdb_t *db, int mode, int nshards, char **dirs, int ndirs);
+int run_option(sdb_t *db, char opt, int argc, char *argv[]);
+int run_session(sdb_t *db, FILE *in, bool timing, char *exename);
+void print_stats(int mode);
 void usage(char *);
 
-//error codes to be returned from individual functions
-// NO_ERROR is returned if there are no errors
-// ERR_DB_FILE is returned if there is are any issues with the database file itself
-// ERR_DB_OP is returned if an operation did not work aka add or delete a student
-// SRCH_NOT_FOUND is returned if the student is not found (get_student, and del_student)
-#define NO_ERROR        0
-#define ERR_DB_FILE     -1
-#define ERR_DB_OP       -2
-#define SRCH_NOT_FOUND  -3
+//error codes returned from individual functions are defined in sdb.h:
+// NO_ERROR, ERR_DB_FILE, ERR_DB_OP and SRCH_NOT_FOUND
 #define NOT_IMPLEMENTED_YET 0
 
 
+//session mode (-i) limits
+#define SESSION_LINE_MAX    512         //longest command line
+#define SESSION_MAX_ARGS    8           //words per command, including argv[0]
+#define SESSION_OUT_BUF     65536       //stdout buffer for scripted sessions
+
+//-D filter limits
+#define FILTER_MAX_TERMS    8           //comma separated terms
+#define FILTER_TEXT_MAX     256         //longest filter
+
+//--stats / SDB_STATS report modes and the phases it times
+#define STATS_OFF           0
+#define STATS_TEXT          1
+#define STATS_JSON          2
+#define PHASE_OPEN          0
+#define PHASE_LOOKUP        1
+#define PHASE_SCAN          2
+#define PHASE_WRITE         3
+#define PHASE_CLOSE         4
+#define PHASES              5
+
+//-q prints at most this many students
+#define QUERY_MAX_RESULTS   20
+
 //error codes to be returned to the shell
 // EXIT_OK          program executed without error
 // EXIT_FAIL_DB     a database operation failed
@@ -53,6 +86,36 @@ void usage(char *);
 #define M_DB_EMPTY        "Database contains no student records.\n"
 #define M_DB_RECORD_CNT   "Database contains %d student record(s).\n"
 #define M_NOT_IMPL        "The requested operation is not implemented yet!\n"
+#define M_ERR_ARC_OPEN    "Error opening archive file, exiting!\n"
+#define M_ERR_ARC_READ    "Error reading archive file, exiting!\n"
+#define M_ERR_ARC_WRITE   "Error writing archive file, exiting!\n"
+#define M_ERR_ARC_FORMAT  "Archive file is corrupt or not a student archive!\n"
+#define M_DB_MIGRATED     "Database migrated to version 2, %d student record(s) converted.\n"
+#define M_DB_IS_V2        "Database is already version 2.\n"
+#define M_DB_SCRUB_BAD    "Student slot %d failed its checksum.\n"
+#define M_DB_SCRUB_OK     "Scrub checked %d student record(s), %d bad.\n"
+#define M_DB_EXPORTED     "Exported %d student record(s) to %s.\n"
+#define M_DB_IMPORTED     "Imported %d student record(s) from %s.\n"
+#define M_ERR_CSV_OPEN    "Error opening CSV file, exiting!\n"
+#define M_ERR_CSV_ROW     "Line %d: not a valid student row.\n"
+#define M_ERR_CSV_DUP     "Line %d: cant add student with ID=%d, already exists in db.\n"
+#define M_DB_DEL_MATCHES  "Deleted %d student record(s) matching %s.\n"
+#define M_ERR_FILTER      "Invalid filter: %s\n"
+#define M_QUERY_NONE      "No students match %s.\n"
+#define M_GPA_NONE        "No students have a GPA from %.2f to %.2f.\n"
+#define M_ERR_GPA_RNG     "Invalid GPA range, use two 3 digit ints from %d to %d, low first.\n"
+#define M_GPA_RANK        "Student %d ranks %d of %d by GPA.\n"
+#define M_DB_SHARDED      "Database split into %d shard(s), %d student record(s) moved.\n"
+#define M_DB_IS_SHARDED   "Database is already sharded.\n"
+#define M_ERR_SHARD_RNG   "Cant shard database, the number of shards must be 1 to %d.\n"
+#define M_STATS_HDR       "-- sdb stats --\n"
+#define M_STATS_PHASE     "%-16s %12d calls %12.3f ms\n"
+#define M_STATS_CALLS     "%-16s %12llu calls\n"
+#define M_STATS_COUNT     "%-16s %12llu\n"
+#define M_SESSION_PROMPT  "sdb> "
+#define M_SESSION_TIME    "# %s took %.3f ms\n"
+#define M_ERR_SESSION_CMD "Line %d: unknown command or wrong arguments: %s\n"
+#define M_ERR_SESSION_OPEN "Error opening script file %s, exiting!\n"
 
 //useful format strings for print students
 //For example to print the header in the required output:
@@ -61,4 +124,8 @@ void usage(char *);
 #define  STUDENT_PRINT_HDR_STRING   "%-6s %-24s %-32s %-3s\n"
 #define  STUDENT_PRINT_FMT_STRING   "%-6d %-24.24s %-32.32s %-3.2f\n"
 
+//-q results add how much of the query each student matched
+#define  QUERY_PRINT_HDR_STRING     "%-6s %-24s %-32s %-4s %5s\n"
+#define  QUERY_PRINT_FMT_STRING     "%-6d %-24.24s %-32.32s %-4.2f %4d%%\n"
+
 #endif
\ No newline at end of file
@@ -0,0 +1,710 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// database include files
+#include "db.h"
+#include "sdbint.h"
+
+/*
+ *  Sharded databases
+ *
+ *  A sharded handle holds an ordinary handle per shard file listed in its
+ *  manifest (see SHARD_ in db.h).  Operations on one id are routed to the
+ *  shard that owns it.  Whole database operations fan out with one thread
+ *  per shard, so shards on separate devices are read at the same time, and
+ *  their results are merged.  Scans keep their id order: every shard is
+ *  scanned by its own thread into a few buffered batches and the calling
+ *  thread merges the heads of those batches by id.
+ *
+ *  Hash placement spreads any id pattern evenly over the shards.  Range
+ *  placement keeps neighbouring ids together, so version 1 shard files stay
+ *  dense and batches of consecutive ids still turn into single writes.
+ */
+#define FEED_DEPTH      4           //batches buffered ahead per shard scan
+#define SHARD_COPY      4096        //students moved per batch by sdb_shard()
+
+//one shard's part of a fanned out call
+typedef struct fan_job {
+    sdb_t *shard;
+    int idx;
+    shard_fn fn;
+    void *arg;
+    int rc;
+} fan_job_t;
+
+//a shard scan running ahead of the merge in shard_scan()
+typedef struct shard_feed {
+    sdb_t *shard;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;            //count, done or stop changed
+    student_t batch[FEED_DEPTH][SCAN_BATCH];
+    int len[FEED_DEPTH];
+    int head;                       //batch the merge reads from
+    int pos;                        //merge: next student in batch[head]
+    int count;                      //filled batches
+    bool done;                      //the scan ended, rc is valid
+    bool stop;                      //the merge needs no more
+    int rc;
+} shard_feed_t;
+
+//a shard's share of a shard_add_batch() call
+typedef struct add_part {
+    student_t *students;
+    int *results;
+    int n;
+} add_part_t;
+
+//a shard's share of a shard_scrub() call
+typedef struct scrub_part {
+    int nthreads;
+    int checked;
+    int *bad;
+    int nbad;
+    int cap;
+} scrub_part_t;
+
+//students buffered by sdb_shard() on their way to the new shards
+typedef struct shard_copy {
+    sdb_t *dst;
+    student_t *buf;
+    int n;
+    int moved;
+} shard_copy_t;
+
+//Fibonacci hash of the id scaled onto [0, nshards).  Existing manifests
+//depend on this mapping, it must never change.
+static int shard_hash(int id, int nshards)
+{
+    uint32_t h = (uint32_t)id * 2654435761u;
+    return (int)(((uint64_t)h * nshards) >> 32);
+}
+
+static int shard_index(sdb_t *db, int id)
+{
+    if (db->shard_mode == SDB_SHARD_HASH)
+        return shard_hash(id, db->nshards);
+
+    int i = db->nshards - 1;
+    while (i > 0 && id < db->shard_first[i])
+        i--;
+    return i;
+}
+
+//returns the handle that owns id, db itself when it is not sharded
+sdb_t *shard_for(sdb_t *db, int id)
+{
+    if (db->nshards == 0)
+        return db;
+    return db->shards[shard_index(db, id)];
+}
+
+//strips leading and trailing blanks in place
+static char *trim_line(char *line)
+{
+    while (*line == ' ' || *line == '\t')
+        line++;
+    size_t len = strlen(line);
+    while (len > 0 && (line[len - 1] == ' ' || line[len - 1] == '\t' || line[len - 1] == '\r'))
+        line[--len] = '\0';
+    return line;
+}
+
+//parses one shard line and opens the shard it names
+static int open_shard_line(sdb_t *db, char *line, int idx, bool should_truncate)
+{
+    char path[PATH_MAX];
+
+    if (db->shard_mode == SDB_SHARD_RANGE) {
+        char *end;
+        long first = strtol(line, &end, 10);
+        if (end == line || first < MIN_STD_ID || first > MAX_STD_ID ||
+            (idx == 0 && first != MIN_STD_ID) ||
+            (idx > 0 && first <= db->shard_first[idx - 1]))
+            return ERR_DB_FILE;
+        db->shard_first[idx] = (int)first;
+        line = trim_line(end);
+    }
+    if (*line == '\0')
+        return ERR_DB_FILE;
+
+    //relative shard paths start from the manifest's directory
+    const char *slash = strrchr(db->path, '/');
+    int dir_len = *line != '/' && slash ? (int)(slash - db->path + 1) : 0;
+    if (snprintf(path, sizeof(path), "%.*s%s", dir_len, db->path, line) >= (int)sizeof(path))
+        return ERR_DB_FILE;
+
+    sdb_t *shard;
+    if (sdb_open(path, should_truncate, &shard) != NO_ERROR)
+        return ERR_DB_FILE;
+    db->shards[idx] = shard;
+    //a manifest can not list another manifest
+    return shard->nshards ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  shard_open
+ *      db:               handle whose file is open in db->fd
+ *      should_truncate:  empty every shard as it is opened
+ *
+ *  Checks whether the database file is a shard manifest and if so opens
+ *  every shard it lists.  The manifest itself is never truncated.
+ *
+ *  returns:  1              db is now a sharded handle
+ *            0              the file is not a manifest
+ *            ERR_DB_FILE    the manifest is not valid or a shard could not
+ *                           be opened
+ */
+int shard_open(sdb_t *db, bool should_truncate)
+{
+    char magic[4];
+    char mode[16];
+    struct stat st;
+    int version;
+    int rc = ERR_DB_FILE;
+
+    if (io_pread(db->fd, magic, sizeof(magic), 0) != sizeof(magic) ||
+        memcmp(magic, SHARD_MAGIC, sizeof(magic)) != 0)
+        return 0;
+    if (io_fstat(db->fd, &st) == -1 || st.st_size > (off_t)(SHARD_MAX + 1) * SHARD_LINE_MAX)
+        return ERR_DB_FILE;
+
+    char *text = malloc(st.st_size + 1);
+    db->shards = calloc(SHARD_MAX, sizeof(sdb_t *));
+    db->shard_first = calloc(SHARD_MAX, sizeof(int));
+    if (!text || !db->shards || !db->shard_first ||
+        io_pread(db->fd, text, st.st_size, 0) != st.st_size)
+        goto done;
+    text[st.st_size] = '\0';
+
+    bool have_header = false;
+    char *save;
+    for (char *line = strtok_r(text, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        line = trim_line(line);
+        if (*line == '\0' || *line == '#')
+            continue;
+
+        if (!have_header) {
+            if (sscanf(line, "SDBS %d %15s", &version, mode) != 2 || version != SHARD_VERSION)
+                goto done;
+            if (strcmp(mode, "hash") == 0)
+                db->shard_mode = SDB_SHARD_HASH;
+            else if (strcmp(mode, "range") == 0)
+                db->shard_mode = SDB_SHARD_RANGE;
+            else
+                goto done;
+            have_header = true;
+            continue;
+        }
+
+        if (db->nshards == SHARD_MAX)
+            goto done;
+        //counted first so shard_close() sees a shard that failed its check
+        int idx = db->nshards++;
+        if (open_shard_line(db, line, idx, should_truncate) != NO_ERROR)
+            goto done;
+        if (db->shards[idx]->version > db->version)
+            db->version = db->shards[idx]->version;
+    }
+    if (db->nshards > 0)
+        rc = 1;
+
+done:
+    free(text);
+    if (rc != 1)
+        shard_close(db);
+    return rc;
+}
+
+//closes every shard of a sharded handle
+void shard_close(sdb_t *db)
+{
+    for (int i = 0; i < db->nshards; i++)
+        sdb_close(db->shards[i]);
+    free(db->shards);
+    free(db->shard_first);
+    db->shards = NULL;
+    db->shard_first = NULL;
+    db->nshards = 0;
+}
+
+static void *fan_worker(void *arg)
+{
+    fan_job_t *job = arg;
+
+    job->rc = job->fn(job->shard, job->idx, job->arg);
+    return NULL;
+}
+
+/*
+ *  shard_fan_out
+ *      db:       sharded handle
+ *      fn:       called once per shard, each call on its own thread
+ *      arg:      passed through to fn
+ *      results:  optional, receives what fn returned for every shard
+ *
+ *  The calling thread runs the first shard itself, and any shard that
+ *  does not get a thread of its own.
+ *
+ *  returns:  <number>       the sum of what fn returned for every shard
+ *            <error>        the first negative value fn returned
+ */
+int shard_fan_out(sdb_t *db, shard_fn fn, void *arg, int *results)
+{
+    fan_job_t jobs[SHARD_MAX];
+    pthread_t tids[SHARD_MAX];
+    bool started[SHARD_MAX] = {false};
+    int sum = 0;
+
+    for (int i = 0; i < db->nshards; i++) {
+        jobs[i] = (fan_job_t){ .shard = db->shards[i], .idx = i, .fn = fn, .arg = arg };
+        if (i > 0)
+            started[i] = pthread_create(&tids[i], NULL, fan_worker, &jobs[i]) == 0;
+    }
+    for (int i = 0; i < db->nshards; i++) {
+        if (!started[i])
+            fan_worker(&jobs[i]);
+    }
+    for (int i = 0; i < db->nshards; i++) {
+        if (started[i])
+            pthread_join(tids[i], NULL);
+    }
+
+    for (int i = 0; i < db->nshards; i++) {
+        if (results)
+            results[i] = jobs[i].rc;
+        if (jobs[i].rc < 0 && sum >= 0)
+            sum = jobs[i].rc;
+        else if (sum >= 0)
+            sum += jobs[i].rc;
+    }
+    return sum;
+}
+
+//scans one shard into its feed until the scan ends or the merge stops it
+static void *feed_worker(void *arg)
+{
+    shard_feed_t *f = arg;
+    int tail = 0;
+    int more = 1;
+
+    db_scan_t *sc = scan_open(f->shard);
+    if (!sc)
+        more = ERR_DB_FILE;
+
+    while (more == 1) {
+        pthread_mutex_lock(&f->lock);
+        while (f->count == FEED_DEPTH && !f->stop)
+            pthread_cond_wait(&f->cond, &f->lock);
+        bool stop = f->stop;
+        pthread_mutex_unlock(&f->lock);
+        if (stop)
+            break;
+
+        //batch[tail] is not visible to the merge until count says so
+        int n = 0;
+        while (n < SCAN_BATCH && (more = scan_next(sc, &f->batch[tail][n])) == 1)
+            n++;
+        if (n == 0)
+            break;
+
+        pthread_mutex_lock(&f->lock);
+        f->len[tail] = n;
+        f->count++;
+        pthread_cond_signal(&f->cond);
+        pthread_mutex_unlock(&f->lock);
+        tail = (tail + 1) % FEED_DEPTH;
+    }
+    if (sc)
+        scan_close(sc);
+
+    pthread_mutex_lock(&f->lock);
+    f->rc = more < 0 ? ERR_DB_FILE : NO_ERROR;
+    f->done = true;
+    pthread_cond_signal(&f->cond);
+    pthread_mutex_unlock(&f->lock);
+    return NULL;
+}
+
+//the next student of a feed, NULL once its scan has ended
+static const student_t *feed_head(shard_feed_t *f)
+{
+    pthread_mutex_lock(&f->lock);
+    while (f->count == 0 && !f->done)
+        pthread_cond_wait(&f->cond, &f->lock);
+    bool empty = f->count == 0;
+    pthread_mutex_unlock(&f->lock);
+
+    return empty ? NULL : &f->batch[f->head][f->pos];
+}
+
+//moves past the current student, handing a used up batch back
+static void feed_advance(shard_feed_t *f)
+{
+    if (++f->pos < f->len[f->head])
+        return;
+
+    pthread_mutex_lock(&f->lock);
+    f->head = (f->head + 1) % FEED_DEPTH;
+    f->pos = 0;
+    f->count--;
+    pthread_cond_signal(&f->cond);
+    pthread_mutex_unlock(&f->lock);
+}
+
+/*
+ *  shard_scan
+ *      db:   sharded handle
+ *      fn:   called with every live student in id order
+ *      arg:  passed through to fn
+ *
+ *  sdb_scan() of a sharded database.  fn is only ever called on the
+ *  calling thread.
+ *
+ *  returns:  NO_ERROR       every student was visited
+ *            ERR_DB_FILE    shard file I/O issue
+ *            <other>        the non-zero value fn returned to stop the scan
+ */
+int shard_scan(sdb_t *db, sdb_scan_fn fn, void *arg)
+{
+    const student_t *cur[SHARD_MAX];
+    pthread_t tids[SHARD_MAX];
+    int nstarted = 0;
+    int rc = ERR_DB_FILE;
+
+    shard_feed_t *feeds = calloc(db->nshards, sizeof(shard_feed_t));
+    if (!feeds)
+        return ERR_DB_FILE;
+    for (; nstarted < db->nshards; nstarted++) {
+        shard_feed_t *f = &feeds[nstarted];
+        f->shard = db->shards[nstarted];
+        pthread_mutex_init(&f->lock, NULL);
+        pthread_cond_init(&f->cond, NULL);
+        if (pthread_create(&tids[nstarted], NULL, feed_worker, f) != 0) {
+            pthread_mutex_destroy(&f->lock);
+            pthread_cond_destroy(&f->cond);
+            goto done;
+        }
+    }
+
+    //shard counts are small, a linear pick of the lowest id is enough
+    for (int i = 0; i < db->nshards; i++)
+        cur[i] = feed_head(&feeds[i]);
+    rc = NO_ERROR;
+    for (;;) {
+        int best = -1;
+        for (int i = 0; i < db->nshards; i++) {
+            if (cur[i] && (best < 0 || cur[i]->id < cur[best]->id))
+                best = i;
+        }
+        if (best < 0)
+            break;
+
+        rc = fn(cur[best], arg);
+        if (rc != 0)
+            break;
+        feed_advance(&feeds[best]);
+        cur[best] = feed_head(&feeds[best]);
+    }
+
+done:
+    for (int i = 0; i < nstarted; i++) {
+        shard_feed_t *f = &feeds[i];
+        pthread_mutex_lock(&f->lock);
+        f->stop = true;
+        pthread_cond_signal(&f->cond);
+        pthread_mutex_unlock(&f->lock);
+        pthread_join(tids[i], NULL);
+        if (f->rc != NO_ERROR)
+            rc = f->rc;
+        pthread_mutex_destroy(&f->lock);
+        pthread_cond_destroy(&f->cond);
+    }
+    free(feeds);
+    return rc;
+}
+
+static int add_part(sdb_t *shard, int idx, void *arg)
+{
+    add_part_t *part = &((add_part_t *)arg)[idx];
+
+    return sdb_add_batch(shard, part->students, part->n, part->results);
+}
+
+/*
+ *  shard_add_batch
+ *      db:        sharded handle
+ *      students:  students to add
+ *      n:         number of students
+ *      results:   optional, receives the sdb_add() code of every student
+ *
+ *  sdb_add_batch() of a sharded database.  The batch is split by shard,
+ *  keeping the order of the students, and every shard adds its part on
+ *  its own thread.
+ *
+ *  returns:  <number>       the number of students added
+ *            ERR_DB_FILE    shard file I/O issue
+ */
+int shard_add_batch(sdb_t *db, const student_t *students, int n, int *results)
+{
+    add_part_t parts[SHARD_MAX] = {{0}};
+    int start[SHARD_MAX + 1] = {0};
+
+    student_t *buf = malloc((n ? n : 1) * sizeof(student_t));
+    int *owner = malloc((n ? n : 1) * sizeof(int));
+    int *res = malloc((n ? n : 1) * sizeof(int));
+    if (!buf || !owner || !res) {
+        free(buf);
+        free(owner);
+        free(res);
+        return ERR_DB_FILE;
+    }
+
+    for (int i = 0; i < n; i++) {
+        owner[i] = shard_index(db, students[i].id);
+        start[owner[i] + 1]++;
+    }
+    for (int s = 0; s < db->nshards; s++) {
+        start[s + 1] += start[s];
+        parts[s].students = buf + start[s];
+        parts[s].results = res + start[s];
+    }
+    for (int i = 0; i < n; i++)
+        parts[owner[i]].students[parts[owner[i]].n++] = students[i];
+
+    int added = shard_fan_out(db, add_part, parts, NULL);
+
+    //hand the results back in the caller's order
+    for (int s = 0; s < db->nshards; s++)
+        parts[s].n = 0;
+    for (int i = 0; results && i < n; i++)
+        results[i] = parts[owner[i]].results[parts[owner[i]].n++];
+
+    free(buf);
+    free(owner);
+    free(res);
+    return added;
+}
+
+//sdb_scrub() callback that keeps the bad ids of one shard
+static int collect_bad(int id, void *arg)
+{
+    scrub_part_t *part = arg;
+
+    if (part->nbad == part->cap) {
+        int cap = part->cap ? part->cap * 2 : 64;
+        int *bad = realloc(part->bad, cap * sizeof(int));
+        if (!bad)
+            return ERR_DB_FILE;
+        part->bad = bad;
+        part->cap = cap;
+    }
+    part->bad[part->nbad++] = id;
+    return 0;
+}
+
+static int scrub_part(sdb_t *shard, int idx, void *arg)
+{
+    scrub_part_t *part = &((scrub_part_t *)arg)[idx];
+
+    return sdb_scrub(shard, part->nthreads, &part->checked, collect_bad, part);
+}
+
+static int cmp_int(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ *  shard_scrub
+ *      db:        sharded handle
+ *      nthreads:  threads to verify with in total, <= 0 for one per CPU
+ *      checked:   optional, receives the number of occupied slots checked
+ *      on_bad:    optional, called in id order for every slot that failed
+ *      arg:       passed through to on_bad
+ *
+ *  sdb_scrub() of a sharded database, the threads are shared out evenly
+ *  between the shards.
+ *
+ *  returns:  <number>       the number of slots that failed verification
+ *            ERR_DB_FILE    shard or checksum file I/O issue
+ */
+int shard_scrub(sdb_t *db, int nthreads, int *checked, sdb_id_fn on_bad, void *arg)
+{
+    scrub_part_t parts[SHARD_MAX] = {{0}};
+    int *bad = NULL;
+    int nbad = 0;
+
+    if (nthreads <= 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int s = 0; s < db->nshards; s++)
+        parts[s].nthreads = nthreads / db->nshards > 1 ? nthreads / db->nshards : 1;
+
+    int rc = shard_fan_out(db, scrub_part, parts, NULL);
+    if (rc >= 0) {
+        bad = malloc((rc ? rc : 1) * sizeof(int));
+        if (!bad)
+            rc = ERR_DB_FILE;
+    }
+    if (checked)
+        *checked = 0;
+    for (int s = 0; s < db->nshards; s++) {
+        if (bad) {
+            memcpy(bad + nbad, parts[s].bad, parts[s].nbad * sizeof(int));
+            nbad += parts[s].nbad;
+        }
+        if (checked)
+            *checked += parts[s].checked;
+        free(parts[s].bad);
+    }
+
+    if (bad) {
+        qsort(bad, nbad, sizeof(int), cmp_int);
+        for (int i = 0; on_bad && i < nbad; i++)
+            on_bad(bad[i], arg);
+    }
+    free(bad);
+    return rc;
+}
+
+//returns the number of shard files, 0 for a database in a single file
+int sdb_shards(sdb_t *db)
+{
+    return db->nshards;
+}
+
+//moves the buffered students into the new shards
+static int flush_copy(shard_copy_t *c)
+{
+    int rc = shard_add_batch(c->dst, c->buf, c->n, NULL);
+    if (rc < 0)
+        return rc;
+    c->moved += rc;
+    c->n = 0;
+    return NO_ERROR;
+}
+
+//sdb_scan() callback for sdb_shard()
+static int copy_student(const student_t *s, void *arg)
+{
+    shard_copy_t *c = arg;
+
+    c->buf[c->n++] = *s;
+    return c->n == SHARD_COPY ? flush_copy(c) : 0;
+}
+
+//writes a manifest for a new set of shards to path
+static int write_manifest(const char *path, const char *base, int mode, int nshards,
+                          const char *const *dirs, int ndirs)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return ERR_DB_FILE;
+
+    fprintf(f, "%s %d %s\n", SHARD_MAGIC, SHARD_VERSION,
+            mode == SDB_SHARD_HASH ? "hash" : "range");
+    for (int i = 0; i < nshards; i++) {
+        if (mode == SDB_SHARD_RANGE)
+            fprintf(f, "%ld ", MIN_STD_ID + (long)(MAX_STD_ID - MIN_STD_ID + 1) * i / nshards);
+        if (ndirs > 0)
+            fprintf(f, "%s/%s.%d\n", dirs[i % ndirs], base, i);
+        else
+            fprintf(f, "%s.%d\n", base, i);
+    }
+
+    bool failed = ferror(f) != 0;
+    if (fclose(f) != 0 || failed)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  sdb_shard
+ *      db:       database handle, must not be sharded yet
+ *      mode:     SDB_SHARD_HASH or SDB_SHARD_RANGE
+ *      nshards:  number of shard files, 1 to SHARD_MAX
+ *      dirs:     directories to put the shards in, round robin; relative
+ *                ones start from the database's directory
+ *      ndirs:    number of dirs, 0 keeps the shards next to the database
+ *
+ *  Creates the shard files as <dir>/<db name>.<n> in the version of the
+ *  database, moves every student into them and replaces the database file
+ *  with their manifest, see SHARD_ in db.h.  Range mode splits the id
+ *  range evenly.  The handle refers to the sharded database afterwards.
+ *
+ *  returns:  <number>       the number of students moved
+ *            ERR_DB_ARGS    mode or nshards out of range
+ *            ERR_DB_OP      the database is already sharded
+ *            ERR_DB_FILE    database or shard file I/O issue
+ */
+int sdb_shard(sdb_t *db, int mode, int nshards, const char *const *dirs, int ndirs)
+{
+    shard_copy_t copy = {0};
+    sdb_t *dst = NULL;
+
+    if (db->nshards)
+        return ERR_DB_OP;
+    if ((mode != SDB_SHARD_HASH && mode != SDB_SHARD_RANGE) ||
+        nshards < 1 || nshards > SHARD_MAX || ndirs < 0)
+        return ERR_DB_ARGS;
+
+    //the manifest is written next to the database and opened from there,
+    //so relative shard paths resolve the same way before and after rename
+    const char *base = strrchr(db->path, '/');
+    base = base ? base + 1 : db->path;
+    if (write_manifest(db->tmp_path, base, mode, nshards, dirs, ndirs) != NO_ERROR ||
+        sdb_open(db->tmp_path, true, &dst) != NO_ERROR)
+        goto fail;
+    if (db->version == DB_VERSION_2 && sdb_migrate(dst) < 0)
+        goto fail;
+
+    copy.dst = dst;
+    copy.buf = malloc(SHARD_COPY * sizeof(student_t));
+    if (!copy.buf || sdb_scan(db, copy_student, &copy) != NO_ERROR ||
+        (copy.n && flush_copy(&copy) != NO_ERROR) ||
+        io_rename(db->tmp_path, db->path) != 0)
+        goto fail;
+
+    //the students now live in the shards, drop the old sidecar files
+    io_close(db->fd);
+    io_close(db->crc_fd);
+    io_unlink(db->crc_path);
+    if (db->tri_fd != -1)
+        io_close(db->tri_fd);
+    io_unlink(db->tri_path);
+    if (db->gpa_fd != -1)
+        io_close(db->gpa_fd);
+    io_unlink(db->gpa_path);
+
+    db->fd = dst->fd;
+    db->crc_fd = -1;
+    db->tri_fd = -1;
+    db->gpa_fd = -1;
+    db->version = dst->version;
+    db->nshards = dst->nshards;
+    db->shard_mode = dst->shard_mode;
+    db->shards = dst->shards;
+    db->shard_first = dst->shard_first;
+    dst->fd = -1;
+    dst->nshards = 0;
+    dst->shards = NULL;
+    dst->shard_first = NULL;
+    sdb_close(dst);
+    sdb_set_direct(db, db->direct);
+    free(copy.buf);
+    return copy.moved;
+
+fail:
+    sdb_close(dst);
+    io_unlink(db->tmp_path);
+    free(copy.buf);
+    return ERR_DB_FILE;
+}
@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// database include files
+#include "db.h"
+#include "sdbint.h"
+
+/*
+ *  Sorted scans
+ *
+ *  Students are read in id order into a buffer sized from the memory
+ *  budget.  If the whole database fits, the buffer is sorted and handed
+ *  out directly.  Otherwise every full buffer is sorted and spilled as a
+ *  run to an unlinked scratch file next to the database, and the runs are
+ *  merged with a loser tree, reading each run through its own slice of
+ *  the same budget.
+ *
+ *  The buffer itself is never moved.  A GPA order is a counting sort over
+ *  the 501 possible values, a last name order sorts small keys holding the
+ *  first 8 bytes of the name so most comparisons never touch the records.
+ *  Both break ties by id, which the scan already delivers in order, so the
+ *  output is fully deterministic.
+ */
+#define SORT_OUT_BATCH  256         //records per run write
+
+typedef struct sort_key {
+    uint64_t prefix;                //first 8 bytes of lname, big endian
+    uint32_t idx;                   //record in the buffer
+} sort_key_t;
+
+typedef struct sorter {
+    int order;
+    student_t *recs;                //the buffer
+    uint32_t *perm;                 //sorted order of the buffer
+    sort_key_t *keys;               //lname order only
+    int cap;
+    int n;
+    int *run_fds;
+    int nruns;
+    int run_cap;
+    const char *tmp_base;
+} sorter_t;
+
+typedef struct run_reader {
+    int fd;
+    off_t off;
+    student_t *buf;
+    int cap;
+    int n;
+    int pos;
+} run_reader_t;
+
+static int cmp_student(int order, const student_t *a, const student_t *b)
+{
+    int c = 0;
+
+    if (order == SDB_ORDER_LNAME)
+        c = strncmp(a->lname, b->lname, sizeof(a->lname));
+    else if (order == SDB_ORDER_GPA)
+        c = (a->gpa > b->gpa) - (a->gpa < b->gpa);
+    return c ? c : (a->id > b->id) - (a->id < b->id);
+}
+
+static const student_t *sort_recs;
+
+static int cmp_key(const void *x, const void *y)
+{
+    const sort_key_t *a = x, *b = y;
+
+    if (a->prefix != b->prefix)
+        return a->prefix < b->prefix ? -1 : 1;
+    return cmp_student(SDB_ORDER_LNAME, &sort_recs[a->idx], &sort_recs[b->idx]);
+}
+
+//fills s->perm with the sorted order of the buffer
+static void sort_buffer(sorter_t *s)
+{
+    if (s->order == SDB_ORDER_GPA) {
+        int start[MAX_STD_GPA + 2] = {0};
+        for (int i = 0; i < s->n; i++)
+            start[s->recs[i].gpa + 1]++;
+        for (int g = 1; g <= MAX_STD_GPA + 1; g++)
+            start[g] += start[g - 1];
+        for (int i = 0; i < s->n; i++)
+            s->perm[start[s->recs[i].gpa]++] = i;
+        return;
+    }
+
+    for (int i = 0; i < s->n; i++) {
+        uint64_t p = 0;
+        const unsigned char *name = (const unsigned char *)s->recs[i].lname;
+        for (int b = 0, end = 0; b < 8; b++) {
+            end |= name[b] == '\0';
+            p = p << 8 | (end ? 0 : name[b]);
+        }
+        s->keys[i].prefix = p;
+        s->keys[i].idx = i;
+    }
+    //qsort is not reentrant over a context, one sort runs at a time here
+    sort_recs = s->recs;
+    qsort(s->keys, s->n, sizeof(sort_key_t), cmp_key);
+    for (int i = 0; i < s->n; i++)
+        s->perm[i] = s->keys[i].idx;
+}
+
+//sorts the buffer and writes it to a new scratch file
+static int spill_run(sorter_t *s)
+{
+    student_t out[SORT_OUT_BATCH];
+    char path[PATH_MAX];
+
+    if (s->nruns == s->run_cap) {
+        int cap = s->run_cap ? s->run_cap * 2 : 16;
+        int *fds = realloc(s->run_fds, cap * sizeof(int));
+        if (!fds)
+            return ERR_DB_FILE;
+        s->run_fds = fds;
+        s->run_cap = cap;
+    }
+
+    snprintf(path, sizeof(path), "%s.runXXXXXX", s->tmp_base);
+    int fd = io_mkstemp(path);
+    if (fd == -1)
+        return ERR_DB_FILE;
+    io_unlink(path);
+    s->run_fds[s->nruns++] = fd;
+
+    sort_buffer(s);
+    for (int i = 0; i < s->n; i += SORT_OUT_BATCH) {
+        int cnt = s->n - i < SORT_OUT_BATCH ? s->n - i : SORT_OUT_BATCH;
+        for (int k = 0; k < cnt; k++)
+            out[k] = s->recs[s->perm[i + k]];
+        ssize_t bytes = (ssize_t)cnt * sizeof(student_t);
+        if (io_write(fd, out, bytes) != bytes)
+            return ERR_DB_FILE;
+    }
+    s->n = 0;
+    return NO_ERROR;
+}
+
+//sdb_scan() callback that fills the buffer, spilling it when full
+static int gather(const student_t *st, void *arg)
+{
+    sorter_t *s = arg;
+
+    if (s->n == s->cap && spill_run(s) != NO_ERROR)
+        return ERR_DB_FILE;
+    s->recs[s->n++] = *st;
+    return 0;
+}
+
+//true while the run still has a current record, refilling as needed
+static bool run_fill(run_reader_t *r, int *err)
+{
+    if (r->pos < r->n)
+        return true;
+    if (r->fd == -1)
+        return false;
+
+    ssize_t got = io_pread(r->fd, r->buf, (size_t)r->cap * sizeof(student_t), r->off);
+    if (got < 0 || got % sizeof(student_t) != 0) {
+        *err = ERR_DB_FILE;
+        got = 0;
+    }
+    r->off += got;
+    r->n = got / sizeof(student_t);
+    r->pos = 0;
+    if (r->n == 0)
+        r->fd = -1;
+    return r->n > 0;
+}
+
+//does run a sort before run b, an exhausted run sorts after everything
+static bool run_less(int order, run_reader_t *runs, int a, int b)
+{
+    bool live_a = runs[a].pos < runs[a].n;
+    bool live_b = runs[b].pos < runs[b].n;
+
+    if (!live_a || !live_b)
+        return live_a;
+    int c = cmp_student(order, &runs[a].buf[runs[a].pos], &runs[b].buf[runs[b].pos]);
+    return c < 0 || (c == 0 && a < b);
+}
+
+/*
+ *  merge_runs
+ *
+ *  tree[0] is the run holding the smallest record, tree[1..k-1] hold the
+ *  loser of the match played at each inner node of a tree whose leaves
+ *  k..2k-1 are the runs.  Taking a record from the winner only replays the
+ *  matches on its path to the root, so each record costs log2(k)
+ *  comparisons.
+ */
+static int merge_runs(sorter_t *s, run_reader_t *runs, sdb_scan_fn fn, void *arg)
+{
+    int k = s->nruns;
+    int err = NO_ERROR;
+    int *tree = malloc(k * sizeof(int));
+    int *win = malloc(2 * k * sizeof(int));
+    int rc = NO_ERROR;
+
+    if (!tree || !win) {
+        free(tree);
+        free(win);
+        return ERR_DB_FILE;
+    }
+
+    for (int r = 0; r < k; r++) {
+        run_fill(&runs[r], &err);
+        win[k + r] = r;
+    }
+    for (int i = k - 1; i > 0; i--) {
+        int a = win[2 * i], b = win[2 * i + 1];
+        bool a_wins = run_less(s->order, runs, a, b);
+        win[i] = a_wins ? a : b;
+        tree[i] = a_wins ? b : a;
+    }
+    tree[0] = k > 1 ? win[1] : 0;
+
+    while (err == NO_ERROR) {
+        int w = tree[0];
+        run_reader_t *r = &runs[w];
+        if (r->pos >= r->n)
+            break;
+
+        rc = fn(&r->buf[r->pos++], arg);
+        if (rc != 0)
+            break;
+        run_fill(r, &err);
+
+        for (int i = (w + k) / 2; i > 0; i /= 2) {
+            if (run_less(s->order, runs, tree[i], w)) {
+                int t = tree[i];
+                tree[i] = w;
+                w = t;
+            }
+        }
+        tree[0] = w;
+    }
+
+    free(tree);
+    free(win);
+    return err != NO_ERROR ? err : rc;
+}
+
+/*
+ *  sdb_scan_sorted
+ *      db:          database handle
+ *      order:       SDB_ORDER_ID, SDB_ORDER_LNAME or SDB_ORDER_GPA
+ *      mem_budget:  bytes the sort may use, 0 for SORT_MEM_DEFAULT
+ *      fn:          called with every live student in the requested order
+ *      arg:         passed through to fn
+ *
+ *  Databases that do not fit in the budget are sorted in runs that are
+ *  spilled next to the database and merged, see above.  Ties are broken by
+ *  id.
+ *
+ *  returns:  NO_ERROR       every student was visited
+ *            ERR_DB_ARGS    unknown order
+ *            ERR_DB_FILE    database or scratch file I/O issue
+ *            <other>        the non-zero value fn returned to stop the scan
+ */
+int sdb_scan_sorted(sdb_t *db, int order, size_t mem_budget, sdb_scan_fn fn, void *arg)
+{
+    sorter_t s = { .order = order, .tmp_base = db->tmp_path };
+    run_reader_t *runs = NULL;
+    int rc = ERR_DB_FILE;
+
+    if (order == SDB_ORDER_ID)
+        return sdb_scan(db, fn, arg);
+    if (order != SDB_ORDER_LNAME && order != SDB_ORDER_GPA)
+        return ERR_DB_ARGS;
+
+    if (mem_budget == 0)
+        mem_budget = SORT_MEM_DEFAULT;
+    if (mem_budget < SORT_MEM_MIN)
+        mem_budget = SORT_MEM_MIN;
+
+    //a record, its slot in perm and, for lname, its key
+    size_t per_rec = sizeof(student_t) + sizeof(uint32_t) +
+                     (order == SDB_ORDER_LNAME ? sizeof(sort_key_t) : 0);
+    s.cap = mem_budget / per_rec;
+    if (s.cap > MAX_STD_ID)
+        s.cap = MAX_STD_ID;
+    s.recs = malloc((size_t)s.cap * sizeof(student_t));
+    s.perm = malloc((size_t)s.cap * sizeof(uint32_t));
+    if (order == SDB_ORDER_LNAME)
+        s.keys = malloc((size_t)s.cap * sizeof(sort_key_t));
+    if (!s.recs || !s.perm || (order == SDB_ORDER_LNAME && !s.keys))
+        goto done;
+
+    rc = sdb_scan(db, gather, &s);
+    if (rc != NO_ERROR)
+        goto done;
+
+    if (s.nruns == 0) {
+        sort_buffer(&s);
+        for (int i = 0; i < s.n && rc == NO_ERROR; i++)
+            rc = fn(&s.recs[s.perm[i]], arg);
+        goto done;
+    }
+    if (s.n && spill_run(&s) != NO_ERROR) {
+        rc = ERR_DB_FILE;
+        goto done;
+    }
+
+    //the buffer becomes the read buffers of the runs
+    free(s.perm);
+    free(s.keys);
+    s.perm = NULL;
+    s.keys = NULL;
+    rc = ERR_DB_FILE;
+    runs = calloc(s.nruns, sizeof(run_reader_t));
+    int slice = s.cap / s.nruns;
+    if (!runs || slice < 1)
+        goto done;
+    for (int r = 0; r < s.nruns; r++) {
+        runs[r].fd = s.run_fds[r];
+        runs[r].buf = s.recs + (size_t)r * slice;
+        runs[r].cap = slice;
+    }
+    rc = merge_runs(&s, runs, fn, arg);
+
+done:
+    for (int r = 0; r < s.nruns; r++)
+        io_close(s.run_fds[r]);
+    free(s.run_fds);
+    free(runs);
+    free(s.recs);
+    free(s.perm);
+    free(s.keys);
+    return rc;
+}
@@ -0,0 +1,145 @@
+#define _GNU_SOURCE     //fallocate()
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+// database include files
+#include "db.h"
+#include "sdbint.h"
+
+/*
+ *  I/O statistics
+ *
+ *  The library makes every system call through the io_ wrappers in
+ *  sdbint.h and here, which count calls and bytes into io_stats.  The
+ *  scanner adds the records it looked at, the students it handed back and
+ *  the bytes of sparse file it skipped.  Everything is process wide, so a
+ *  sharded database reports the sum of its shards.
+ *
+ *  While statistics are off io_stats is NULL and the only cost is the
+ *  branch in IO_STAT_ADD.
+ */
+static sdb_stats_t stats_store;
+sdb_stats_t *io_stats;
+
+static const char *io_names[SDB_IO_KINDS] = {
+    "open", "close", "pread", "pwrite", "write", "lseek", "fstat", "ftruncate",
+    "fallocate", "fdatasync", "fadvise", "mmap", "munmap", "rename", "unlink",
+    "mkstemp",
+};
+
+/*
+ *  sdb_stats_enable
+ *      enable:  true to start counting from zero, false to stop
+ *
+ *  Call it while no other thread is inside the library.
+ */
+void sdb_stats_enable(bool enable)
+{
+    if (enable)
+        memset(&stats_store, 0, sizeof(stats_store));
+    io_stats = enable ? &stats_store : NULL;
+}
+
+/*
+ *  sdb_stats_get
+ *      stats:  receives the counters, all zero if statistics were never on
+ */
+void sdb_stats_get(sdb_stats_t *stats)
+{
+    const unsigned long long *src = (const unsigned long long *)&stats_store;
+    unsigned long long *dst = (unsigned long long *)stats;
+
+    for (size_t i = 0; i < sizeof(sdb_stats_t) / sizeof(*src); i++)
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+}
+
+//name of an SDB_IO_ kind, NULL if it is out of range
+const char *sdb_io_name(int kind)
+{
+    return kind >= 0 && kind < SDB_IO_KINDS ? io_names[kind] : NULL;
+}
+
+int io_open(const char *path, int flags, mode_t mode)
+{
+    IO_STAT_ADD(calls[SDB_IO_OPEN], 1);
+    return open(path, flags, mode);
+}
+
+int io_close(int fd)
+{
+    IO_STAT_ADD(calls[SDB_IO_CLOSE], 1);
+    return close(fd);
+}
+
+off_t io_lseek(int fd, off_t off, int whence)
+{
+    IO_STAT_ADD(calls[SDB_IO_LSEEK], 1);
+    return lseek(fd, off, whence);
+}
+
+int io_fstat(int fd, struct stat *st)
+{
+    IO_STAT_ADD(calls[SDB_IO_FSTAT], 1);
+    return fstat(fd, st);
+}
+
+int io_ftruncate(int fd, off_t len)
+{
+    IO_STAT_ADD(calls[SDB_IO_FTRUNCATE], 1);
+    return ftruncate(fd, len);
+}
+
+int io_fallocate(int fd, int mode, off_t off, off_t len)
+{
+    IO_STAT_ADD(calls[SDB_IO_FALLOCATE], 1);
+    return fallocate(fd, mode, off, len);
+}
+
+int io_fdatasync(int fd)
+{
+    IO_STAT_ADD(calls[SDB_IO_FDATASYNC], 1);
+    return fdatasync(fd);
+}
+
+int io_fadvise(int fd, off_t off, off_t len, int advice)
+{
+    IO_STAT_ADD(calls[SDB_IO_FADVISE], 1);
+    return posix_fadvise(fd, off, len, advice);
+}
+
+//maps len bytes of fd from offset 0
+void *io_mmap(size_t len, int prot, int flags, int fd)
+{
+    IO_STAT_ADD(calls[SDB_IO_MMAP], 1);
+    return mmap(NULL, len, prot, flags, fd, 0);
+}
+
+int io_munmap(void *addr, size_t len)
+{
+    IO_STAT_ADD(calls[SDB_IO_MUNMAP], 1);
+    return munmap(addr, len);
+}
+
+int io_rename(const char *from, const char *to)
+{
+    IO_STAT_ADD(calls[SDB_IO_RENAME], 1);
+    return rename(from, to);
+}
+
+int io_unlink(const char *path)
+{
+    IO_STAT_ADD(calls[SDB_IO_UNLINK], 1);
+    return unlink(path);
+}
+
+int io_mkstemp(char *path)
+{
+    IO_STAT_ADD(calls[SDB_IO_MKSTEMP], 1);
+    return mkstemp(path);
+}
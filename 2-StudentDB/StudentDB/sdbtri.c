@@ -0,0 +1,704 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// database include files
+#include "db.h"
+#include "sdbint.h"
+
+/*
+ *  Trigram name index
+ *
+ *  The index file (see TRI_ in db.h) is built in one scan and never
+ *  rewritten in place.  Every change to a student afterwards only appends
+ *  its id to the log at the end of the file, so keeping the index current
+ *  costs one small append per add or delete.  A search treats the logged
+ *  ids as dirty: they are dropped from the posting lists and checked
+ *  against the database directly instead.  Once the log holds more than
+ *  TRI_LOG_MAX ids the next search rebuilds the index.
+ *
+ *  A search ranks students by how many of the query's padded trigrams
+ *  their names share, and puts students whose names contain the query
+ *  verbatim first.  Those are found by intersecting the posting lists of
+ *  the query's inner trigrams, which is done 4 ids at a time with SSE2
+ *  (always present on x86-64) and in scalar code elsewhere.
+ */
+#define TRI_MAX_PER_STUDENT 128     //distinct trigrams kept per student
+#define TRI_MAX_QUERY       256     //trigrams kept from a query
+#define TRI_LOG_MAX         4096    //logged ids before a search rebuilds
+#define TRI_MIN_SHARE       50      //percent of the query a fuzzy match needs
+
+//per id flags used by a search
+#define TRI_DIRTY           1       //changed since the build, check the db
+#define TRI_SUBSTRING       2       //has every inner trigram of the query
+
+typedef struct tri_build {
+    uint64_t *pairs;                //trigram << 32 | id, in id order
+    size_t npairs;
+    size_t cap;
+    uint8_t *counts;                //distinct trigrams per id
+    uint32_t max_id;
+} tri_build_t;
+
+typedef struct tri_cand {
+    student_t student;
+    int share;                      //query trigrams the student has
+    int ntri;                       //distinct trigrams of the student
+    bool substring;
+} tri_cand_t;
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+//sorts and removes duplicates, returns the new count
+static int sort_unique(uint32_t *v, int n)
+{
+    int k = 0;
+
+    qsort(v, n, sizeof(uint32_t), cmp_u32);
+    for (int i = 0; i < n; i++) {
+        if (k == 0 || v[i] != v[k - 1])
+            v[k++] = v[i];
+    }
+    return k;
+}
+
+/*
+ *  Appends the trigrams of every word of text to out.  A word is a run of
+ *  letters and digits.  Padded words give the "  word " trigrams stored in
+ *  the index, unpadded ones only the trigrams fully inside the word.
+ */
+static int text_trigrams(const char *text, size_t len, bool padded, uint32_t *out, int n, int max)
+{
+    size_t i = 0;
+
+    while (i < len && text[i]) {
+        while (i < len && text[i] && !isalnum((unsigned char)text[i]))
+            i++;
+        size_t start = i;
+        while (i < len && text[i] && isalnum((unsigned char)text[i]))
+            i++;
+        if (i == start)
+            break;
+
+        uint32_t t = padded ? (' ' << 8 | ' ') : 0;
+        int have = padded ? 2 : 0;
+        for (size_t k = start; k <= i && n < max; k++) {
+            uint32_t c = k < i ? (uint32_t)tolower((unsigned char)text[k]) : ' ';
+            if (k == i && !padded)
+                break;
+            t = (t << 8 | c) & 0xFFFFFF;
+            if (++have >= 3)
+                out[n++] = t;
+        }
+    }
+    return n;
+}
+
+static int student_trigrams(const student_t *s, uint32_t *out)
+{
+    int n = text_trigrams(s->fname, sizeof(s->fname), true, out, 0, TRI_MAX_PER_STUDENT);
+    n = text_trigrams(s->lname, sizeof(s->lname), true, out, n, TRI_MAX_PER_STUDENT);
+    return sort_unique(out, n);
+}
+
+//sdb_scan() callback that collects the trigrams of every student
+static int build_collect(const student_t *s, void *arg)
+{
+    tri_build_t *b = arg;
+    uint32_t tri[TRI_MAX_PER_STUDENT];
+    int n = student_trigrams(s, tri);
+
+    if (b->npairs + n > b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 65536;
+        uint64_t *pairs = realloc(b->pairs, cap * sizeof(uint64_t));
+        if (!pairs)
+            return ERR_DB_FILE;
+        b->pairs = pairs;
+        b->cap = cap;
+    }
+    for (int i = 0; i < n; i++)
+        b->pairs[b->npairs++] = (uint64_t)tri[i] << 32 | (uint32_t)s->id;
+    b->counts[s->id] = n > 255 ? 255 : n;
+    if ((uint32_t)s->id > b->max_id)
+        b->max_id = s->id;
+    return 0;
+}
+
+//stable LSD radix sort on the 24 bit trigram, ids stay in order per trigram
+static int sort_pairs(uint64_t *pairs, size_t n)
+{
+    uint64_t *tmp = malloc((n ? n : 1) * sizeof(uint64_t));
+    if (!tmp)
+        return ERR_DB_FILE;
+
+    for (int shift = 32; shift < 56; shift += 12) {
+        size_t pos[4097] = {0};
+        for (size_t i = 0; i < n; i++)
+            pos[((pairs[i] >> shift) & 0xFFF) + 1]++;
+        for (int d = 1; d <= 4096; d++)
+            pos[d] += pos[d - 1];
+        for (size_t i = 0; i < n; i++)
+            tmp[pos[(pairs[i] >> shift) & 0xFFF]++] = pairs[i];
+        memcpy(pairs, tmp, n * sizeof(uint64_t));
+    }
+    free(tmp);
+    return NO_ERROR;
+}
+
+static size_t put_varint(uint8_t *p, uint32_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+    p[n++] = v;
+    return n;
+}
+
+static int build_shard(sdb_t *shard, int idx, void *arg)
+{
+    (void)idx;
+    (void)arg;
+    return sdb_index_build(shard);
+}
+
+/*
+ *  sdb_index_build
+ *      db:  database handle
+ *
+ *  Builds the trigram index of every student from scratch, or creates it
+ *  if the database has none yet.  Once an index exists the library keeps
+ *  it current on every change.  Every shard has an index of its own.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int sdb_index_build(sdb_t *db)
+{
+    tri_build_t b = {0};
+    uint8_t *file = NULL;
+    char *tmp_path = NULL;
+    int rc = ERR_DB_FILE;
+    int fd = -1;
+
+    if (db->nshards)
+        return shard_fan_out(db, build_shard, NULL, NULL);
+
+    b.counts = calloc(MAX_STD_ID + 1, 1);
+    if (!b.counts || sdb_scan(db, build_collect, &b) != NO_ERROR ||
+        sort_pairs(b.pairs, b.npairs) != NO_ERROR)
+        goto done;
+
+    uint32_t ntri = 0;
+    for (size_t i = 0; i < b.npairs; i++) {
+        if (i == 0 || b.pairs[i] >> 32 != b.pairs[i - 1] >> 32)
+            ntri++;
+    }
+
+    //every varint of an id below 2^21 fits in 3 bytes
+    tri_header_t hdr = { .version = TRI_VERSION, .ntrigrams = ntri, .max_id = b.max_id };
+    memcpy(hdr.magic, TRI_MAGIC, 4);
+    hdr.counts_off = sizeof(tri_header_t);
+    hdr.table_off = (hdr.counts_off + b.max_id + 1 + 7) & ~(uint64_t)7;
+    hdr.post_off = hdr.table_off + (uint64_t)ntri * sizeof(tri_entry_t);
+    size_t size = hdr.post_off + b.npairs * 3;
+
+    file = calloc(size, 1);
+    if (!file)
+        goto done;
+    memcpy(file + hdr.counts_off, b.counts, b.max_id + 1);
+
+    tri_entry_t *table = (tri_entry_t *)(file + hdr.table_off);
+    uint8_t *post = file + hdr.post_off;
+    size_t post_len = 0;
+    uint32_t prev = 0;
+    int t = -1;
+    for (size_t i = 0; i < b.npairs; i++) {
+        uint32_t tri = b.pairs[i] >> 32;
+        uint32_t id = (uint32_t)b.pairs[i];
+        if (t < 0 || table[t].trigram != tri) {
+            t++;
+            table[t].trigram = tri;
+            table[t].count = 0;
+            table[t].off = post_len;
+            prev = 0;
+        }
+        post_len += put_varint(post + post_len, id - prev);
+        table[t].count++;
+        prev = id;
+    }
+    hdr.log_off = hdr.post_off + post_len;
+    memcpy(file, &hdr, sizeof(hdr));
+
+    //written beside the old index and renamed over it
+    tmp_path = malloc(strlen(db->tri_path) + 5);
+    if (!tmp_path)
+        goto done;
+    sprintf(tmp_path, "%s.tmp", db->tri_path);
+    fd = io_open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (fd == -1 || io_write(fd, file, hdr.log_off) != (ssize_t)hdr.log_off ||
+        io_rename(tmp_path, db->tri_path) != 0) {
+        io_unlink(tmp_path);
+        goto done;
+    }
+
+    if (db->tri_fd != -1)
+        io_close(db->tri_fd);
+    db->tri_fd = fd;
+    fd = -1;
+    rc = NO_ERROR;
+
+done:
+    if (fd != -1)
+        io_close(fd);
+    free(tmp_path);
+    free(file);
+    free(b.pairs);
+    free(b.counts);
+    return rc;
+}
+
+//appends changed ids to the index log
+int tri_note(sdb_t *db, const uint32_t *ids, int n)
+{
+    if (db->tri_fd == -1 || n <= 0)
+        return NO_ERROR;
+    ssize_t bytes = (ssize_t)n * sizeof(uint32_t);
+    return io_write(db->tri_fd, ids, bytes) == bytes ? NO_ERROR : ERR_DB_FILE;
+}
+
+//an emptied database gets an empty index if it had one
+int tri_reset(sdb_t *db)
+{
+    return db->tri_fd == -1 ? NO_ERROR : sdb_index_build(db);
+}
+
+static uint32_t *decode_postings(const uint8_t *p, const uint8_t *end, uint32_t count)
+{
+    uint32_t *ids = malloc((count ? count : 1) * sizeof(uint32_t));
+    uint32_t id = 0;
+
+    if (!ids)
+        return NULL;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t delta = 0;
+        for (int shift = 0; p < end; shift += 7) {
+            uint8_t byte = *p++;
+            delta |= (uint32_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                break;
+        }
+        id += delta;
+        ids[i] = id;
+    }
+    return ids;
+}
+
+static int intersect_scalar(const uint32_t *a, int na, const uint32_t *b, int nb, uint32_t *out)
+{
+    int i = 0, j = 0, n = 0;
+
+    while (i < na && j < nb) {
+        if (a[i] < b[j])
+            i++;
+        else if (a[i] > b[j])
+            j++;
+        else {
+            out[n++] = a[i];
+            i++;
+            j++;
+        }
+    }
+    return n;
+}
+
+/*
+ *  Intersects two sorted lists of unique ids into out, which may be a.
+ *  Four ids of a are compared with four of b at once by comparing a with
+ *  each rotation of b, then the block with the smaller last id moves on.
+ */
+static int intersect(const uint32_t *a, int na, const uint32_t *b, int nb, uint32_t *out)
+{
+    int i = 0, j = 0, n = 0;
+
+#if defined(__SSE2__)
+    while (i + 4 <= na && j + 4 <= nb) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + j));
+        __m128i eq = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi32(va, vb),
+                         _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)))),
+            _mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))),
+                         _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)))));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+        uint32_t a_last = a[i + 3], b_last = b[j + 3];
+
+        uint32_t block[4];
+        _mm_storeu_si128((__m128i *)block, va);
+        for (int k = 0; k < 4; k++) {
+            if (mask & (1 << k))
+                out[n++] = block[k];
+        }
+        if (a_last <= b_last)
+            i += 4;
+        if (b_last <= a_last)
+            j += 4;
+    }
+#endif
+    return n + intersect_scalar(a + i, na - i, b + j, nb - j, out + n);
+}
+
+static bool contains_ci(const char *name, size_t len, const char *query)
+{
+    size_t qlen = strlen(query);
+    size_t nlen = strnlen(name, len);
+
+    for (size_t i = 0; qlen && i + qlen <= nlen; i++) {
+        size_t k = 0;
+        while (k < qlen && tolower((unsigned char)name[i + k]) == tolower((unsigned char)query[k]))
+            k++;
+        if (k == qlen)
+            return true;
+    }
+    return false;
+}
+
+//shared entries of two sorted unique trigram sets
+static int shared_trigrams(const uint32_t *a, int na, const uint32_t *b, int nb)
+{
+    int i = 0, j = 0, n = 0;
+
+    while (i < na && j < nb) {
+        if (a[i] == b[j])
+            n++;
+        if (a[i] <= b[j])
+            i++;
+        else
+            j++;
+    }
+    return n;
+}
+
+//best first: verbatim matches, then most shared trigrams, then the
+//closest overall (Jaccard), then id
+static int cmp_cand(const void *x, const void *y)
+{
+    const tri_cand_t *a = x, *b = y;
+
+    if (a->substring != b->substring)
+        return a->substring ? -1 : 1;
+    if (a->share != b->share)
+        return b->share - a->share;
+    long lhs = (long)a->share * (b->ntri - b->share);
+    long rhs = (long)b->share * (a->ntri - a->share);
+    if (lhs != rhs)
+        return lhs > rhs ? -1 : 1;
+    return a->student.id - b->student.id;
+}
+
+static const tri_entry_t *find_trigram(const tri_entry_t *table, uint32_t n, uint32_t tri)
+{
+    uint32_t lo = 0, hi = n;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (table[mid].trigram < tri)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < n && table[lo].trigram == tri ? &table[lo] : NULL;
+}
+
+//true when the mapped file is laid out the way sdb_index_build() writes
+//it: every section inside the file and in order, and a table sorted by
+//trigram whose posting lists follow each other and end before log_off
+static bool tri_layout_ok(const tri_header_t *h, const uint8_t *map, uint64_t size)
+{
+    if (memcmp(h->magic, TRI_MAGIC, 4) != 0 || h->version != TRI_VERSION ||
+        h->max_id > MAX_STD_ID)
+        return false;
+    if (h->counts_off > size || h->table_off > size || h->post_off > size ||
+        h->log_off > size)
+        return false;
+    if (h->counts_off < sizeof(tri_header_t) ||
+        h->table_off < h->counts_off + h->max_id + 1 ||
+        h->post_off < h->table_off + (uint64_t)h->ntrigrams * sizeof(tri_entry_t) ||
+        h->log_off < h->post_off || h->table_off % sizeof(uint64_t))
+        return false;
+
+    //every id of a posting list takes at least one byte
+    const tri_entry_t *table = (const tri_entry_t *)(map + h->table_off);
+    uint64_t post_len = h->log_off - h->post_off;
+    for (uint32_t t = 0; t < h->ntrigrams; t++) {
+        uint64_t next = t + 1 < h->ntrigrams ? table[t + 1].off : post_len;
+        if ((t > 0 && table[t].trigram <= table[t - 1].trigram) ||
+            table[t].off > next || table[t].count > next - table[t].off)
+            return false;
+    }
+    return true;
+}
+
+//maps the index, building or rebuilding it first when needed, a file that
+//is damaged is rebuilt the same way as one with a full log
+static int tri_map(sdb_t *db, tri_header_t *hdr, uint8_t **map, size_t *size)
+{
+    struct stat st;
+    bool rebuilt = false;
+
+    *map = MAP_FAILED;
+    if (db->tri_fd == -1) {
+        if (sdb_index_build(db) != NO_ERROR)
+            return ERR_DB_FILE;
+        rebuilt = true;
+    }
+    for (;;) {
+        if (io_fstat(db->tri_fd, &st) == -1)
+            return ERR_DB_FILE;
+        if ((size_t)st.st_size >= sizeof(tri_header_t)) {
+            *size = st.st_size;
+            *map = io_mmap(*size, PROT_READ, MAP_SHARED, db->tri_fd);
+            if (*map == MAP_FAILED)
+                return ERR_DB_FILE;
+            memcpy(hdr, *map, sizeof(*hdr));
+            if (tri_layout_ok(hdr, *map, *size) &&
+                (*size - hdr->log_off) / sizeof(uint32_t) <= TRI_LOG_MAX)
+                return NO_ERROR;
+            io_munmap(*map, *size);
+            *map = MAP_FAILED;
+        }
+        if (rebuilt || sdb_index_build(db) != NO_ERROR)
+            return ERR_DB_FILE;
+        rebuilt = true;
+    }
+}
+
+//one shard's search, out has room for max matches per shard
+typedef struct shard_search {
+    const char *query;
+    sdb_match_t *out;
+    int max;
+} shard_search_t;
+
+static int search_shard(sdb_t *shard, int idx, void *arg)
+{
+    shard_search_t *ss = arg;
+
+    return sdb_search(shard, ss->query, ss->out + (size_t)idx * ss->max, ss->max);
+}
+
+//searches every shard at once and ranks their best matches together
+static int search_shards(sdb_t *db, const char *query, sdb_match_t *out, int max)
+{
+    uint32_t q[TRI_MAX_QUERY];
+    uint32_t tri[TRI_MAX_PER_STUDENT];
+    int found[SHARD_MAX];
+    shard_search_t ss = { .query = query, .max = max };
+    int ncands = 0;
+
+    if (max <= 0)
+        return 0;
+    ss.out = malloc((size_t)db->nshards * max * sizeof(sdb_match_t));
+    tri_cand_t *cands = malloc((size_t)db->nshards * max * sizeof(tri_cand_t));
+    if (!ss.out || !cands || shard_fan_out(db, search_shard, &ss, found) < 0) {
+        free(ss.out);
+        free(cands);
+        return ERR_DB_FILE;
+    }
+
+    //the shards only report percentages, recount for the exact order
+    int nq = sort_unique(q, text_trigrams(query, strlen(query), true, q, 0, TRI_MAX_QUERY));
+    for (int i = 0; i < db->nshards; i++) {
+        for (int k = 0; k < found[i]; k++) {
+            tri_cand_t *c = &cands[ncands++];
+            c->student = ss.out[(size_t)i * max + k].student;
+            c->substring = ss.out[(size_t)i * max + k].substring;
+            c->ntri = student_trigrams(&c->student, tri);
+            c->share = shared_trigrams(q, nq, tri, c->ntri);
+        }
+    }
+
+    qsort(cands, ncands, sizeof(tri_cand_t), cmp_cand);
+    int n = ncands < max ? ncands : max;
+    for (int i = 0; i < n; i++) {
+        out[i].student = cands[i].student;
+        out[i].score = nq ? cands[i].share * 100 / nq : 0;
+        out[i].substring = cands[i].substring;
+    }
+    free(ss.out);
+    free(cands);
+    return n;
+}
+
+/*
+ *  sdb_search
+ *      db:     database handle
+ *      query:  part of a first or last name, possibly misspelled
+ *      out:    receives the best matches, best first
+ *      max:    room in out
+ *
+ *  Finds students whose names contain the query, or share at least
+ *  TRI_MIN_SHARE percent of its trigrams, using the trigram index.  The
+ *  index is built first if the database does not have one yet.  Shards
+ *  are searched side by side.
+ *
+ *  returns:  <number>       the number of matches written to out
+ *            ERR_DB_FILE    database or index file I/O issue
+ */
+int sdb_search(sdb_t *db, const char *query, sdb_match_t *out, int max)
+{
+    uint32_t q[TRI_MAX_QUERY], inner[TRI_MAX_QUERY];
+    uint32_t tri[TRI_MAX_PER_STUDENT];
+    tri_header_t hdr;
+    size_t size = 0;
+    uint8_t *map = MAP_FAILED;
+    uint8_t *share = NULL;
+    uint8_t *flags = NULL;
+    uint32_t *touched = NULL;
+    uint32_t *sub = NULL;
+    tri_cand_t *cands = NULL;
+    int ntouched = 0, nsub = -1, ncands = 0, cand_cap = 0;
+    int rc = ERR_DB_FILE;
+
+    if (db->nshards)
+        return search_shards(db, query, out, max);
+    if (tri_map(db, &hdr, &map, &size) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    share = calloc(MAX_STD_ID + 1, 1);
+    flags = calloc(MAX_STD_ID + 1, 1);
+    touched = malloc((MAX_STD_ID + 1) * sizeof(uint32_t));
+    if (!share || !flags || !touched)
+        goto done;
+
+    const uint8_t *counts = map + hdr.counts_off;
+    const tri_entry_t *table = (const tri_entry_t *)(map + hdr.table_off);
+    const uint8_t *post = map + hdr.post_off;
+    const uint8_t *post_end = map + hdr.log_off;
+    const uint32_t *log = (const uint32_t *)(map + hdr.log_off);
+    size_t nlog = (size - hdr.log_off) / sizeof(uint32_t);
+    for (size_t i = 0; i < nlog; i++) {
+        if (log[i] <= MAX_STD_ID)
+            flags[log[i]] = TRI_DIRTY;
+    }
+
+    size_t qlen = strlen(query);
+    int nq = sort_unique(q, text_trigrams(query, qlen, true, q, 0, TRI_MAX_QUERY));
+    int ninner = sort_unique(inner, text_trigrams(query, qlen, false, inner, 0, TRI_MAX_QUERY));
+    if (nq == 0) {
+        rc = 0;
+        goto done;
+    }
+
+    //count shared trigrams for every indexed student
+    for (int k = 0; k < nq; k++) {
+        const tri_entry_t *e = find_trigram(table, hdr.ntrigrams, q[k]);
+        if (!e)
+            continue;
+        uint32_t *ids = decode_postings(post + e->off, post_end, e->count);
+        if (!ids)
+            goto done;
+        for (uint32_t i = 0; i < e->count; i++) {
+            if (ids[i] > MAX_STD_ID || (flags[ids[i]] & TRI_DIRTY))
+                continue;
+            if (share[ids[i]]++ == 0)
+                touched[ntouched++] = ids[i];
+        }
+        free(ids);
+    }
+
+    //students that have every inner trigram may contain the query as is,
+    //they share at least those trigrams so they are already touched
+    for (int k = 0; k < ninner && nsub != 0; k++) {
+        const tri_entry_t *e = find_trigram(table, hdr.ntrigrams, inner[k]);
+        uint32_t *ids = e ? decode_postings(post + e->off, post_end, e->count) : NULL;
+        if (e && !ids)
+            goto done;
+        if (nsub < 0) {
+            sub = ids;
+            nsub = e ? (int)e->count : 0;
+        } else {
+            nsub = ids ? intersect(sub, nsub, ids, e->count, sub) : 0;
+            free(ids);
+        }
+    }
+    for (int i = 0; i < nsub; i++) {
+        if (sub[i] <= MAX_STD_ID)
+            flags[sub[i]] |= TRI_SUBSTRING;
+    }
+
+    //candidates from the index, then every dirty id straight from the db
+    for (int i = 0; i < ntouched + (int)nlog; i++) {
+        uint32_t id = i < ntouched ? touched[i] : log[i - ntouched];
+        tri_cand_t c = {0};
+
+        if (i >= ntouched) {
+            if (id > MAX_STD_ID || !(flags[id] & TRI_DIRTY))
+                continue;
+            flags[id] = 0;
+        } else if (share[id] * 100 < TRI_MIN_SHARE * nq && !(flags[id] & TRI_SUBSTRING)) {
+            continue;
+        }
+
+        int grc = sdb_get(db, id, &c.student);
+        if (grc == SRCH_NOT_FOUND || grc == ERR_DB_ARGS)
+            continue;
+        if (grc != NO_ERROR)
+            goto done;
+
+        if (i < ntouched) {
+            c.share = share[id];
+            c.ntri = id <= hdr.max_id ? counts[id] : 0;
+        } else {
+            c.ntri = student_trigrams(&c.student, tri);
+            c.share = shared_trigrams(q, nq, tri, c.ntri);
+        }
+        c.substring = contains_ci(c.student.fname, sizeof(c.student.fname), query) ||
+                      contains_ci(c.student.lname, sizeof(c.student.lname), query);
+        if (!c.substring && c.share * 100 < TRI_MIN_SHARE * nq)
+            continue;
+
+        if (ncands == cand_cap) {
+            int cap = cand_cap ? cand_cap * 2 : 64;
+            tri_cand_t *more = realloc(cands, cap * sizeof(tri_cand_t));
+            if (!more)
+                goto done;
+            cands = more;
+            cand_cap = cap;
+        }
+        cands[ncands++] = c;
+    }
+
+    qsort(cands, ncands, sizeof(tri_cand_t), cmp_cand);
+    rc = ncands < max ? ncands : max;
+    for (int i = 0; i < rc; i++) {
+        out[i].student = cands[i].student;
+        out[i].score = nq ? cands[i].share * 100 / nq : 0;
+        out[i].substring = cands[i].substring;
+    }
+
+done:
+    if (map != MAP_FAILED)
+        io_munmap(map, size);
+    free(share);
+    free(flags);
+    free(touched);
+    free(sub);
+    free(cands);
+    return rc;
+}
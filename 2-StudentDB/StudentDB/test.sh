@@ -194,3 +194,507 @@ setup_file() {
 }
 
 
+@test "Export db to archive" {
+    run ./sdbsc -e student.sdba
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Exported 3 student record(s) to student.sdba." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Archive is smaller than the records it holds" {
+    run stat --format="%s" ./student.sdba
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" -lt 192 ] || {
+        echo "Archive size:  ${lines[0]}"
+        return 1
+    }
+}
+
+@test "Import archive into empty db" {
+    run ./sdbsc -z
+    [ "$status" -eq 0 ]
+
+    run ./sdbsc -r student.sdba
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Imported 3 student record(s) from student.sdba." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -p
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST_NAME LAST_NAME GPA 1 john doe 3.45 3 jane doe 3.90 63 jim doe 2.85"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+}
+
+@test "Import archive twice reports duplicates" {
+    run ./sdbsc -r student.sdba
+    rm -f student.sdba
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Cant add student with ID=1, already exists in db." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Migrate db to version 2" {
+    run ./sdbsc -m
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database migrated to version 2, 3 student record(s) converted." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -m
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database is already version 2." ]
+}
+
+@test "Version 2 db keeps the same records" {
+    run ./sdbsc -p
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST_NAME LAST_NAME GPA 1 john doe 3.45 3 jane doe 3.90 63 jim doe 2.85"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+}
+
+@test "Version 2 db add, find, delete and compress" {
+    run ./sdbsc -a 7 Maximiliano-Alejandro Featherstonehaugh-Cholmondeley-Smythe 400
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Student 7 added to database." ]
+
+    run ./sdbsc -a 7 dup student 300
+    [ "$status" -eq 1 ]
+
+    run ./sdbsc -d 3
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Student 3 was deleted from database." ]
+
+    run ./sdbsc -x
+    [ "$status" -eq 0 ]
+
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 3 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -f 7
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "7 Maximiliano-Alejandro Featherstonehaugh-Cholmondeley- 4.00" ] || {
+        echo "Failed Output:  $normalized_output"
+        return 1
+    }
+
+    # full names are kept in the heap rather than cut to the slot size
+    run grep -c "Featherstonehaugh-Cholmondeley-Smythe" student.db
+    [ "$status" -eq 0 ]
+}
+
+@test "Version 2 db stays version 2 when zeroed" {
+    run ./sdbsc -z
+    [ "$status" -eq 0 ]
+
+    run ./sdbsc -m
+    [ "${lines[0]}" = "Database is already version 2." ]
+
+    run ./sdbsc -p
+    [ "$output" = "Database contains no student records." ]
+}
+
+@test "Scrub a clean db" {
+    rm -f student.db student.db.crc
+    run ./sdbsc -a 1 john doe 345
+    run ./sdbsc -a 2 jane doe 390
+    run ./sdbsc -a 70 jim doe 285
+
+    run ./sdbsc --scrub
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Scrub checked 3 student record(s), 0 bad." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Scrub finds a corrupted record" {
+    # flip a byte in the first name of student 2
+    printf 'X' | dd of=student.db bs=1 seek=$((2 * 64 + 5)) conv=notrunc 2>/dev/null
+
+    run ./sdbsc --scrub 2
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Student slot 2 failed its checksum." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "${lines[1]}" = "Scrub checked 3 student record(s), 1 bad." ]
+}
+
+@test "Scrub a version 2 db" {
+    run ./sdbsc -d 2
+    run ./sdbsc -m
+    [ "$status" -eq 0 ]
+
+    run ./sdbsc --scrub
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Scrub checked 2 student record(s), 0 bad." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    # the first heap record starts on the first page after the directory
+    printf 'X' | dd of=student.db bs=1 seek=$((802816 + 8)) conv=notrunc 2>/dev/null
+    run ./sdbsc --scrub
+    rm -f student.db student.db.crc
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Student slot 1 failed its checksum." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Batch add next to a corrupted record leaves it failing" {
+    run ./sdbsc -a 1 john doe 345
+    printf 'X' | dd of=student.db bs=1 seek=$((1 * 64 + 5)) conv=notrunc 2>/dev/null
+
+    printf '1,again,roe,100\n2,new,student,200\n' > student.csv
+    run ./sdbsc -I student.csv
+    rm -f student.csv
+    [ "$status" -eq 1 ]
+
+    run ./sdbsc --scrub
+    rm -f student.db student.db.crc
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Student slot 1 failed its checksum." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "${lines[1]}" = "Scrub checked 2 student record(s), 1 bad." ]
+}
+
+@test "Session runs commands from stdin" {
+    run bash -c "printf 'add 1 john doe 345\nfind 1\n# comment\n\ndel 1\ncount\n' | ./sdbsc -i"
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Student 1 added to database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "${lines[2]}" = "1      john                     doe                              3.45" ]
+    [ "${lines[3]}" = "Student 1 was deleted from database." ]
+    [ "${lines[4]}" = "Database contains no student records." ]
+}
+
+@test "Session script with timing and a bad command" {
+    printf 'add 5 jane doe 390\nfrobnicate\nfind 5\n' > session.txt
+    run ./sdbsc -i -t session.txt
+    rm -f session.txt student.db student.db.crc
+    [ "$status" -eq 2 ]
+    [ "${lines[0]}" = "Student 5 added to database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [[ "${lines[1]}" =~ ^"# add took " ]]
+    [ "${lines[2]}" = "Line 2: unknown command or wrong arguments: frobnicate" ]
+    [[ "${lines[5]}" =~ ^"# find took " ]]
+}
+
+@test "CSV import loads rows and reports bad ones in line order" {
+    printf 'id,first,last,gpa\n1,john,doe,345\n2, jane , roe ,3.9\nnot a row\n1,dup,dup,100\n' > student.csv
+    run ./sdbsc -I student.csv 2
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Line 4: not a valid student row." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "${lines[1]}" = "Line 5: cant add student with ID=1, already exists in db." ]
+    [ "${lines[2]}" = "Imported 2 student record(s) from student.csv." ]
+
+    run ./sdbsc -f 2
+    rm -f student.csv
+    [ "${lines[1]}" = "2      jane                     roe                              3.90" ]
+}
+
+@test "CSV import skips ids already in the db" {
+    printf '2,again,roe,100\n3,new,student,200\n' > student.csv
+    run ./sdbsc -I student.csv
+    rm -f student.csv student.db student.db.crc
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Line 1: cant add student with ID=2, already exists in db." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "${lines[1]}" = "Imported 1 student record(s) from student.csv." ]
+}
+
+@test "Delete by filter removes only matching students" {
+    printf '1,john,doe,145\n2,jane,doe,350\n3,jim,roe,120\n4,jill,roe,390\n' > student.csv
+    run ./sdbsc -I student.csv
+    rm -f student.csv
+
+    run ./sdbsc -D 'gpa<200,lname=doe'
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Deleted 1 student record(s) matching gpa<200,lname=doe." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -D 'gpa<2.0' --punch
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Deleted 1 student record(s) matching gpa<2.0." ]
+
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 2 student record(s)." ]
+    run ./sdbsc --scrub
+    [ "$status" -eq 0 ]
+}
+
+@test "Delete by filter rejects a bad filter" {
+    run ./sdbsc -D 'age>20'
+    rm -f student.db student.db.crc
+    [ "$status" -eq 2 ]
+    [ "${lines[0]}" = "Invalid filter: age>20" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Delete by filter leaves a corrupted record between matches failing" {
+    printf '1,john,doe,350\n2,jane,doe,145\n3,jim,roe,300\n4,jill,roe,120\n' > student.csv
+    run ./sdbsc -I student.csv
+    rm -f student.csv
+    printf 'X' | dd of=student.db bs=1 seek=$((3 * 64 + 5)) conv=notrunc 2>/dev/null
+
+    run ./sdbsc -D 'gpa<200'
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Deleted 2 student record(s) matching gpa<200." ]
+
+    run ./sdbsc --scrub
+    rm -f student.db student.db.crc
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Student slot 3 failed its checksum." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "${lines[1]}" = "Scrub checked 2 student record(s), 1 bad." ]
+}
+
+@test "Print ordered by last name and by gpa" {
+    printf '1,amy,zed,300\n2,bob,adams,390\n3,cal,moss,120\n4,dee,adams,120\n' > student.csv
+    run ./sdbsc -I student.csv
+    rm -f student.csv
+
+    run ./sdbsc -p --order-by lname
+    [ "$status" -eq 0 ]
+    [ "${lines[1]}" = "2      bob                      adams                            3.90" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "${lines[2]}" = "4      dee                      adams                            1.20" ]
+    [ "${lines[4]}" = "1      amy                      zed                              3.00" ]
+
+    run ./sdbsc -p --order-by gpa
+    [ "$status" -eq 0 ]
+    [ "${lines[1]}" = "3      cal                      moss                             1.20" ]
+    [ "${lines[4]}" = "2      bob                      adams                            3.90" ]
+    rm -f student.db student.db.crc
+}
+
+@test "Ordered print spills to disk under a small memory budget" {
+    seq 1 5000 | awk '{ printf "%d,f%d,n%d,%d\n", $1, $1, (($1 * 7919) % 5000), $1 % 501 }' > student.csv
+    run ./sdbsc -I student.csv
+    rm -f student.csv
+
+    ./sdbsc -p --order-by lname > sorted_mem.txt
+    ./sdbsc -p --order-by lname --mem 64 > sorted_disk.txt
+    run cmp sorted_mem.txt sorted_disk.txt
+    rm -f sorted_mem.txt sorted_disk.txt student.db student.db.crc
+    [ "$status" -eq 0 ]
+}
+
+@test "Name search finds substrings and misspellings" {
+    printf '1,john,smith,300\n2,jane,smyth,310\n3,jim,brown,320\n4,ann,goldsmith,330\n' > student.csv
+    run ./sdbsc -I student.csv
+    rm -f student.csv
+
+    run ./sdbsc -q smith
+    [ "$status" -eq 0 ]
+    [ "${lines[1]}" = "1      john                     smith                            3.00  100%" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "${lines[2]}" = "4      ann                      goldsmith                        3.30  100%" ]
+    [ "${lines[3]}" = "2      jane                     smyth                            3.10   50%" ]
+    [ "${#lines[@]}" -eq 4 ]
+}
+
+@test "Name search index follows adds and deletes" {
+    run ./sdbsc -d 1
+    run ./sdbsc -a 5 sue smithson 340
+
+    run ./sdbsc -q smith
+    rm -f student.db student.db.crc student.db.tri
+    [ "$status" -eq 0 ]
+    [ "${lines[1]}" = "5      sue                      smithson                         3.40  100%" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "${lines[2]}" = "4      ann                      goldsmith                        3.30  100%" ]
+    [ "${#lines[@]}" -eq 4 ]
+}
+
+@test "Name search rebuilds a damaged index" {
+    printf '1,aaron,smith,300\n2,bob,aardvark,360\n' > student.csv
+    run ./sdbsc -I student.csv
+    rm -f student.csv
+    run ./sdbsc -q aa
+    [ "$status" -eq 0 ]
+
+    # a trigram count far past the end of the file, then a file cut short
+    printf '\377\377\377\177' | dd of=student.db.tri bs=1 seek=8 conv=notrunc 2>/dev/null
+    run ./sdbsc -q aa
+    [ "$status" -eq 0 ]
+    [ "${lines[1]}" = "1      aaron                    smith                            3.00  100%" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    truncate -s 10 student.db.tri
+    run ./sdbsc -q aa
+    rm -f student.db student.db.crc student.db.tri
+    [ "$status" -eq 0 ]
+    [ "${#lines[@]}" -eq 3 ]
+}
+
+@test "Sharding keeps every student and prints in id order" {
+    printf '5,eve,stone,350\n1,amy,zed,300\n9,bob,adams,390\n2,cal,moss,120\n7,dee,fox,220\n' > student.csv
+    run ./sdbsc -I student.csv
+    rm -f student.csv
+
+    run ./sdbsc --shard hash 3
+    [ "$status" -eq 0 ]
+    [ "$output" = "Database split into 3 shard(s), 5 student record(s) moved." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "$(head -c 4 student.db)" = "SDBS" ]
+
+    run ./sdbsc -p
+    [ "$status" -eq 0 ]
+    [ "${lines[1]}" = "1      amy                      zed                              3.00" ]
+    [ "${lines[2]}" = "2      cal                      moss                             1.20" ]
+    [ "${lines[5]}" = "9      bob                      adams                            3.90" ]
+    [ "${#lines[@]}" -eq 6 ]
+
+    run ./sdbsc --shard range 2
+    [ "$status" -eq 1 ]
+    [ "$output" = "Database is already sharded." ]
+}
+
+@test "Sharded database routes lookups and fans out filters" {
+    run ./sdbsc -a 4 fay lee 280
+    [ "$status" -eq 0 ]
+    [ "$output" = "Student 4 added to database." ]
+
+    run ./sdbsc -f 7
+    [ "$status" -eq 0 ]
+    [ "${lines[1]}" = "7      dee                      fox                              2.20" ]
+
+    run ./sdbsc -D "gpa<250"
+    [ "$status" -eq 0 ]
+    [ "$output" = "Deleted 2 student record(s) matching gpa<250." ]
+
+    run ./sdbsc -c
+    [ "$output" = "Database contains 4 student record(s)." ]
+
+    run ./sdbsc --scrub
+    rm -f student.db student.db.[0-9]*
+    [ "$status" -eq 0 ]
+    [ "$output" = "Scrub checked 4 student record(s), 0 bad." ]
+}
+
+@test "Direct scans match buffered scans on both versions" {
+    seq 1 3 3000 | awk '{ printf "%d,f%d,n%d,%d\n", $1, $1, $1 % 97, $1 % 501 }' > student.csv
+    run ./sdbsc -I student.csv
+    rm -f student.csv
+
+    ./sdbsc -p > buffered.txt
+    ./sdbsc -p --direct > direct.txt
+    run cmp buffered.txt direct.txt
+    [ "$status" -eq 0 ]
+
+    run ./sdbsc --direct -m
+    [ "$status" -eq 0 ]
+    [ "$output" = "Database migrated to version 2, 1000 student record(s) converted." ]
+    ./sdbsc -p --direct > direct.txt
+    run cmp buffered.txt direct.txt
+    rm -f buffered.txt direct.txt student.db student.db.crc
+    [ "$status" -eq 0 ]
+}
+
+@test "Stats report I/O on stderr without touching stdout" {
+    ./sdbsc -a 1 ann ash 300
+    ./sdbsc -a 70000 bob bay 200
+
+    ./sdbsc -p > plain.txt
+    ./sdbsc -p --stats=json > out.txt 2> stats.txt
+    run cmp plain.txt out.txt
+    [ "$status" -eq 0 ]
+    run grep -c '"scan":{"calls":1,' stats.txt
+    [ "$output" = "1" ]
+    run grep -c '"records_live":2,' stats.txt
+    [ "$output" = "1" ]
+
+    # the ids in between were never written, the scan skips that hole
+    run grep -c '"holes_skipped":0}' stats.txt
+    [ "$output" = "0" ]
+
+    SDB_STATS=1 ./sdbsc -f 1 > out.txt 2> stats.txt
+    run grep -c '^lookup  *1 calls' stats.txt
+    rm -f plain.txt out.txt stats.txt student.db student.db.crc
+    [ "$output" = "1" ]
+}
+
+@test "GPA index answers ranges and ranks and follows changes" {
+    printf '1,ann,ash,350\n2,bob,bay,400\n3,cal,cox,280\n4,dee,dow,350\n5,eve,eng,390\n' > student.csv
+    run ./sdbsc -I student.csv
+    rm -f student.csv
+
+    run ./sdbsc -g 350 400
+    [ "$status" -eq 0 ]
+    [ "${lines[1]}" = "1      ann                      ash                              3.50" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "${lines[2]}" = "4      dee                      dow                              3.50" ]
+    [ "${lines[3]}" = "5      eve                      eng                              3.90" ]
+    [ "${lines[4]}" = "2      bob                      bay                              4.00" ]
+    [ "${#lines[@]}" -eq 5 ]
+
+    # changes after the index was built are merged in without a rebuild
+    ./sdbsc -d 5
+    ./sdbsc -a 6 fay fox 360
+    run ./sdbsc -g 355 395
+    [ "${lines[1]}" = "6      fay                      fox                              3.60" ]
+    [ "${#lines[@]}" -eq 2 ]
+
+    run ./sdbsc -k 4
+    [ "$status" -eq 0 ]
+    [ "$output" = "Student 4 ranks 3 of 5 by GPA." ]
+    run ./sdbsc -k 3
+    [ "$output" = "Student 3 ranks 5 of 5 by GPA." ]
+
+    run ./sdbsc -g 400 350
+    rm -f student.db student.db.crc student.db.gpa
+    [ "$status" -eq 2 ]
+}